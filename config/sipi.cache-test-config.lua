@@ -0,0 +1,29 @@
+--
+-- Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+-- Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+-- This file is part of Sipi.
+-- Sipi is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU Affero General Public License as published
+-- by the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+-- Sipi is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+-- Additional permission under GNU AGPL version 3 section 7:
+-- If you modify this Program, or any covered work, by linking or combining
+-- it with Kakadu (or a modified version of that library) or Adobe ICC Color
+-- Profiles (or a modified version of that library) or both, containing parts
+-- covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+-- or both, the licensors of this Program grant you additional permission
+-- to convey the resulting work.
+-- You should have received a copy of the GNU Affero General Public
+-- License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+-- Configuration file for the tests of the cache eviction: the configuration for use with nginx to simulate Knora,
+-- with a cache that is full with 10 files, and is purged down to 7 files.
+--
+dofile('./config/sipi.fake-knora-test-config.lua')
+
+sipi.cache_nfiles = 10
+sipi.cache_hysteresis = 0.25
@@ -48,6 +48,24 @@ sipi = {
     --
     nthreads = 8,
 
+    --
+    -- Maximal number of threads used to decode a single JPEG2000 image. This limits the share
+    -- of the processors one (large) request can get. 0 means all available processors.
+    --
+    jpx_threads = 4,
+
+    --
+    -- Maximal number of threads working on one image operation (scaling, rotation, color
+    -- conversion etc.). The threads are shared by all requests. 0 means all available processors.
+    --
+    image_threads = 4,
+
+    --
+    -- Coding parameters for the JPEG2000 files written by SIPI. 'iiif' writes tiled files with
+    -- packet length markers which are much faster for region requests, 'default' writes untiled files.
+    --
+    jpx_profile = 'iiif',
+
     --
     -- Number of seconds a connection (socket) remains open at maximum ("keep-alive")
     --
@@ -123,6 +141,25 @@ sipi = {
     --
     cache_hysteresis = 0.15,
 
+    --
+    -- number of seconds a decision of the pre_flight function granting access ("allow" or "restrict")
+    -- is reused for further requests with the same prefix, identifier and cookie. 0 (default) disables
+    -- the reuse, and pre_flight is called for every request. Only decisions for which pre_flight returns
+    -- true as last value are reused (e.g. "return 'allow', filepath, true"). Since the other request data
+    -- (e.g. the Authorization header, the client address or the query parameters) is not part of the key,
+    -- pre_flight must not opt in if its decision depends on it.
+    --
+    preflight_ttl = 0,
+
+    --
+    -- number of seconds a decision of the pre_flight function denying access is reused (0: disabled).
+    -- Every other result than "allow" or "restrict" counts as a denial. As above, only decisions for
+    -- which pre_flight returns true as last value are reused, so a 'deny' because the permission service
+    -- could not be reached should be returned without it (as sipi.init-knora.lua does when server.http
+    -- fails). preflight_cache.invalidate() forgets the decisions early.
+    --
+    preflight_negative_ttl = 0,
+
     --
     -- Path to the directory where the scripts for the routes defined below are to be found
     --
@@ -144,6 +181,7 @@ sipi = {
     -- # openssl genrsa -out key.pem 2048
     -- # openssl req -new -key key.pem -out csr.pem
     -- #openssl req -x509 -days 365 -key key.pem -in csr.pem -out certificate.pem
+    -- Certificate and key are read at startup and again whenever the server receives SIGHUP.
     --
     ssl_certificate = './certificate/certificate.pem',
 
@@ -39,6 +39,11 @@ sipi = {
     --
     keep_alive = 5,
 
+    --
+    -- Number of threads to use (enough for the concurrent requests of the tests to wait for each other)
+    --
+    nthreads = 16,
+
     --
     -- indicates the path to the root of the image directory. Depending on the settings of the variable
     -- "prefix_as_path" the images are search at <imgroot>/<prefix>/<imageid> (prefix_as_path = TRUE)
@@ -73,6 +78,16 @@ sipi = {
     --
     cache_hysteresis = 0.1,
 
+    --
+    -- number of seconds a decision of the pre_flight function granting access is reused
+    --
+    preflight_ttl = 5,
+
+    --
+    -- number of seconds a decision of the pre_flight function denying access is reused
+    --
+    preflight_negative_ttl = 2,
+
     --
     -- Path to the directory where the scripts for the routes defined below are to be found
     --
@@ -172,5 +187,35 @@ routes = {
         method = 'GET',
         route = '/test_knora_session_cookie',
         script = 'test_knora_session_cookie.lua'
+    },
+    {
+        method = 'GET',
+        route = '/test_lua_globals',
+        script = 'test_lua_globals.lua'
+    },
+    {
+        method = 'GET',
+        route = '/test_preflight_cache',
+        script = 'test_preflight_cache.lua'
+    },
+    {
+        method = 'GET',
+        route = '/test_cache',
+        script = 'test_cache.lua'
+    },
+    {
+        method = 'GET',
+        route = '/test_http_client',
+        script = 'test_http_client.lua'
+    },
+    {
+        method = 'POST',
+        route = '/test_http_echo',
+        script = 'test_http_echo.lua'
+    },
+    {
+        method = 'PUT',
+        route = '/test_http_echo',
+        script = 'test_http_echo.lua'
     }
 }
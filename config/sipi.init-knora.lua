@@ -36,6 +36,8 @@ require "get_knora_session"
 --       'restrict:size=<iiif-size-string>' : reduce size/resolution
 --       'deny' : no access!
 --    filepath: server-path where the master file is located
+--    cacheable: true if the decision may be reused for the same prefix, identifier and cookie
+--       (see preflight_ttl and preflight_negative_ttl)
 -------------------------------------------------------------------------------
 function pre_flight(prefix, identifier, cookie)
 
@@ -47,12 +49,12 @@ function pre_flight(prefix, identifier, cookie)
 
     if prefix == "thumbs" then
         -- always allow thumbnails
-        return 'allow', filepath
+        return 'allow', filepath, true
     end
 
     if prefix == "tmp" then
         -- always deny access to tmp folder
-        return 'deny'
+        return 'deny', true
     end
 
 
@@ -81,7 +83,7 @@ function pre_flight(prefix, identifier, cookie)
 
         success, result = server.http("GET", knora_url, knora_cookie_header, 5000)
 
-        -- check HTTP request was successful
+        -- check HTTP request was successful (the failure may be transient, so the denial is not cached)
         if not success then
             server.log("Server.http() failed: " .. result, server.loglevel.LOG_ERR)
             return 'deny'
@@ -90,7 +92,7 @@ function pre_flight(prefix, identifier, cookie)
         if result.status_code ~= 200 then
             server.log("Knora returned HTTP status code " .. result.status_code)
             server.log(result.body)
-            return 'deny'
+            return 'deny', true
         end
 
         success, response_json = server.json_to_table(result.body)
@@ -104,19 +106,19 @@ function pre_flight(prefix, identifier, cookie)
 
         if response_json.status ~= 0 then
             -- something went wrong with the request, Knora returned a non zero status
-            return 'deny'
+            return 'deny', true
         end
 
         if response_json.permissionCode == 0 then
             -- no view permission on file
-            return 'deny'
+            return 'deny', true
         elseif response_json.permissionCode == 1 then
             -- restricted view permission on file
             -- either watermark or size (depends on project, should be returned with permission code by Sipi responder)
-            return 'restrict:size=' .. config.thumb_size, filepath
+            return 'restrict:size=' .. config.thumb_size, filepath, true
         elseif response_json.permissionCode >= 2 then
             -- full view permissions on file
-            return 'allow', filepath
+            return 'allow', filepath, true
         else
             -- invalid permission code
             return 'deny'
@@ -26,12 +26,20 @@
 
 #include <ctime>
 #include <unordered_map>
+#include <list>
+#include <deque>
+#include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <sys/time.h>
 #include <algorithm>
 
 #include "SipiConfig.h"
+#include "SipiCacheJournal.h"
 
 namespace Sipi {
 
@@ -51,8 +59,8 @@ namespace Sipi {
         } SortMethod;
 
         /*!
-         * A struct which is used to read/write the file containing all cache information on
-         * server start or server shutdown.
+         * A struct which was used to write the index of the cache to the file ".sipicache" on server
+         * shutdown. Such a file is still read on startup and converted to the journal.
          */
         typedef struct {
             size_t img_w, img_h;
@@ -100,6 +108,16 @@ namespace Sipi {
 #endif
         } SizeRecord;
 
+        /*!
+         * Progress of the reconciliation of the cache directory with the index after startup
+         */
+        typedef struct {
+            bool running; //!< the reconciliation is still running
+            unsigned long long scanned; //!< number of files in the cache directory checked
+            unsigned long long removed; //!< number of files removed because they are not in the index
+            unsigned long long missing; //!< number of entries dropped because their file does not exist
+        } ReconcileStats;
+
         /*!
          * This is the prototype function to used as parameter for the method SipiCache::loop
          * which is applied to all cached files.
@@ -107,23 +125,153 @@ namespace Sipi {
         typedef void (*ProcessOneCacheFile)(int index, const std::string &, const SipiCache::CacheRecord &,
                                             void *userdata);
 
+        /*!
+         * Handle of a request which renders a canonical URL that is not yet in the cache. Identical
+         * requests arriving in the meantime wait for the rendering instead of doing the same work
+         * again (see SipiCache::startRendering). The rendering ends with finish(), or as failed when
+         * the last copy of the handle is destroyed.
+         */
+        class Rendering {
+            friend class SipiCache;
+
+        private:
+            SipiCache *cache;
+            std::string canonical; //!< empty if the request is not coalesced
+            bool finished;
+
+            Rendering(SipiCache *cache_p, const std::string &canonical_p);
+
+        public:
+            ~Rendering();
+
+            /*!
+             * Ends the rendering and wakes up the requests waiting for it
+             *
+             * \param[in] ok true, if the rendered file has been added to the cache
+             */
+            void finish(bool ok);
+        };
+
+        static int render_wait; //!< maximal number of seconds a request waits for an identical request
+        static unsigned render_waiters; //!< maximal number of requests waiting for identical requests at a time
+
     private:
-        std::mutex locking;
+        /*!
+         * A rendering in progress, shared by all requests waiting for it
+         */
+        typedef struct {
+            bool done;
+            bool ok;
+            std::condition_variable cond;
+        } Flight;
+
+        /*!
+         * Entry of the cache index. The canonical URLs of a shard are kept in a list ordered by the
+         * last access (most recent first): an access moves an entry to the front in constant time,
+         * and the least recently used file of the shard is always at the end.
+         */
+        typedef struct {
+            CacheRecord record;
+            std::list<std::string>::iterator lru; //!< position in the LRU list of the shard
+        } CacheEntry;
+
+        /*!
+         * The index is split into shards by the hash of the key, each with its own lock, so that
+         * concurrent requests rarely wait for each other.
+         */
+        typedef struct {
+            std::mutex lock;
+            std::unordered_map<std::string, CacheEntry> cachetable; //!< cached files by canonical URL
+            std::list<std::string> lru; //!< canonical URLs of cachetable, most recently used first
+            std::unordered_map<std::string, SizeRecord> sizetable; //!< image sizes by original path
+        } Shard;
+
+        static const size_t nshards = 16;
+        Shard shards[nshards];
+        std::mutex purging; //!< only one purge at a time
+
+        std::mutex flights_lock;
+        std::unordered_map<std::string, std::shared_ptr<Flight>> flights; //!< renderings in progress
+        unsigned nwaiting; //!< number of requests waiting for a rendering (flights_lock)
+
+        std::thread evictor; //!< purges the cache and removes evicted files in the background
+        std::mutex evictor_lock;
+        std::condition_variable evictor_cond;
+        std::deque<std::string> doomed; //!< paths of the files to be removed (evictor_lock)
+        bool closing; //!< the evictor has to stop once all files are removed (evictor_lock)
+
+        std::thread reconciler; //!< checks the cache directory against the index after startup
+        std::atomic<bool> reconciling; //!< the reconciler is running
+        std::atomic<unsigned long long> reconcile_scanned; //!< number of files checked by the reconciler
+        std::atomic<unsigned long long> reconcile_removed; //!< number of files not in the index removed
+        std::atomic<unsigned long long> reconcile_missing; //!< number of entries without a file dropped
+        std::unordered_map<std::string, std::string> startup_files; //!< canonical URLs by cache file (reconciler)
+
         std::string _cachedir; //!< path to the cache directory
-        std::unordered_map<std::string, CacheRecord> cachetable; //!< Internal map of all cached files
-        std::unordered_map<std::string, SizeRecord> sizetable; //!< Internal map of original file paths and image size
-        unsigned long long cachesize; //!< number of bytes in the cache
+        SipiCacheJournal journal; //!< the index on disk, updated with every change
+        std::atomic<unsigned long long> cachesize; //!< number of bytes in the cache
         unsigned long long max_cachesize; //!< maximum number of bytes that can be cached
-        unsigned nfiles; //!< number of files in cache
+        std::atomic<unsigned> nfiles; //!< number of files in cache
         unsigned max_nfiles; //!< maximum number of files that can be cached
-        float cache_hysteresis; //!< If files are purged, what percentage we go below the maximum
+        float cache_hysteresis; //!< If files are purged, what fraction of the maximum is cleared
+
+        inline Shard &shard(const std::string &key) { return shards[std::hash<std::string>()(key) % nshards]; }
+
+        /*!
+         * Returns true if the cache reaches the given fraction of one of its limits
+         *
+         * \param[in] fraction 1.0 for the limits themselves (high watermark), 1.0 - cache_hysteresis
+         * for the level a purge goes down to (low watermark)
+         */
+        bool exceeds(double fraction);
+
+        /*!
+         * Returns true if the cache reaches one of its limits
+         */
+        inline bool full(void) { return exceeds(1.0); }
+
+        /*!
+         * Inserts or replaces an entry of the index. The shard has to be locked.
+         */
+        void insert(Shard &shard_p, const std::string &canonical_p, const CacheRecord &record_p);
+
+        /*!
+         * Removes an entry from the index and its file from the disk. The shard has to be locked.
+         */
+        void erase(Shard &shard_p, std::unordered_map<std::string, CacheEntry>::iterator entry_p);
+
+        /*!
+         * Body of the evictor thread: purges the cache whenever it is full, removes the files of
+         * evicted entries from the disk, and writes and compacts the journal
+         */
+        void evict(void);
+
+        /*!
+         * Body of the reconciler thread: removes the files in the cache directory that are not in the
+         * index, and the entries of the index whose file does not exist
+         *
+         * \param[in] started Time of the startup; files created later belong to new entries
+         */
+        void reconcile(time_t started);
+
+        /*!
+         * Returns the journal records of all entries of the index
+         */
+        std::vector<std::string> snapshot(void);
+
+        /*!
+         * Replaces the journal by a snapshot of the index
+         */
+        void compact(void);
+
     public:
 
         /*!
          * Create a Cache instance an initialized the cache.
          *
-         * Create the cache, read if available, the cache file containing all the files that
-         * are already in the cache directory. The size of the cache can be limited to a maximum number
+         * Create the cache, read if available, the journal of the index of all the files that
+         * are already in the cache directory. The files in the cache directory are checked against the
+         * index in the background, so that the cache can be used at once. The size of the cache can be limited to a maximum number
          * of files and a maxi,um size in bytes. The first limit that is readed will purge the cache.
          *
          * \param[in] cachedir_p Path to the cache directory. The directory must exist!
@@ -137,8 +285,8 @@ namespace Sipi {
                   float cache_hysteresis_p = 0.1);
 
         /*!
-         * Cleans up the cache, serializes the actual cache content into a file and closes all caching
-         * activities.
+         * Cleans up the cache, compacts the journal (which also saves the last access times) and closes
+         * all caching activities.
          */
         ~SipiCache();
 
@@ -159,14 +307,14 @@ namespace Sipi {
 #endif
 
         /*!
-         * Purge the cache to make room for more files. Uses the cache_hysteresis, max_cachesize and max_nfiles values
-         * for the amount of files that should be purged.
-         *
-         * \param[in] Use the cache-lock mutex
+         * Purge the cache to make room for more files. Once max_cachesize or max_nfiles is reached, the least
+         * recently used files are purged until the cache is cache_hysteresis below both limits. The files are
+         * removed from the index at once and from the disk in the background. A full cache is purged by the
+         * evictor thread anyway; this method is for purging it explicitly.
          *
          * \returns Number of files being purged.
          */
-        int purge(bool use_lock = true);
+        int purge(void);
 
         /*!
          * check if a file is already in the cache and up-to-date
@@ -179,6 +327,25 @@ namespace Sipi {
          */
         std::string check(const std::string &origpath_p, const std::string &canonical_p);
 
+        /*!
+         * Check if a file is in the cache and, if not, whether an identical request is already
+         * rendering it. In this case the call waits until the other request has added the file
+         * to the cache (at most render_wait seconds), so that concurrent cache misses of the same
+         * canonical URL are rendered only once. Since the rendered file is complete only once it
+         * has been sent to the client of the other request, a waiting request occupies a worker
+         * thread for as long as that client takes; if render_waiters requests are already waiting,
+         * the file is rendered again instead.
+         *
+         * \param[in] origpath_p The original path to the master file
+         * \param[in] canonical_p The canonical URL according to the IIIF standard
+         * \param[out] cachepath_p The path of the cached file, or empty if the file has to be rendered
+         *
+         * \returns nullptr if the file is cached. Otherwise a handle which has to be kept until the
+         *          rendered file has been added to the cache, or the rendering has failed.
+         */
+        std::shared_ptr<Rendering> startRendering(const std::string &origpath_p, const std::string &canonical_p,
+                                                  std::string &cachepath_p);
+
         /*!
          * Creates a new cache file with a unique name.
          *
@@ -187,7 +354,8 @@ namespace Sipi {
         std::string getNewCacheFileName(void);
 
         /*!
-         * Add (or replace) a file to the cache.
+         * Add (or replace) a file to the cache. This only updates the in-memory index; if the cache
+         * becomes full, it is purged by the evictor thread.
          *
          * \param[in] origpath_p Path to the original master file
          * \param[in] canonical_p Canonical IIIF URL
@@ -227,6 +395,15 @@ namespace Sipi {
          */
         inline unsigned getMaxNfiles(void) { return max_nfiles; }
 
+        /*!
+         * Get the progress of the reconciliation of the cache directory with the index
+         * \returns Statistics of the reconciliation
+         */
+        inline ReconcileStats getReconcileStats(void) {
+            ReconcileStats stats = {reconciling, reconcile_scanned, reconcile_removed, reconcile_missing};
+            return stats;
+        }
+
         /*!
          * get the path to the cache directory
          * \returns Path of the cache directory
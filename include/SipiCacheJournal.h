@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __defined_sipi_cache_journal_h
+#define __defined_sipi_cache_journal_h
+
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <functional>
+
+namespace Sipi {
+
+    /*!
+     * SipiCacheJournal is an append-only file of records, used to keep the index of the cache on disk.
+     * Every change of the index is appended as a record, so that the index survives a crash of the
+     * server. The records are buffered in memory and written by flush(), which has to be called
+     * regularly. Every record carries its length and a CRC-32 checksum; a record that has been torn
+     * by a crash, and everything after it, is ignored by replay(). Since the journal grows with every
+     * change, it has to be compacted from time to time by rewrite(), which replaces it atomically
+     * with a snapshot of the index.
+     *
+     * The journal does not know the meaning of the records, they are encoded by SipiCache.
+     */
+    class SipiCacheJournal {
+    private:
+        std::string path; //!< path of the journal file
+        int fd; //!< file descriptor of the journal opened for appending, -1 if not open
+        std::mutex lock;
+        std::string pending; //!< records not yet written to the file
+        size_t npending; //!< number of records in pending
+        size_t nwritten; //!< number of records in the file
+        off_t valid_end; //!< end of the last valid record found by replay()
+
+        static void frame(std::string &buf, const std::string &record);
+
+        bool writeAll(int fd_p, const std::string &buf);
+
+    public:
+        /*!
+         * Creates a journal. The file is not opened before open() or rewrite() have been called.
+         *
+         * \param[in] path_p Path of the journal file
+         */
+        SipiCacheJournal(const std::string &path_p);
+
+        /*!
+         * Writes the pending records and closes the journal
+         */
+        ~SipiCacheJournal();
+
+        /*!
+         * Reads all valid records of the journal file
+         *
+         * \param[in] apply Function called with every record, in the order they have been appended
+         *
+         * \returns Number of valid records read
+         */
+        size_t replay(const std::function<void(const std::string &)> &apply);
+
+        /*!
+         * Opens the journal for appending after replay(). An incomplete record at the end of the file
+         * is cut off, and a new journal is created if there is none.
+         */
+        void open(void);
+
+        /*!
+         * Replaces the journal file by the given records and opens it for appending. The new file is
+         * written next to the old one and renamed when it is complete, so that there is always a valid
+         * journal on disk. Records appended while the snapshot is being written are kept and written
+         * to the new journal; they must be idempotent with respect to the snapshot.
+         *
+         * \param[in] records Snapshot of the index, usually taken after a flush()
+         */
+        void rewrite(const std::vector<std::string> &records);
+
+        /*!
+         * Appends a record. It is only kept in memory until the next flush(). Records appended before
+         * the journal has been opened by open() or rewrite() are dropped.
+         *
+         * \param[in] record Record to be appended
+         */
+        void append(const std::string &record);
+
+        /*!
+         * Writes the pending records to the journal file and syncs it to the disk
+         */
+        void flush(void);
+
+        /*!
+         * Get the number of records in the journal (used to decide whether it should be compacted)
+         */
+        size_t size(void);
+    };
+
+}
+
+#endif
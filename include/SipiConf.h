@@ -57,7 +57,12 @@ namespace Sipi {
         int keep_alive;
         std::string thumb_size;
         int cache_n_files;
+        int preflight_ttl; //<! lifetime of pre-flight decisions granting access (seconds)
+        int preflight_negative_ttl; //<! lifetime of pre-flight decisions denying access (seconds)
         int n_threads;
+        int jpx_threads; //<! maximal number of threads used to decode one JPEG2000 image
+        int image_threads; //<! maximal number of threads used for one image operation (scaling, rotation etc.)
+        std::string jpx_profile; //<! coding parameters for writing JPEG2000 files ("default" or "iiif")
         size_t max_post_size;
         std::string tmp_dir;
         std::string scriptdir;
@@ -115,8 +120,18 @@ namespace Sipi {
 
         inline int getCacheNFiles(void) { return cache_n_files; }
 
+        inline int getPreflightTtl(void) { return preflight_ttl; }
+
+        inline int getPreflightNegativeTtl(void) { return preflight_negative_ttl; }
+
         inline int getNThreads(void) { return n_threads; }
 
+        inline int getJpxThreads(void) { return jpx_threads; }
+
+        inline int getImageThreads(void) { return image_threads; }
+
+        inline std::string getJpxProfile(void) { return jpx_profile; }
+
         inline size_t getMaxPostSize(void) { return max_post_size; }
 
         inline std::string getTmpDir(void) { return tmp_dir; }
@@ -41,6 +41,7 @@
 #include "iiifparser/SipiRotation.h"
 #include "iiifparser/SipiQualityFormat.h"
 #include "SipiCache.h"
+#include "SipiPreflightCache.h"
 
 #include "lua.hpp"
 
@@ -63,6 +64,7 @@ namespace Sipi {
         std::vector<std::string> _dirs_to_exclude; //!< Directories which should habe no subdirs even if subdirs are enabled
         std::string _logfile;
         std::shared_ptr<SipiCache> _cache;
+        std::shared_ptr<SipiPreflightCache> _preflight_cache; //!< decisions of the pre-flight function, or nullptr
 
     public:
         /*!
@@ -105,6 +107,18 @@ namespace Sipi {
 
         inline std::shared_ptr<SipiCache> cache() { return _cache; }
 
+        /*!
+         * Reuse the decisions of the Lua pre-flight function (see SipiPreflightCache)
+         *
+         * \param ttl_p Number of seconds decisions granting access are reused
+         * \param negative_ttl_p Number of seconds decisions denying access are reused
+         */
+        inline void preflight_cache(int ttl_p, int negative_ttl_p) {
+            _preflight_cache = std::make_shared<SipiPreflightCache>(ttl_p, negative_ttl_p);
+        }
+
+        inline std::shared_ptr<SipiPreflightCache> preflight_cache() { return _preflight_cache; }
+
     };
 
 }
@@ -36,6 +36,7 @@
 
 #include "SipiError.h"
 #include "SipiIO.h"
+#include "SipiResample.h"
 #include "formats/SipiIOTiff.h"
 #include "metadata/SipiXmp.h"
 #include "metadata/SipiIcc.h"
@@ -167,6 +168,7 @@ namespace Sipi {
         friend class SipiIOPng;     //!< I/O class for the PNG file format
     private:
         static std::unordered_map<std::string, std::shared_ptr<SipiIO> > io; //!< member variable holding a map of I/O class instances for the different file formats
+        static std::unordered_map<std::string, std::shared_ptr<SipiIO> > write_only_io; //!< I/O class instances for formats which are only written, e.g. "ptif"
         byte bilinn(byte buf[], register int nx, register float x, register float y, register int c, register int n);
 
         word bilinn(word buf[], register int nx, register float x, register float y, register int c, register int n);
@@ -406,6 +408,7 @@ namespace Sipi {
          *
          * \param[in] ftype The file format that should be used to write the file. Supported are
          * - "tif" for TIFF files
+         * - "ptif" for tiled pyramidal TIFF files
          * - "j2k" for JPEG2000 files
          * - "png" for PNG files
          * \param[in] filepath String containg the path/filename
@@ -459,8 +462,9 @@ namespace Sipi {
          *
          * \param[in] nnx New horizonal dimension (width)
          * \param[in] nny New vertical dimension (height)
+         * \param[in] filter Resampling filter
          */
-        bool scale(size_t nnx = 0, size_t nny = 0);
+        bool scale(size_t nnx = 0, size_t nny = 0, ResampleFilter filter = RESAMPLE_BILINEAR);
 
 
         /*!
@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*!
+ * Process-wide pool of threads which the image operations of SipiImage use to
+ * process an image in bands of rows.
+ */
+#ifndef __sipi_parallel_h
+#define __sipi_parallel_h
+
+#include <cstdlib>
+#include <functional>
+
+namespace Sipi {
+
+    /*!
+     * Splits the rows of an image operation into bands which are processed by the calling thread
+     * together with the threads of a process-wide pool. The pool threads take the next band of
+     * any waiting operation as soon as they are free, while the calling thread works on its own
+     * operation until all bands are taken. The number of threads working on one operation
+     * (the calling thread included) is limited, so that one request cannot occupy all processors.
+     */
+    class RowBands {
+    private:
+        static int max_threads; //!< maximal number of threads working on one operation
+
+    public:
+        /*!
+         * Sets the maximal number of threads working on one operation
+         *
+         * \param[in] n Number of threads including the calling thread. 0 means all available
+         * processors, 1 processes everything in the calling thread.
+         */
+        static void setMaxThreads(int n);
+
+        /*!
+         * Processes the rows [0, nrows) in bands and returns when all bands are done. If a band
+         * throws an exception, the remaining bands are still processed and the first exception
+         * is rethrown in the calling thread.
+         *
+         * \param[in] nrows Number of rows
+         * \param[in] func Function processing the rows [begin, end). It is called concurrently
+         * for disjoint bands.
+         * \param[in] min_rows Minimal number of rows in a band; smaller operations are done in
+         * the calling thread only.
+         */
+        static void run(size_t nrows, const std::function<void(size_t begin, size_t end)> &func,
+                        size_t min_rows = 16);
+    };
+
+}
+
+#endif
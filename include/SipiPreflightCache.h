@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __defined_sipi_preflight_cache_h
+#define __defined_sipi_preflight_cache_h
+
+#include <ctime>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <string>
+
+namespace Sipi {
+
+    /*!
+     * SipiPreflightCache keeps the decisions of the Lua pre-flight function for a limited time. The
+     * pre-flight function usually asks an external service (e.g. Knora) for the permissions of the user,
+     * and a viewer requests many tiles of the same image in a short time, all leading to the same
+     * decision. The decisions are keyed by IIIF prefix, identifier and cookie only, so the pre-flight
+     * function opts in per decision (by returning true as last value) when it knows that the decision
+     * depends on nothing else, and when it is not a transient failure of the external service. Decisions
+     * granting access ("allow" and "restrict...") are kept for ttl seconds, all others for negative_ttl
+     * seconds.
+     */
+    class SipiPreflightCache {
+    private:
+        typedef struct {
+            std::string permission;
+            std::string infile;
+            time_t expires;
+        } Decision;
+
+        std::mutex lock;
+        std::unordered_map<std::string, Decision> decisions;
+        int _ttl; //!< lifetime of decisions granting access, in seconds
+        int _negative_ttl; //!< lifetime of decisions denying access, in seconds
+        size_t max_entries; //!< maximal number of decisions kept
+        std::atomic<unsigned long long> _hits;
+        std::atomic<unsigned long long> _misses;
+
+        static std::string key(const std::string &prefix, const std::string &identifier, const std::string &cookie);
+
+    public:
+        /*!
+         * Creates a pre-flight decision cache
+         *
+         * \param[in] ttl_p Number of seconds decisions granting access are kept (0: not cached)
+         * \param[in] negative_ttl_p Number of seconds decisions denying access are kept (0: not cached)
+         * \param[in] max_entries_p Maximal number of decisions kept
+         */
+        SipiPreflightCache(int ttl_p, int negative_ttl_p, size_t max_entries_p = 100000);
+
+        /*!
+         * Looks for a valid decision
+         *
+         * \param[in] prefix IIIF prefix
+         * \param[in] identifier IIIF identifier
+         * \param[in] cookie Cookie header of the request
+         * \param[out] permission The permission returned by the pre-flight function
+         * \param[out] infile The file path returned by the pre-flight function
+         *
+         * \returns true, if a decision has been found
+         */
+        bool get(const std::string &prefix, const std::string &identifier, const std::string &cookie,
+                 std::string &permission, std::string &infile);
+
+        /*!
+         * Stores a decision of the pre-flight function
+         *
+         * \param[in] prefix IIIF prefix
+         * \param[in] identifier IIIF identifier
+         * \param[in] cookie Cookie header of the request
+         * \param[in] permission The permission returned by the pre-flight function
+         * \param[in] infile The file path returned by the pre-flight function
+         */
+        void put(const std::string &prefix, const std::string &identifier, const std::string &cookie,
+                 const std::string &permission, const std::string &infile);
+
+        /*!
+         * Removes all decisions for an image, e.g. after its permissions have changed
+         *
+         * \param[in] prefix IIIF prefix
+         * \param[in] identifier IIIF identifier
+         *
+         * \returns Number of decisions removed
+         */
+        size_t invalidate(const std::string &prefix, const std::string &identifier);
+
+        /*!
+         * Removes all decisions
+         */
+        void clear(void);
+
+        /*!
+         * Get the number of decisions kept
+         */
+        size_t size(void);
+
+        inline int ttl(void) { return _ttl; }
+
+        inline int negative_ttl(void) { return _negative_ttl; }
+
+        inline unsigned long long hits(void) { return _hits; }
+
+        inline unsigned long long misses(void) { return _misses; }
+    };
+
+}
+
+#endif
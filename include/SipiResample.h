@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*!
+ * Separable resampling of interleaved 8 and 16 bit images. The image is first filtered
+ * horizontally and then vertically with precomputed weight tables; only the few
+ * horizontally filtered rows needed for the current output row are kept in memory.
+ */
+#ifndef __sipi_resample_h
+#define __sipi_resample_h
+
+#include <cstdlib>
+#include <vector>
+
+namespace Sipi {
+
+    /*! The filter used for resampling */
+    typedef enum {
+        RESAMPLE_BOX,       //!< Box filter (area average when downscaling, pixel replication when upscaling)
+        RESAMPLE_BILINEAR,  //!< Triangle filter (bilinear interpolation, antialiased when downscaling)
+        RESAMPLE_LANCZOS3   //!< Lanczos filter with 3 lobes (sharpest, but slowest)
+    } ResampleFilter;
+
+    /*!
+     * Weights of a filter for resampling one dimension. For every output position
+     * the weights of count[i] consecutive input positions starting at first[i] are stored
+     * at weights[i*ntaps]. Weights which are zero at both ends are dropped, and ntaps is
+     * reduced to the longest run, so that the table stays small and is read sequentially.
+     */
+    class ResampleWeights {
+    public:
+        size_t ntaps; //!< maximal number of input positions contributing to one output position
+        std::vector<size_t> first; //!< first input position contributing to an output position
+        std::vector<size_t> count; //!< number of input positions contributing to an output position
+        std::vector<float> weights; //!< normalized weights, ntaps per output position
+
+        /*!
+         * Calculates the weights
+         *
+         * \param[in] in_size Number of input positions (pixels)
+         * \param[in] out_size Number of output positions (pixels)
+         * \param[in] filter Filter to be used
+         */
+        ResampleWeights(size_t in_size, size_t out_size, ResampleFilter filter);
+    };
+
+    /*!
+     * Resamples an interleaved image to a new size
+     *
+     * \param[in] in Input pixels (nx*ny*nc samples)
+     * \param[in] nx Width of input image
+     * \param[in] ny Height of input image
+     * \param[in] nc Number of channels (samples per pixel)
+     * \param[out] out Output pixels (nnx*nny*nc samples), allocated by the caller
+     * \param[in] nnx Width of output image
+     * \param[in] nny Height of output image
+     * \param[in] filter Filter to be used
+     */
+    template<typename T>
+    void resample(const T *in, size_t nx, size_t ny, size_t nc, T *out, size_t nnx, size_t nny,
+                  ResampleFilter filter);
+
+    /*!
+     * Resamples the output rows [row_begin, row_end) of an image. Disjoint row ranges may be
+     * processed concurrently with the same weight tables. The vertical pass works on whole
+     * float rows, so that its inner loop is a plain multiply-add which the compiler vectorizes.
+     */
+    template<typename T>
+    void resample_rows(const T *in, size_t nx, size_t nc, T *out, size_t nnx,
+                       const ResampleWeights &xweights, const ResampleWeights &yweights,
+                       size_t row_begin, size_t row_end);
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*!
+ * Rotation and mirroring kernels for interleaved 8 and 16 bit images
+ */
+#ifndef __sipi_rotate_h
+#define __sipi_rotate_h
+
+#include <cstdlib>
+
+namespace Sipi {
+
+    /*!
+     * Mirrors (optionally) and rotates an image by a multiple of 90 degrees clockwise in one pass.
+     * Mirroring is done first, as required by IIIF. Flips and the rotation by 180 degrees are done
+     * in place; the rotations by 90 and 270 degrees write a new buffer tile by tile, so that
+     * reading and writing stay within the cache.
+     *
+     * \param[in,out] buf Pixels (nx*ny*nc samples, allocated with new[]). If the operation cannot
+     * be done in place, buf is deleted and replaced by a new buffer.
+     * \param[in,out] nx Width of the image, updated for 90 and 270 degrees
+     * \param[in,out] ny Height of the image, updated for 90 and 270 degrees
+     * \param[in] nc Number of channels
+     * \param[in] angle Rotation angle, one of 0, 90, 180 and 270
+     * \param[in] mirror Mirror the image horizontally before the rotation
+     */
+    template<typename T>
+    void rotate_orthogonal(T *&buf, size_t &nx, size_t &ny, size_t nc, int angle, bool mirror);
+
+    /*!
+     * Calculates the size of the bounding box of an image rotated by an arbitrary angle
+     *
+     * \param[in] nx Width of the image
+     * \param[in] ny Height of the image
+     * \param[in] angle Rotation angle in degrees (clockwise)
+     * \param[out] nnx Width of the rotated image
+     * \param[out] nny Height of the rotated image
+     */
+    void rotated_size(size_t nx, size_t ny, double angle, size_t &nnx, size_t &nny);
+
+    /*!
+     * Rotates an image by an arbitrary angle clockwise around its center, with bilinear interpolation.
+     * The source position of an output pixel is advanced incrementally along the output row in 32.32
+     * fixed point, and the part of the row which falls into the source image is determined once per
+     * row, so that the inner loop has neither trigonometry nor bounds tests. Pixels outside of the
+     * source image are set to 0. The output rows are processed in parallel bands.
+     *
+     * \param[in] in Source pixels (nx*ny*nc samples)
+     * \param[in] nx Width of the source image
+     * \param[in] ny Height of the source image
+     * \param[in] nc Number of channels
+     * \param[out] out Buffer for the rotated image (nnx*nny*nc samples)
+     * \param[in] nnx Width of the rotated image, usually as given by rotated_size()
+     * \param[in] nny Height of the rotated image, usually as given by rotated_size()
+     * \param[in] angle Rotation angle in degrees (clockwise)
+     */
+    template<typename T>
+    void rotate_affine(const T *in, size_t nx, size_t ny, size_t nc, T *out, size_t nnx, size_t nny,
+                       double angle);
+
+}
+
+#endif
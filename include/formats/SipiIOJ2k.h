@@ -38,8 +38,37 @@ namespace Sipi {
 
     /*! Class which implements the JPEG2000-reader/writer */
     class SipiIOJ2k : public SipiIO {
+    public:
+        /*!
+         * Sets of coding parameters used to write JPEG2000 files
+         */
+        typedef enum {
+            PROFILE_DEFAULT, //!< untiled, resolution-position-component-layer progression with SOP markers
+            PROFILE_IIIF     //!< 1024x1024 tiles, PLT markers and tile-parts per resolution for fast region access
+        } WriteProfile;
+
     private:
+        static int max_read_threads; //!< Maximal number of threads used to decode one image (0 = all processors)
+        static WriteProfile write_profile; //!< Coding parameters used by write()
+
     public:
+        /*!
+         * Sets the maximal number of threads used by Kakadu to decode one image. Since every request
+         * decodes its own image, this limits the share of the processors a single request can get.
+         *
+         * \param[in] nthreads Maximal number of threads per decode. 0 means all available processors.
+         */
+        static void setMaxReadThreads(int nthreads) { max_read_threads = nthreads; };
+
+        /*!
+         * Sets the coding parameters used to write JPEG2000 files. The IIIF profile writes tiled
+         * codestreams with packet length (PLT) markers and one tile-part per resolution, so that
+         * a region/reduce request has to parse only the tiles and resolutions it needs.
+         *
+         * \param[in] profile The write profile
+         */
+        static void setWriteProfile(WriteProfile profile) { write_profile = profile; };
+
         /*!
          * Method used to read an image file
          *
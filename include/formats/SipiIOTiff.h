@@ -41,6 +41,9 @@ namespace Sipi {
     /*! Class which implements the TIFF-reader/writer */
     class SipiIOTiff : public SipiIO {
     private:
+        bool pyramid; //!< if true, tiled pyramidal TIFF files are written
+        unsigned int tile_size; //!< Width and height of the tiles of pyramidal TIFF files
+
         /*!
          * Read the EXIF data from the TIFF file and create an Exiv2::Exif object
          * \param img Pointer to SipiImage instance
@@ -56,6 +59,39 @@ namespace Sipi {
          */
         void writeExif(SipiImage *img, TIFF *tif);
 
+        /*!
+         * Reads the pixels of a region of the current TIFF directory. Tiled images are read
+         * with TIFFReadTile, all others with TIFFReadEncodedStrip. Only the tiles or strips
+         * which intersect the region are decoded, and only the columns of the region are copied.
+         *
+         * \param img Pointer to SipiImage instance (nx, ny, nc and bps must be set)
+         * \param[in] tif Pointer to TIFF file handle
+         * \param[in] planar Planar configuration (PLANARCONFIG_CONTIG or PLANARCONFIG_SEPARATE)
+         * \param[in] roi_x X position of region
+         * \param[in] roi_y Y position of region
+         * \param[in] roi_w Width of region
+         * \param[in] roi_h Height of region
+         * \param[out] rsll Length of a scanline of the region in bytes (per plane if planar separate)
+         * \returns Buffer with the pixels (planes one after the other if planar separate). NOTE: This buffer has to be deleted by the caller!
+         */
+        unsigned char *readRegion(SipiImage *img, TIFF *tif, unsigned short planar, int roi_x, int roi_y,
+                                  size_t roi_w, size_t roi_h, unsigned int &rsll);
+
+        /*!
+         * Selects the reduced resolution level of a pyramidal TIFF which fits best a reduce factor.
+         * The levels are looked up in the SubIFDs of the current directory, or, if there are none, in
+         * the following directories. A level is accepted if it has the same number of samples, bits/sample
+         * and photometric interpretation as the full resolution image and if its dimensions are the
+         * full resolution dimensions divided by a power of two (rounded up or down).
+         * After the call the directory of the selected level (or the first directory) is the current one.
+         *
+         * \param[in] tif Pointer to TIFF file handle
+         * \param[in] img Pointer to SipiImage instance with the parameters of the full resolution image
+         * \param[in] reduce Maximal reduce factor (a level of 2^reduce is the smallest acceptable one)
+         * \returns The reduce factor of the selected level (0 if no suitable level has been found)
+         */
+        int selectPyramidLevel(TIFF *tif, SipiImage *img, int reduce);
+
         /*!
          * Converts an image from RRRRRR...GGGGGG...BBBBB to RGBRGBRGBRGB....
          * \param img Pointer to SipiImage instance
@@ -83,6 +119,15 @@ namespace Sipi {
         unsigned char *cvrt8BitTo1bit(const SipiImage &img, unsigned int &sll);
 
     public:
+        /*!
+         * Constructor of the TIFF reader/writer
+         *
+         * \param[in] pyramid If true, the writer produces tiled pyramidal TIFF files with the
+         * reduced resolution levels stored in SubIFDs
+         * \param[in] tile_size Width and height of the tiles of pyramidal TIFF files
+         */
+        SipiIOTiff(bool pyramid = false, unsigned int tile_size = 256) : pyramid(pyramid), tile_size(tile_size) {};
+
         static void initLibrary(void);
 
         /*!
@@ -90,7 +135,9 @@ namespace Sipi {
          *
          * \param *img Pointer to SipiImage instance
          * \param filepath Image file path
-         * \param reduce Reducing factor. Not used reading TIFF files
+         * \param region Region of the image to be read
+         * \param size Size of the resulting image. If the file is a pyramidal TIFF, the smallest
+         * reduced resolution level which is at least as large as the requested size is read
          */
         bool read(SipiImage *img, std::string filepath, std::shared_ptr<SipiRegion> region = nullptr,
                   std::shared_ptr<SipiSize> size = nullptr, bool force_bps_8 = false);
@@ -116,6 +163,9 @@ namespace Sipi {
          * \param filepath Name of the image file to be written. Please note that
          * - "-" means to write the image data to stdout
          * - "HTTP" means to write the image data to the HTTP-server output
+         *
+         * If the instance has been created with pyramid = true, a tiled TIFF is written which contains
+         * the halved resolution levels down to the tile size in SubIFDs.
          */
         void write(SipiImage *img, std::string filepath, int quality = 0);
 
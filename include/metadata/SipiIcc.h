@@ -27,6 +27,7 @@
 #define __sipi_icc_h
 
 #include <string>
+#include <memory>
 
 #include <stdio.h>
 #include <limits.h>
@@ -62,6 +63,14 @@ namespace Sipi {
     private:
         cmsHPROFILE icc_profile;            //!< Handle of the littleCMS profile data
         PredefinedProfiles profile_type;    //!< Profile type that is represented
+        mutable std::string profile_id;     //!< MD5 of the profile data, computed on first use by profileId()
+
+        /*!
+         * Identifies the profile data by its MD5. The checksum is computed once; the shared predefined
+         * profiles compute it when they are created, as they are used by several threads.
+         * \returns The MD5 of the binary ICC profile (empty for an undefined profile)
+         */
+        const std::string &profileId() const;
 
     public:
         /*!
@@ -152,6 +161,29 @@ namespace Sipi {
          */
         unsigned int iccFormatter(SipiImage *img) const;
 
+        /*!
+         * Returns a shared instance of a predefined profile. The instance is created on first use
+         * and kept until the process ends, so that the standard profiles used for the IIIF qualities
+         * are not built again for every request.
+         * \param[in] predef Desired predefined profile
+         * \returns Shared profile instance
+         */
+        static const SipiIcc &predefined(PredefinedProfiles predef);
+
+        /*!
+         * Returns a color transform between two profiles. Transforms are cached by the MD5 of the profiles,
+         * the formatters and the intent, so that a transform is created only once for every kind of
+         * conversion. The transform may be used by several threads at the same time.
+         * \param[in] from Profile of the source pixels
+         * \param[in] in_formatter Formatter of the source pixels
+         * \param[in] to Profile of the destination pixels
+         * \param[in] out_formatter Formatter of the destination pixels
+         * \param[in] intent Rendering intent
+         * \returns Shared handle of the transform, or an empty pointer if littleCMS couldn't create it
+         */
+        static std::shared_ptr<void> transform(const SipiIcc &from, unsigned int in_formatter, const SipiIcc &to,
+                                               unsigned int out_formatter, unsigned int intent = INTENT_PERCEPTUAL);
+
         /**
          * Print info to output stream
          * \param[in] lhs Output stream
@@ -0,0 +1,58 @@
+--
+-- Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+-- Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+-- This file is part of Sipi.
+-- Sipi is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU Affero General Public License as published
+-- by the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+-- Sipi is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+-- Additional permission under GNU AGPL version 3 section 7:
+-- If you modify this Program, or any covered work, by linking or combining
+-- it with Kakadu (or a modified version of that library), containing parts
+-- covered by the terms of the Kakadu Software Licence, the licensors of this
+-- Program grant you additional permission to convey the resulting work.
+-- See the GNU Affero General Public License for more details.
+-- You should have received a copy of the GNU Affero General Public
+-- License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+
+--
+-- Returns the state of the cache: the number of files and their size, the limits, the cached files (as an object
+-- mapping the canonical URL to the name of the file in the cache directory) and the statistics of the reconciliation.
+--
+
+require "send_response"
+
+success, errmsg = server.setBuffer()
+
+if not success then
+    server.log("server.setBuffer() failed: " .. errmsg, server.loglevel.LOG_ERR)
+    send_error(500, "buffer could not be set correctly")
+    return
+end
+
+local filelist = cache.filelist()
+
+if filelist == nil then
+    send_error(404, "no cache")
+    return
+end
+
+local entries = {}
+
+for index, entry in pairs(filelist) do
+    entries[entry.canonical] = entry.cachepath
+end
+
+result = {
+    nfiles = cache.nfiles(),
+    size = cache.size(),
+    max_nfiles = cache.max_nfiles(),
+    max_size = cache.max_size(),
+    entries = entries,
+    reconciliation = cache.reconciliation()
+}
+
+send_success(result)
@@ -0,0 +1,119 @@
+--
+-- Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+-- Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+-- This file is part of Sipi.
+-- Sipi is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU Affero General Public License as published
+-- by the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+-- Sipi is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+-- Additional permission under GNU AGPL version 3 section 7:
+-- If you modify this Program, or any covered work, by linking or combining
+-- it with Kakadu (or a modified version of that library), containing parts
+-- covered by the terms of the Kakadu Software Licence, the licensors of this
+-- Program grant you additional permission to convey the resulting work.
+-- See the GNU Affero General Public License for more details.
+-- You should have received a copy of the GNU Affero General Public
+-- License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+
+--
+-- Tests server.http() and server.http_multi(). The parameter silent_port is the port of a server which
+-- accepts connections but never answers.
+--
+
+require "send_response"
+
+success, errmsg = server.setBuffer()
+
+if not success then
+    server.log("server.setBuffer() failed: " .. errmsg, server.loglevel.LOG_ERR)
+    send_error(500, "buffer could not be set correctly")
+    return
+end
+
+local echo_url = 'http://localhost:' .. config.port .. '/test_http_echo'
+local text_header = { ["Content-Type"] = "text/plain" }
+
+--
+-- checks that a result is the answer of test_http_echo to the given method and body
+--
+local function check_echo(result, method, body)
+    if result.status_code ~= 200 then
+        return false, method .. " returned HTTP status code " .. tostring(result.status_code)
+    end
+
+    local success, echo = server.json_to_table(result.body)
+
+    if not success then
+        return false, method .. " returned invalid JSON: " .. echo
+    end
+
+    if echo.method ~= method or echo.content ~= body then
+        return false, method .. " was received as " .. tostring(echo.method) .. " with body '" .. tostring(echo.content) .. "'"
+    end
+
+    return true
+end
+
+for _, method in ipairs({ "POST", "PUT" }) do
+    local body = "data sent with " .. method
+    local success, result = server.http(method, echo_url, text_header, 2000, body)
+
+    if not success then
+        send_error(500, "server.http() failed: " .. result)
+        return
+    end
+
+    local ok, errmsg = check_echo(result, method, body)
+
+    if not ok then
+        send_error(500, errmsg)
+        return
+    end
+end
+
+local silent_url = 'http://localhost:' .. server.get.silent_port .. '/'
+local success, result = server.http("GET", silent_url, 2000, 500)
+
+if success then
+    send_error(500, "the request of server.http() to a server which never answers did not fail")
+    return
+end
+
+local success, results = server.http_multi({
+    { method = "POST", url = echo_url, header = text_header, body = "first" },
+    { method = "PUT", url = echo_url, header = text_header, body = "second" },
+    { url = silent_url, request_timeout = 500 }
+})
+
+if not success then
+    send_error(500, "server.http_multi() failed: " .. results)
+    return
+end
+
+for i, expected in ipairs({ { "POST", "first" }, { "PUT", "second" } }) do
+    if results[i].errmsg ~= nil then
+        send_error(500, "request " .. i .. " of server.http_multi() failed: " .. results[i].errmsg)
+        return
+    end
+
+    local ok, errmsg = check_echo(results[i], expected[1], expected[2])
+
+    if not ok then
+        send_error(500, errmsg)
+        return
+    end
+end
+
+if results[3].errmsg == nil then
+    send_error(500, "the request to a server which never answers did not fail")
+    return
+end
+
+result = {
+    result = "ok"
+}
+
+send_success(result)
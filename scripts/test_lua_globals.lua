@@ -0,0 +1,50 @@
+--
+-- Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+-- Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+-- This file is part of Sipi.
+-- Sipi is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU Affero General Public License as published
+-- by the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+-- Sipi is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+-- Additional permission under GNU AGPL version 3 section 7:
+-- If you modify this Program, or any covered work, by linking or combining
+-- it with Kakadu (or a modified version of that library), containing parts
+-- covered by the terms of the Kakadu Software Licence, the licensors of this
+-- Program grant you additional permission to convey the resulting work.
+-- See the GNU Affero General Public License for more details.
+-- You should have received a copy of the GNU Affero General Public
+-- License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+
+--
+-- Reports whether global variables and tables of the init state have been changed, and changes them.
+-- Since the interpreters are reused, the next request shows whether the changes have been undone.
+--
+
+require "send_response"
+
+success, errmsg = server.setBuffer()
+
+if not success then
+    server.log("server.setBuffer() failed: " .. errmsg, server.loglevel.LOG_ERR)
+    send_error(500, "buffer could not be set correctly")
+    return
+end
+
+result = {
+    pre_flight = type(pre_flight),
+    imgroot = config.imgroot,
+    string_marker = tostring(string.test_marker),
+    new_global = tostring(test_new_global),
+    config_metatable = tostring(getmetatable(config) ~= nil)
+}
+
+pre_flight = "changed"
+config.imgroot = "changed"
+string.test_marker = "changed"
+test_new_global = "changed"
+setmetatable(config, {})
+
+send_success(result)
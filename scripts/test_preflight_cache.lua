@@ -0,0 +1,57 @@
+--
+-- Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+-- Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+-- This file is part of Sipi.
+-- Sipi is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU Affero General Public License as published
+-- by the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+-- Sipi is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+-- Additional permission under GNU AGPL version 3 section 7:
+-- If you modify this Program, or any covered work, by linking or combining
+-- it with Kakadu (or a modified version of that library), containing parts
+-- covered by the terms of the Kakadu Software Licence, the licensors of this
+-- Program grant you additional permission to convey the resulting work.
+-- See the GNU Affero General Public License for more details.
+-- You should have received a copy of the GNU Affero General Public
+-- License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+
+--
+-- Returns the statistics of the pre-flight decision cache. If the parameters prefix and identifier
+-- are given, the decisions for this image are removed first.
+--
+
+require "send_response"
+
+success, errmsg = server.setBuffer()
+
+if not success then
+    server.log("server.setBuffer() failed: " .. errmsg, server.loglevel.LOG_ERR)
+    send_error(500, "buffer could not be set correctly")
+    return
+end
+
+local stats = preflight_cache.stats()
+
+if stats == nil then
+    send_error(404, "pre-flight decisions are not kept")
+    return
+end
+
+local invalidated = 0
+
+if server.get and server.get.prefix and server.get.identifier then
+    invalidated = preflight_cache.invalidate(server.get.prefix, server.get.identifier)
+    stats = preflight_cache.stats()
+end
+
+result = {
+    invalidated = invalidated,
+    hits = stats.hits,
+    misses = stats.misses,
+    entries = stats.entries
+}
+
+send_success(result)
@@ -0,0 +1,304 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+
+#include "AsyncFileWriter.h"
+
+static const char __file__[] = __FILE__;
+
+namespace shttps {
+
+    size_t AsyncFileWriter::max_pending = 16 * 1024 * 1024;
+
+    static const size_t block_size = 64 * 1024; //!< small writes are collected into blocks of this size
+    static const size_t sync_batch = 16; //!< number of files which are synced together
+    static const std::chrono::milliseconds sync_delay(1000); //!< maximal time a written file waits to be synced
+
+    /*!
+     * A file to be written by the writer thread. Except fd and path, the members are protected
+     * by the lock of the writer queue.
+     */
+    struct AsyncFile {
+        int fd;
+        std::string path;
+        std::deque<std::string> blocks; //!< data waiting to be written
+        size_t pending;   //!< number of bytes queued or being written
+        bool scheduled;   //!< the file is in the work queue
+        bool closed;      //!< no more data will be added
+        bool failed;      //!< the file is abandoned
+        bool finished;    //!< the writer thread is done with the file
+        std::function<void(bool)> done;
+    };
+
+    /*!
+     * The files the writer thread has to take care of
+     */
+    typedef struct {
+        std::mutex lock;
+        std::condition_variable cond;
+        std::deque<std::shared_ptr<AsyncFile>> work; //!< files with queued data or waiting to be finished
+    } FileWriterQueue;
+
+    //
+    // The writer thread is started on first use and never stopped, thus the queue must outlive
+    // the static destructors.
+    //
+    static FileWriterQueue *queue = nullptr;
+    static std::once_flag writer_started;
+
+    static bool write_block(int fd, const std::string &block) {
+        const char *ptr = block.data();
+        size_t n = block.size();
+
+        while (n > 0) {
+            ssize_t nn = ::write(fd, ptr, n);
+            if (nn < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            ptr += nn;
+            n -= nn;
+        }
+
+        return true;
+    }
+    //=========================================================================
+
+    static void call_done(AsyncFile *file, bool ok) {
+        if (file->done) {
+            try {
+                file->done(ok);
+            } catch (...) {
+                syslog(LOG_ERR, "Exception in completion handler of file %s", file->path.c_str());
+            }
+            file->done = nullptr;
+        }
+    }
+    //=========================================================================
+
+    //
+    // the completion handlers are called only once the files are on the disk, so that nothing (e.g. the
+    // journal of the cache) can refer to a file which would be truncated by a crash
+    //
+    static void sync_files(std::vector<std::shared_ptr<AsyncFile>> &files) {
+        for (auto &file : files) {
+            bool ok = (fsync(file->fd) == 0);
+            if (!ok) syslog(LOG_ERR, "Could not sync file %s: %m", file->path.c_str());
+            ::close(file->fd);
+            if (!ok) ::unlink(file->path.c_str());
+            call_done(file.get(), ok);
+        }
+        files.clear();
+    }
+    //=========================================================================
+
+    static void finish_file(const std::shared_ptr<AsyncFile> &file, bool ok,
+                            std::vector<std::shared_ptr<AsyncFile>> &unsynced) {
+        if (ok) {
+            unsynced.push_back(file);
+        } else {
+            ::close(file->fd);
+            ::unlink(file->path.c_str());
+            call_done(file.get(), false);
+        }
+    }
+    //=========================================================================
+
+    static void writer_thread(void) {
+        std::vector<std::shared_ptr<AsyncFile>> unsynced; // files completely written, but not yet synced
+        std::chrono::steady_clock::time_point sync_due;
+
+        while (true) {
+            std::shared_ptr<AsyncFile> file;
+            std::deque<std::string> blocks;
+            bool failed;
+
+            //
+            // checked on every iteration, as the queue may never run empty while the server is busy
+            //
+            if (!unsynced.empty() && (std::chrono::steady_clock::now() >= sync_due)) {
+                sync_files(unsynced);
+            }
+
+            {
+                std::unique_lock<std::mutex> guard(queue->lock);
+                if (unsynced.empty()) {
+                    queue->cond.wait(guard, [] { return !queue->work.empty(); });
+                } else if (!queue->cond.wait_until(guard, sync_due, [] { return !queue->work.empty(); })) {
+                    continue; // the files are synced at the top of the loop
+                }
+
+                file = queue->work.front();
+                queue->work.pop_front();
+                file->scheduled = false;
+                if (file->finished) continue;
+                blocks.swap(file->blocks);
+                failed = file->failed;
+            }
+
+            size_t nbytes = 0;
+            bool ok = true;
+            if (!failed) {
+                for (auto const &block : blocks) {
+                    if (!write_block(file->fd, block)) {
+                        ok = false;
+                        break;
+                    }
+                    nbytes += block.size();
+                }
+            }
+            blocks.clear();
+
+            bool finish;
+            {
+                std::lock_guard<std::mutex> guard(queue->lock);
+                file->pending -= nbytes;
+                if (!ok && !file->failed) {
+                    syslog(LOG_ERR, "Could not write file %s: %m", file->path.c_str());
+                    file->failed = true;
+                    file->blocks.clear();
+                    file->pending = 0;
+                }
+                finish = file->closed && (file->failed || file->blocks.empty());
+                if (finish) {
+                    file->finished = true;
+                    failed = file->failed;
+                }
+            }
+
+            if (finish) {
+                if (!failed && unsynced.empty()) sync_due = std::chrono::steady_clock::now() + sync_delay;
+                finish_file(file, !failed, unsynced);
+                if (unsynced.size() >= sync_batch) sync_files(unsynced);
+            }
+        }
+    }
+    //=========================================================================
+
+    static void start_writer(void) {
+        queue = new FileWriterQueue();
+        std::thread(writer_thread).detach();
+    }
+    //=========================================================================
+
+    //
+    // has to be called with the queue locked
+    //
+    static void schedule(const std::shared_ptr<AsyncFile> &file) {
+        if (file->scheduled) return;
+        file->scheduled = true;
+        queue->work.push_back(file);
+        queue->cond.notify_one();
+    }
+    //=========================================================================
+
+
+    AsyncFileWriter::AsyncFileWriter(const std::string &path) {
+        std::call_once(writer_started, start_writer);
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw Error(__file__, __LINE__, "Could not open file " + path, errno);
+        }
+
+        file = std::make_shared<AsyncFile>();
+        file->fd = fd;
+        file->path = path;
+        file->pending = 0;
+        file->scheduled = false;
+        file->closed = false;
+        file->failed = false;
+        file->finished = false;
+    }
+    //=========================================================================
+
+    AsyncFileWriter::~AsyncFileWriter() {
+        discard();
+    }
+    //=========================================================================
+
+    void AsyncFileWriter::write(const void *buf, size_t n) {
+        if (n == 0) return;
+
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if (file->closed || file->failed) return;
+
+        if (file->pending + n > max_pending) {
+            //
+            // the disk does not keep up; rather give up the file than make the producer wait
+            //
+            syslog(LOG_WARNING, "Writing %s is too slow, file abandoned", file->path.c_str());
+            file->failed = true;
+            file->blocks.clear();
+            return;
+        }
+
+        const char *data = static_cast<const char *>(buf);
+        if (!file->blocks.empty() && (file->blocks.back().size() + n <= block_size)) {
+            file->blocks.back().append(data, n);
+        } else {
+            file->blocks.emplace_back(data, n);
+        }
+        file->pending += n;
+
+        schedule(file);
+    }
+    //=========================================================================
+
+    void AsyncFileWriter::close(const std::function<void(bool)> &done) {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if (file->closed) return;
+
+        file->closed = true;
+        file->done = done;
+        schedule(file);
+    }
+    //=========================================================================
+
+    void AsyncFileWriter::discard(void) {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if (file->closed) return;
+
+        file->closed = true;
+        file->failed = true;
+        file->blocks.clear();
+        schedule(file);
+    }
+    //=========================================================================
+
+    bool AsyncFileWriter::failed(void) {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        return file->failed;
+    }
+    //=========================================================================
+
+}
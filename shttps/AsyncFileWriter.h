@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ *//*!
+ * \brief Writes files in the background
+ *
+ */
+#ifndef __shttp_async_file_writer_h
+#define __shttp_async_file_writer_h
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "Error.h"
+
+namespace shttps {
+
+    struct AsyncFile;
+
+    /*!
+     * The class AsyncFileWriter writes a file in a background thread, so that the thread producing
+     * the data never waits for the disk. The data is copied into a bounded queue which a single,
+     * process-wide writer thread drains to the disk. If the disk cannot keep up and the queue
+     * exceeds its limit, the file is abandoned instead of blocking the producer.
+     * The files are synced to the disk in batches after they have been written completely, which
+     * delays their completion by at most a second.
+     */
+    class AsyncFileWriter {
+    private:
+        std::shared_ptr<AsyncFile> file;
+
+    public:
+        static size_t max_pending; //!< maximal number of bytes waiting to be written per file
+
+        /*!
+         * Opens (and truncates) the file to be written
+         *
+         * \param[in] path Path of the file to be written
+         *
+         * \throws Error if the file could not be opened
+         */
+        AsyncFileWriter(const std::string &path);
+
+        /*!
+         * Discards the file if it has not been closed
+         */
+        ~AsyncFileWriter();
+
+        AsyncFileWriter(const AsyncFileWriter &) = delete;
+
+        AsyncFileWriter &operator=(const AsyncFileWriter &) = delete;
+
+        /*!
+         * Queues data to be written. Never blocks on the disk.
+         *
+         * \param[in] buf Data to be written
+         * \param[in] n Number of bytes
+         */
+        void write(const void *buf, size_t n);
+
+        /*!
+         * Hands the file over to the writer thread. The function returns immediately; the
+         * given callback is called by the writer thread once all data has been written to the
+         * file and synced to the disk (with true), or once the file has been removed because it
+         * could not be written completely (with false).
+         *
+         * \param[in] done Callback (optional)
+         */
+        void close(const std::function<void(bool)> &done = nullptr);
+
+        /*!
+         * Abandons the file. Data already queued is dropped and the file is removed.
+         */
+        void discard(void);
+
+        /*!
+         * Returns true if the file has been abandoned, e.g. because the disk was too slow
+         */
+        bool failed(void);
+    };
+
+}
+
+#endif
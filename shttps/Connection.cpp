@@ -43,6 +43,10 @@
 #include <signal.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 #include "Global.h"
 #include "Error.h"
 #include "Connection.h"
@@ -58,6 +62,9 @@ namespace shttps {
 
     const size_t max_headerline_len = 65535;
 
+    static const size_t file_block_size = 256 * 1024; //!< size of the blocks if a file has to be read for sending
+    static const size_t file_sendfile_size = 16 * 1024 * 1024; //!< maximal number of bytes per sendfile() call
+
     // trim from start
     static inline std::string &ltrim(std::string &s) {
         s.erase(s.begin(), std::find_if(s.begin(), s.end(), std::not1(std::ptr_fun<int, int>(std::isspace))));
@@ -342,6 +349,7 @@ namespace shttps {
     Connection::Connection(void) {
         _server = nullptr;
         _secure = false;
+        _sock = -1;
         ins = nullptr;
         os = nullptr;
         cachefile = nullptr;
@@ -366,6 +374,7 @@ namespace shttps {
                                                               outbuf_size(buf_size), outbuf_inc(buf_inc) {
         _server = server_p;
         _secure = false;
+        _sock = -1;
         cachefile = nullptr;
         header_sent = false;
         _keep_alive = false; // should be true as this is the default for HTTP/1.1, but ab makes a porblem
@@ -915,7 +924,7 @@ namespace shttps {
         }
 
         if (cachefile != nullptr) {
-            delete cachefile;
+            delete cachefile; // an unfinished cache file is discarded
             cachefile = nullptr;
         }
     }
@@ -1199,16 +1208,22 @@ namespace shttps {
     //=============================================================================
 
     void Connection::openCacheFile(const std::string &cfname) {
-        cachefile = new ofstream(cfname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+        if (cachefile != nullptr) discardCacheFile();
+        cachefile = new AsyncFileWriter(cfname);
+    }
+    //=============================================================================
 
-        if (cachefile->fail()) {
-            throw Error(__file__, __LINE__, "Could not open cache file!");
-        }
+    void Connection::closeCacheFile(const std::function<void(bool)> &done) {
+        if (cachefile == nullptr) return;
+        cachefile->close(done);
+        delete cachefile;
+        cachefile = nullptr;
     }
     //=============================================================================
 
-    void Connection::closeCacheFile(void) {
-        cachefile->close();
+    void Connection::discardCacheFile(void) {
+        if (cachefile == nullptr) return;
+        cachefile->discard();
         delete cachefile;
         cachefile = nullptr;
     }
@@ -1426,6 +1441,43 @@ namespace shttps {
     //=============================================================================
 
 
+    void Connection::send_file_blocks(int fd, size_t offset, size_t n, size_t bufsize) {
+        std::vector<char> buf(std::max(bufsize, file_block_size));
+
+        while (n > 0) {
+            ssize_t nread = pread(fd, buf.data(), std::min(buf.size(), n), offset);
+
+            if ((nread < 0) && (errno == EINTR)) continue;
+            if (nread <= 0) throw Error(__file__, __LINE__, "Cannot read file!", errno);
+
+            if (outbuf != nullptr) {
+                add_to_outbuf(buf.data(), nread);
+            } else {
+                if (_chunked_transfer_out) {
+                    *os << std::hex << nread << std::dec << "\r\n";
+                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+                    os->write(buf.data(), nread);
+                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+                    *os << "\r\n";
+                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+                } else {
+                    os->write(buf.data(), nread);
+                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+                }
+            }
+
+            offset += nread;
+            n -= nread;
+        }
+
+        if (outbuf == nullptr) {
+            os->flush();
+            if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+        }
+    }
+    //=============================================================================
+
+
     void Connection::sendFile(const string &path, const size_t bufsize, size_t from, size_t to) {
         if (_finished) throw Error(__file__, __LINE__, "Sending data already terminated!");
 
@@ -1436,87 +1488,80 @@ namespace shttps {
             throw Error(__file__, __LINE__, "File not readable!");
         }
 
-        struct stat fstatbuf;
+        int infd = open(path.c_str(), O_RDONLY);
 
-        if (stat(path.c_str(), &fstatbuf) != 0) {
-            throw Error(__file__, __LINE__, "Cannot fstat file!");
+        if (infd < 0) {
+            throw Error(__file__, __LINE__, "File not readable!");
         }
 
-        size_t fsize = fstatbuf.st_size;
-        size_t orig_fsize;
-
-        FILE *infile = fopen(path.c_str(), "rb");
+        struct stat fstatbuf;
 
-        if (infile == nullptr) {
-            throw Error(__file__, __LINE__, "File not readable!");
+        if (fstat(infd, &fstatbuf) != 0) {
+            close(infd);
+            throw Error(__file__, __LINE__, "Cannot fstat file!");
         }
 
+        size_t orig_fsize = fstatbuf.st_size;
+        size_t fsize = orig_fsize;
+
         if (from > 0) {
-            if (from < fsize) {
-                if (fseek(infile, from, SEEK_SET) < 0) {
-                    fclose(infile);
-                    throw Error(__file__, __LINE__, "Cannot seek to position!");
-                }
-                orig_fsize = fsize;
-                fsize -= from;
-            } else {
-                fclose(infile);
+            if (from >= orig_fsize) {
+                close(infd);
                 throw Error(__file__, __LINE__, "Seek position beyond end of file!");
             }
+            fsize -= from;
         }
 
         if (to > 0) {
-            if (to > orig_fsize) {
-                fclose(infile);
+            if ((to > orig_fsize) || (to < from)) {
+                close(infd);
                 throw Error(__file__, __LINE__, "Trying to read beyond end of file!");
             }
             fsize -= (orig_fsize - to);
         }
 
-        if (outbuf != nullptr) {
-            char buf[bufsize];
-            size_t n;
-            while ((n = fread(buf, sizeof(char), bufsize, infile)) > 0) {
-                add_to_outbuf(buf, n);
-            }
-        } else {
-            if (!header_sent) {
-                if (_chunked_transfer_out) {
-                    send_header();
-                } else {
-                    send_header(fsize);
+        try {
+            if (outbuf != nullptr) {
+                send_file_blocks(infd, from, fsize, bufsize);
+            } else {
+                if (!header_sent) {
+                    if (_chunked_transfer_out) {
+                        send_header();
+                    } else {
+                        send_header(fsize);
+                    }
                 }
-            }
-
-            char buf[bufsize];
-            size_t n;
 
-            while ((n = fread(buf, sizeof(char), bufsize, infile)) > 0) {
-                // send data here...
-                if (_chunked_transfer_out) {
-                    *os << std::hex << n << "\r\n";
-                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
-                    os->write(buf, n);
-                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
-                    *os << "\r\n";
+#ifdef __linux__
+                if ((_sock >= 0) && !_chunked_transfer_out) {
+                    //
+                    // the header still waits in the output stream; then the kernel copies the
+                    // file directly from the page cache to the socket
+                    //
+                    os->flush();
                     if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+
+                    off_t offset = from;
+                    size_t n = fsize;
+                    while (n > 0) {
+                        ssize_t nsent = sendfile(_sock, infd, &offset, std::min(n, file_sendfile_size));
+                        if ((nsent < 0) && (errno == EINTR)) continue;
+                        if (nsent <= 0) throw OUTPUT_WRITE_FAIL;
+                        n -= nsent;
+                    }
                 } else {
-                    os->write(buf, n);
-                    if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+                    send_file_blocks(infd, from, fsize, bufsize);
                 }
-
-                os->flush();
-                if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
-            }
-
-            if (!feof(infile)) {
-                fclose(infile);
-                return;
-                // send Error here
+#else
+                send_file_blocks(infd, from, fsize, bufsize);
+#endif
             }
+        } catch (...) {
+            close(infd);
+            throw;
         }
 
-        fclose(infile);
+        close(infd);
     }
     //=============================================================================
 
@@ -1619,6 +1664,9 @@ namespace shttps {
         if (_chunked_transfer_out) { // no content length, please!!!
             *os << "\r\n"; //we have to add only one more "\r\n" in this case
             if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
+        } else if (status_code == NOT_MODIFIED) { // no body, and a content length would have to be the one of a 200
+            *os << "\r\n";
+            if (os->eof() || os->fail()) throw OUTPUT_WRITE_FAIL;
         } else {
             if ((outbuf != nullptr) && (outbuf_nbytes > 0)) {
                 *os << "Content-Length: " << outbuf_nbytes << "\r\n\r\n";
@@ -31,8 +31,10 @@
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <functional>
 
 #include "Error.h"
+#include "AsyncFileWriter.h"
 
 
 namespace shttps {
@@ -306,6 +308,7 @@ namespace shttps {
         int _peer_port;           //!< Port of peer/client
         std::string http_version; //!< Holds the HTTP version of the request
         bool _secure;             //!< true if SSL used
+        int _sock;                //!< plain socket used to send files with sendfile(), or -1
         HttpMethod _method;       //!< request method
         std::string _host;        //!< host name that was used (for virtual hosts)
         std::string _uri;         //!< uri of the request
@@ -330,7 +333,7 @@ namespace shttps {
         char *_content;             //!< Content if content-type is "text/plain", "application/json" etc.
         size_t content_length;      //!< length of body in octets (used if not chunked transfer)
         std::string _content_type;  //!< Content-type (mime type of content)
-        std::ofstream *cachefile;   //!< pointer to cache file
+        AsyncFileWriter *cachefile; //!< cache file, written in the background
         char *outbuf;               //!< If not NULL, pointer to the output buffer (buffered output used)
         size_t outbuf_size;         //!< Actual size of output buffer
         size_t outbuf_inc;          //!< Increment of outbuf buffer if it has to be enlarged
@@ -350,6 +353,17 @@ namespace shttps {
          */
         void add_to_outbuf(char *buf, size_t n);
 
+        /*!
+         * Reads n bytes of a file starting at offset in large blocks and sends them, or adds them
+         * to the output buffer if the connection is buffered
+         *
+         * \param[in] fd File descriptor of the file
+         * \param[in] offset Position of the first byte
+         * \param[in] n Number of bytes
+         * \param[in] bufsize Minimal size of the blocks
+         */
+        void send_file_blocks(int fd, size_t offset, size_t n, size_t bufsize);
+
         /*!
          * Send the HTTP header. If n > 0, a "Content-Lenght" header is added
          *
@@ -443,6 +457,14 @@ namespace shttps {
          */
         inline void secure(bool sec) { _secure = sec; }
 
+        /*!
+         * Set the plain socket of the connection. If set, files are sent with the
+         * zero-copy sendfile() system call where available.
+         *
+         * \param[in] sock_p Socket, or -1 if the data has to go through the output stream (e.g. SSL)
+         */
+        inline void sock(int sock_p) { _sock = sock_p; }
+
         /*!
          * Get the request URI
          *
@@ -698,9 +720,19 @@ namespace shttps {
         void openCacheFile(const std::string &cfname);
 
         /*!
-         * close cache file
+         * Close the cache file. The data sent may still be on its way to the disk when this
+         * method returns, thus the file must not be used before the given callback is called.
+         * It is called from the background writer thread with true once the file has been
+         * written completely, or with false if the file could not be written and has been removed.
+         *
+         * \param[in] done Callback (optional)
+         */
+        void closeCacheFile(const std::function<void(bool)> &done = nullptr);
+
+        /*!
+         * Abandon the cache file, e.g. after an error. The file is removed.
          */
-        void closeCacheFile(void);
+        void discardCacheFile(void);
 
         /*!
          * Quasi "raw" data transmition. Sens the header if not yet done, and then
@@ -734,9 +766,14 @@ namespace shttps {
         void sendAndFlush(const void *buffer, size_t n);
 
         /*!
-         * Sends the data of a file to the connection
+         * Sends the data of a file to the connection. On a plain (non-SSL) socket with
+         * unchunked, unbuffered output, the file is sent by the kernel with sendfile() (Linux);
+         * otherwise it is read and sent in large blocks.
          *
          * \param[in] path Path to the file
+         * \param[in] bufsize Minimal size of the blocks if the file has to be read
+         * \param[in] from Position of the first byte to be sent
+         * \param[in] to Position after the last byte to be sent (0 means up to the end of the file)
          */
         void sendFile(const std::string &path, const size_t bufsize = 8192, size_t from = 0, size_t to = 0);
 
@@ -29,6 +29,10 @@
 #include <string>
 #include <cstring>      // Needed for memset
 #include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
 
 //#include <sys/types.h>
 #include <sys/stat.h>
@@ -44,6 +48,7 @@
 #include "LuaServer.h"
 #include "Connection.h"
 #include "Server.h"
+#include "makeunique.h"
 //#include "ChunkReader.h"
 
 #include "sole.hpp"
@@ -1076,18 +1081,91 @@ namespace shttps {
     }
 
     /*!
-     * Represents a libcurl connection that can be used to make a single HTTP request.
+     * A HTTP request made by server.http() or server.http_multi()
+     */
+    typedef struct {
+        std::string method; //!< "GET", "POST" or "PUT"
+        std::string url;
+        std::unordered_map<std::string, std::string> headers;
+        std::string body; //!< data sent with "POST" and "PUT"
+        long timeout; //!< connection timeout in milliseconds
+        long request_timeout; //!< time the whole request may take in milliseconds, 0 for no limit
+    } HttpRequest;
+
+    //
+    // Finished easy handles are kept in a pool instead of being cleaned up: a reused handle keeps
+    // its connections to the upstream servers alive, so that the next request to the same server
+    // needs neither a DNS lookup nor a TCP (or TLS) handshake. All handles share one DNS cache and
+    // the TLS sessions. The pool and the share object are created on first use and never freed.
+    //
+    static const size_t curl_pool_max = 32; //!< maximal number of idle handles kept
+    static std::mutex curl_pool_lock;
+    static std::vector<CURL *> *curl_pool = nullptr;
+    static CURLSH *curl_share = nullptr;
+    static std::mutex *curl_share_locks = nullptr;
+    static std::once_flag curl_share_created;
+
+    static void curlShareLock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+        curl_share_locks[data].lock();
+    }
+
+    static void curlShareUnlock(CURL *handle, curl_lock_data data, void *userptr) {
+        curl_share_locks[data].unlock();
+    }
+
+    static void createCurlShare(void) {
+        curl_pool = new std::vector<CURL *>();
+        curl_share_locks = new std::mutex[CURL_LOCK_DATA_LAST];
+        curl_share = curl_share_init();
+
+        if (curl_share != nullptr) {
+            curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, curlShareLock);
+            curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, curlShareUnlock);
+            curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        }
+    }
+
+    static CURL *acquireCurlHandle(void) {
+        std::call_once(curl_share_created, createCurlShare);
+        {
+            std::lock_guard<std::mutex> pool_guard(curl_pool_lock);
+            if (!curl_pool->empty()) {
+                CURL *handle = curl_pool->back();
+                curl_pool->pop_back();
+                return handle;
+            }
+        }
+        return curl_easy_init();
+    }
+
+    static void releaseCurlHandle(CURL *handle) {
+        curl_easy_reset(handle); // forgets the options, but keeps the open connections
+        {
+            std::lock_guard<std::mutex> pool_guard(curl_pool_lock);
+            if (curl_pool->size() < curl_pool_max) {
+                curl_pool->push_back(handle);
+                return;
+            }
+        }
+        curl_easy_cleanup(handle);
+    }
+
+    /*!
+     * Represents a libcurl connection that can be used to make a single HTTP request. The
+     * underlying easy handle is taken from the pool and returned to it afterwards.
      */
     class CurlConnection {
     public:
         std::string responseBody;
         std::unordered_map<std::string, std::string> responseHeaders;
 
-        CurlConnection(const std::string &url, const std::unordered_map<std::string, std::string> &requestHeaders,
-                       long timeout) : _url(url) {
-            // Make a libcurl connection object.
+        CurlConnection(const HttpRequest &request) : _url(request.url), _method(request.method),
+                                                     _body(request.body) {
+            // Get a libcurl connection object.
 
-            _conn = curl_easy_init();
+            _conn = acquireCurlHandle();
+            _headers = nullptr;
 
             if (_conn == nullptr) {
                 throw HttpError(__LINE__, "Failed to create libcurl connection");
@@ -1098,87 +1176,84 @@ namespace shttps {
                 if (curl_easy_setopt(_conn, CURLOPT_ERRORBUFFER, _curlErrorBuffer) != CURLE_OK) {
                     throw HttpError(__LINE__, "Failed to set libcurl error buffer");
                 }
+                _curlErrorBuffer[0] = '\0';
 
                 // Tell Curl not to use signal handlers. This is required in multi-threaded applications.
-                if (curl_easy_setopt(_conn, CURLOPT_NOSIGNAL, 1L) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set CURLOPT_NOSIGNAL: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
+                setopt(CURLOPT_NOSIGNAL, 1L, "Failed to set CURLOPT_NOSIGNAL");
+
+                // Share the DNS cache and TLS sessions with the other connections.
+                if (curl_share != nullptr) {
+                    setopt(CURLOPT_SHARE, curl_share, "Failed to set libcurl share");
                 }
 
+                // Keep idle connections to the server alive.
+                setopt(CURLOPT_TCP_KEEPALIVE, 1L, "Failed to set TCP keep-alive");
+
                 // Set the connection URL.
-                if (curl_easy_setopt(_conn, CURLOPT_URL, url.c_str()) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set libcurl URL: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
+                setopt(CURLOPT_URL, _url.c_str(), "Failed to set libcurl URL");
+
+                // Set the connection timeout, and, if given, the time the whole request may take, so that
+                // a server which accepts the connection but never answers cannot block the worker thread.
+                setopt(CURLOPT_CONNECTTIMEOUT_MS, request.timeout, "Failed to set connection timeout");
+                if (request.request_timeout > 0) {
+                    setopt(CURLOPT_TIMEOUT_MS, request.request_timeout, "Failed to set request timeout");
                 }
 
-                // Set the connection timeout.
-                if (curl_easy_setopt(_conn, CURLOPT_CONNECTTIMEOUT_MS, timeout) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set connection timeout: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
+                // Set the HTTP method and the data to be sent.
+                if (_method == "GET") {
+                    setopt(CURLOPT_HTTPGET, 1L, "Failed to set HTTP method");
+                } else if ((_method == "POST") || (_method == "PUT")) {
+                    setopt(CURLOPT_POSTFIELDS, _body.data(), "Failed to set request body");
+                    setopt(CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) _body.size(), "Failed to set request body size");
+                    if (_method == "PUT") {
+                        setopt(CURLOPT_CUSTOMREQUEST, "PUT", "Failed to set HTTP method");
+                    }
+                } else {
+                    throw HttpError(__LINE__, "unknown method " + _method);
                 }
 
                 // Set the HTTP request headers.
-
-                struct curl_slist *chunk = nullptr;
-
-                for (const auto &header : requestHeaders) {
+                for (const auto &header : request.headers) {
                     std::string headerStr = header.first + ": " + header.second;
-                    chunk = curl_slist_append(chunk, headerStr.c_str());
+                    _headers = curl_slist_append(_headers, headerStr.c_str());
                 }
 
-                if (curl_easy_setopt(_conn, CURLOPT_HTTPHEADER, chunk) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set HTTP headers: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
-                }
+                setopt(CURLOPT_HTTPHEADER, _headers, "Failed to set HTTP headers");
 
                 // Tell the connection to follow redirects.
-                if (curl_easy_setopt(_conn, CURLOPT_FOLLOWLOCATION, 1L) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set libcurl redirect option: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
-                }
+                setopt(CURLOPT_FOLLOWLOCATION, 1L, "Failed to set libcurl redirect option");
 
                 // Register a function for handling the connection's response data.
-                if (curl_easy_setopt(_conn, CURLOPT_WRITEFUNCTION, curlWriterCallback) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set libcurl writer callback: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
-                }
+                setopt(CURLOPT_WRITEFUNCTION, curlWriterCallback, "Failed to set libcurl writer callback");
 
                 // Set the connection's response data buffer.
-                if (curl_easy_setopt(_conn, CURLOPT_WRITEDATA, &responseBody) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set libcurl response data buffer: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
-                }
+                setopt(CURLOPT_WRITEDATA, &responseBody, "Failed to set libcurl response data buffer");
 
                 // Register a fiunction for handling the connection's response headers.
-                if (curl_easy_setopt(_conn, CURLOPT_HEADERFUNCTION, curlHeaderCallback) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set libcurl response header callback: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
-                }
+                setopt(CURLOPT_HEADERFUNCTION, curlHeaderCallback, "Failed to set libcurl response header callback");
 
                 // Set the object that will collect the respnse headers.
-                if (curl_easy_setopt(_conn, CURLOPT_HEADERDATA, &responseHeaders) != CURLE_OK) {
-                    std::ostringstream errMsg;
-                    errMsg << "Failed to set libcurl response header object: " << _curlErrorBuffer;
-                    throw HttpError(__LINE__, errMsg.str());
-                }
+                setopt(CURLOPT_HEADERDATA, &responseHeaders, "Failed to set libcurl response header object");
             } catch (HttpError &err) {
-                curl_easy_cleanup(_conn);
+                release();
                 throw err;
             }
         }
 
-        void doGetRequest() {
-            if (curl_easy_perform(_conn) != CURLE_OK) {
+        void doRequest() {
+            checkResult(curl_easy_perform(_conn));
+        }
+
+        /*!
+         * Throws a HttpError if the request failed
+         *
+         * \param[in] code Result of curl_easy_perform, or of the transfer in a multi handle
+         */
+        void checkResult(CURLcode code) {
+            if (code != CURLE_OK) {
                 std::ostringstream errMsg;
-                errMsg << "HTTP GET request to " << _url << " failed: " << _curlErrorBuffer;
+                errMsg << "HTTP " << _method << " request to " << _url << " failed: "
+                       << ((_curlErrorBuffer[0] != '\0') ? _curlErrorBuffer : curl_easy_strerror(code));
                 throw HttpError(__LINE__, errMsg.str());
             }
         }
@@ -1189,26 +1264,119 @@ namespace shttps {
             return status_code;
         }
 
+        inline CURL *handle(void) { return _conn; }
+
         ~CurlConnection() {
-            curl_easy_cleanup(_conn);
+            release();
         }
 
     private:
         CURL *_conn;
+        struct curl_slist *_headers;
         std::string _url;
+        std::string _method;
+        std::string _body;
         char _curlErrorBuffer[CURL_ERROR_SIZE];
+
+        template<typename T>
+        void setopt(CURLoption option, T value, const char *msg) {
+            if (curl_easy_setopt(_conn, option, value) != CURLE_OK) {
+                std::ostringstream errMsg;
+                errMsg << msg << ": " << _curlErrorBuffer;
+                throw HttpError(__LINE__, errMsg.str());
+            }
+        }
+
+        void release(void) {
+            if (_conn != nullptr) {
+                releaseCurlHandle(_conn);
+                _conn = nullptr;
+            }
+            if (_headers != nullptr) {
+                curl_slist_free_all(_headers);
+                _headers = nullptr;
+            }
+        }
     };
 
 
+    /*!
+     * Reads the optional parameters of a request (header table, timeouts, body) from the Lua stack.
+     * They are distinguished by their type, so that they can be given in any order. The first integer
+     * is the connection timeout, a second one the time the whole request may take.
+     */
+    static void get_http_options(lua_State *L, int first, int last, HttpRequest &request) {
+        int ntimeouts = 0;
+
+        for (int i = first; i <= last; i++) {
+            if (lua_istable(L, i)) { // process header table
+                lua_pushnil(L);
+
+                while (lua_next(L, i) != 0) {
+                    const char *key = lua_tostring(L, -2);
+                    const char *value = lua_tostring(L, -1);
+                    request.headers[key] = value;
+                    lua_pop(L, 1);
+                }
+            } else if (lua_isinteger(L, i)) { // process timeouts
+                if (ntimeouts++ == 0) {
+                    request.timeout = static_cast<long>(lua_tointeger(L, i));
+                } else {
+                    request.request_timeout = static_cast<long>(lua_tointeger(L, i));
+                }
+            } else if (lua_type(L, i) == LUA_TSTRING) { // process body
+                size_t len;
+                const char *body = lua_tolstring(L, i, &len);
+                request.body = std::string(body, len);
+            }
+        }
+    }
+    //=========================================================================
+
+    /*!
+     * Pushes the result table of a finished request
+     */
+    static void push_http_result(lua_State *L, CurlConnection &curlConnection, int duration) {
+        // Construct a Lua table containing the HTTP response.
+        lua_createtable(L, 0, 0); // table
+
+        lua_pushstring(L, "status_code"); // table - "success"
+        lua_pushinteger(L, curlConnection.getStatusCode()); // table - "status_code" - status_code
+        lua_rawset(L, -3); // table
+
+        lua_pushstring(L, "body"); // table - "body"
+        std::string &responseBody = curlConnection.responseBody;
+        lua_pushlstring(L, responseBody.c_str(), responseBody.length()); // table - "body" - curlResponseBuffer
+        lua_rawset(L, -3); // table
+
+        lua_pushstring(L, "duration"); // table - "duration"
+        lua_pushinteger(L, duration); // table - "duration" - duration
+        lua_rawset(L, -3); // table
+
+        lua_pushstring(L, "header"); // table1 - "header"
+        std::unordered_map<std::string, std::string> &responseHeaders = curlConnection.responseHeaders;
+        lua_createtable(L, 0, responseHeaders.size()); // table - "header" - table2
+        for (auto const &iterator : responseHeaders) {
+            lua_pushstring(L, iterator.first.c_str()); // table - "header" - table2 - headername
+            lua_pushstring(L, iterator.second.c_str()); // table - "header" - table2 - headername - headervalue
+            lua_rawset(L, -3); // table - "header" - table2
+        }
+        lua_rawset(L, -3); // table
+    }
+    //=========================================================================
+
     /*!
      * Get data from a http server
-     * LUA: result = server.http("GET", "http://server.domain/path/file" [, header] [, timeout])
+     * LUA: result = server.http(method, "http://server.domain/path/file" [, header] [, timeout [, request_timeout]]
+     *                            [, body])
      * where header is an associative array (key-value pairs) of header variables.
      * Parameters:
-     *  - method: "GET" (only method allowed so far
+     *  - method: "GET", "POST" or "PUT"
      *  - url: complete url including optional port, but no authorization yet
      *  - header: optional table with HTTP-header key-value pairs
-     *  - timeout: option number of milliseconds until the connect timeouts
+     *  - timeout: optional number of milliseconds the connection may take at most (default 2000)
+     *  - request_timeout: optional number of milliseconds the whole request may take at most (default: no limit)
+     *  - body: optional string with the data to be sent with "POST" or "PUT"
      *
      * result = {
      *    header {
@@ -1216,6 +1384,8 @@ namespace shttps {
      *    },
      *    body = data
      * }
+     *
+     * Connections to the server are kept open and reused by later calls.
      */
     static int lua_http_client(lua_State *L) {
         int top = lua_gettop(L);
@@ -1223,94 +1393,177 @@ namespace shttps {
         if (top < 2) {
             lua_settop(L, 0); // clear stack
             lua_pushboolean(L, false);
-            lua_pushstring(L, "'server.http(method, url [, header] [, timeout])' requires at least 2 parameters");
+            lua_pushstring(L, "'server.http(method, url [, header] [, timeout [, request_timeout]] [, body])' requires at least 2 parameters");
             return 2;
         }
 
-        // Get the first parameter: HTTP method (only "GET" is supported at the moment)
-        std::string method = lua_tostring(L, 1);
+        HttpRequest request;
+
+        // Get the first parameter: HTTP method
+        request.method = lua_tostring(L, 1);
 
         // Get the second parameter: URL
-        std::string url = lua_tostring(L, 2);;
+        request.url = lua_tostring(L, 2);
 
-        // the next parameters are either the header values and/or the timeout
+        // the next parameters are the header values, the timeout and/or the body
         // header: table of key/value pairs of additional HTTP-headers to be sent
-        // timeout: number of milliseconds any operation of the socket may take at maximum
-        std::unordered_map<std::string, std::string> requestHeaders;
-        int timeout = 2000; // default is 2000 ms
+        // timeout: number of milliseconds the connection may take at maximum
+        // request_timeout: number of milliseconds the whole request may take at maximum
+        // body: string to be sent as request body
+        request.timeout = 2000; // default is 2000 ms
+        request.request_timeout = 0; // default is no limit
+        get_http_options(L, 3, top, request);
 
-        if (lua_istable(L, 3)) { // process header table
-            lua_pushnil(L);
+        lua_settop(L, 0); // clear stack
 
-            while (lua_next(L, 3) != 0) {
-                const char *key = lua_tostring(L, -2);
-                const char *value = lua_tostring(L, -1);
-                requestHeaders[key] = value;
-                lua_pop(L, 1);
-            }
-        } else if (lua_isinteger(L, 3)) { // process timeout
-            timeout = static_cast<int>(lua_tointeger(L, 1));
-            lua_pop(L, 1);
+        try {
+            // Perform the HTTP request using libcurl.
+            CurlConnection curlConnection(request);
+            auto start = get_time::now();
+            curlConnection.doRequest();
+
+            // Calculate how long the request took.
+            auto end = get_time::now();
+            auto diff = end - start;
+            int duration = std::chrono::duration_cast<ms>(diff).count();
+
+            // Return true to indicate that this function call succeeded.
+            lua_pushboolean(L, true);
+            push_http_result(L, curlConnection, duration);
+
+            return 2; // we return success and one table...
+        } catch (HttpError &err) {
+            lua_settop(L, 0); // clear stack
+            lua_pushboolean(L, false);
+            lua_pushstring(L, err.what().c_str()); // table - "errmsg" - errorMsg
+            return 2;
         }
+    }
+    //=========================================================================
 
-        lua_settop(L, 0); // clear stack
+    /*!
+     * Make several HTTP requests concurrently
+     * LUA: success, results = server.http_multi(requests)
+     * Parameters:
+     *  - requests: array of tables { method = "GET", url = "http://...", header = {...}, timeout = ms,
+     *    request_timeout = ms, body = data }, only url is required
+     *
+     * results is an array with a table for every request, in the same order. A table is either the result of the
+     * request (like the one of server.http()), or { errmsg = "..." } if the request failed or took longer than
+     * one of its timeouts. Without request_timeout, the function waits until all servers have answered.
+     */
+    static int lua_http_multi(lua_State *L) {
+        int top = lua_gettop(L);
 
-        try {
-            if (method == "GET") { // the only method we support so far...
-                // Perform the HTTP request using libcurl.
-                CurlConnection curlConnection(url, requestHeaders, timeout);
-                auto start = get_time::now();
-                curlConnection.doGetRequest();
+        if ((top < 1) || !lua_istable(L, 1)) {
+            lua_settop(L, 0); // clear stack
+            lua_pushboolean(L, false);
+            lua_pushstring(L, "'server.http_multi(requests)' requires a table of requests");
+            return 2;
+        }
 
-                // Calculate how long the request took.
-                auto end = get_time::now();
-                auto diff = end - start;
-                int duration = std::chrono::duration_cast<ms>(diff).count();
+        std::vector<HttpRequest> requests;
+        lua_Integer nrequests = luaL_len(L, 1);
 
-                // Return true to indicate that this function call succeeded.
-                lua_pushboolean(L, true);
+        for (lua_Integer i = 1; i <= nrequests; i++) {
+            HttpRequest request;
+            request.method = "GET";
+            request.timeout = 2000; // default is 2000 ms
+            request.request_timeout = 0; // default is no limit
 
-                // Construct a Lua table containing the HTTP response.
-                lua_createtable(L, 0, 0); // table
+            lua_geti(L, 1, i); // request
+            if (lua_istable(L, -1)) {
+                lua_getfield(L, -1, "method"); // request - method
+                if (lua_type(L, -1) == LUA_TSTRING) request.method = lua_tostring(L, -1);
+                lua_getfield(L, -2, "url"); // request - method - url
+                if (lua_type(L, -1) == LUA_TSTRING) request.url = lua_tostring(L, -1);
+                lua_getfield(L, -3, "header"); // request - method - url - header
+                lua_getfield(L, -4, "timeout"); // request - method - url - header - timeout
+                lua_getfield(L, -5, "body"); // request - method - url - header - timeout - body
+                get_http_options(L, lua_gettop(L) - 2, lua_gettop(L), request);
+                lua_getfield(L, -6, "request_timeout"); // request - method - url - header - timeout - body - request_timeout
+                if (lua_isinteger(L, -1)) request.request_timeout = static_cast<long>(lua_tointeger(L, -1));
+                lua_pop(L, 6); // request
+            }
+            lua_pop(L, 1);
 
-                lua_pushstring(L, "status_code"); // table - "success"
-                lua_pushinteger(L, curlConnection.getStatusCode()); // table - "status_code" - status_code
-                lua_rawset(L, -3); // table
+            requests.push_back(request);
+        }
 
-                lua_pushstring(L, "body"); // table - "body"
-                std::string &responseBody = curlConnection.responseBody;
-                lua_pushlstring(L, responseBody.c_str(), responseBody.length()); // table - "body" - curlResponseBuffer
-                lua_rawset(L, -3); // table
+        lua_settop(L, 0); // clear stack
 
-                lua_pushstring(L, "duration"); // table - "duration"
-                lua_pushinteger(L, duration); // table - "duration" - duration
-                lua_rawset(L, -3); // table
+        //
+        // set up all requests; those that cannot even be started get their error message right away
+        //
+        std::vector<std::unique_ptr<CurlConnection>> connections(requests.size());
+        std::vector<std::string> errors(requests.size());
+        std::unordered_map<CURL *, size_t> index;
+        CURLM *multi = curl_multi_init();
 
-                lua_pushstring(L, "header"); // table1 - "header"
-                std::unordered_map<std::string, std::string> &responseHeaders = curlConnection.responseHeaders;
-                lua_createtable(L, 0, responseHeaders.size()); // table - "header" - table2
-                for (auto const &iterator : responseHeaders) {
-                    lua_pushstring(L, iterator.first.c_str()); // table - "header" - table2 - headername
-                    lua_pushstring(L, iterator.second.c_str()); // table - "header" - table2 - headername - headervalue
-                    lua_rawset(L, -3); // table - "header" - table2
+        if (multi == nullptr) {
+            lua_pushboolean(L, false);
+            lua_pushstring(L, "Failed to create libcurl multi handle");
+            return 2;
+        }
+
+        for (size_t i = 0; i < requests.size(); i++) {
+            try {
+                connections[i] = shttps::make_unique<CurlConnection>(requests[i]);
+                if (curl_multi_add_handle(multi, connections[i]->handle()) != CURLM_OK) {
+                    throw HttpError(__LINE__, "Failed to add request to libcurl multi handle");
                 }
-                lua_rawset(L, -3); // table
+                index[connections[i]->handle()] = i;
+            } catch (HttpError &err) {
+                errors[i] = err.what();
+                connections[i].reset();
+            }
+        }
+
+        auto start = get_time::now();
+        std::vector<int> durations(requests.size(), 0);
+        int running = 0;
+
+        do {
+            CURLMcode mc = curl_multi_perform(multi, &running);
+            if (mc == CURLM_OK) {
+                mc = curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+            }
+            if (mc != CURLM_OK) break;
+
+            CURLMsg *msg;
+            int msgs_left;
+            while ((msg = curl_multi_info_read(multi, &msgs_left)) != nullptr) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                size_t i = index[msg->easy_handle];
+                durations[i] = std::chrono::duration_cast<ms>(get_time::now() - start).count();
+                try {
+                    connections[i]->checkResult(msg->data.result);
+                } catch (HttpError &err) {
+                    errors[i] = err.what();
+                }
+            }
+        } while (running > 0);
 
-                return 2; // we return success and one table...
+        lua_pushboolean(L, true);
+        lua_createtable(L, requests.size(), 0); // table
+
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (errors[i].empty() && (connections[i] != nullptr)) {
+                push_http_result(L, *connections[i], durations[i]);
             } else {
-                std::string errorMsg = std::string("'server.http(method, url, [header])': unknown method ") + method;
-                throw HttpError(__LINE__, errorMsg);
+                lua_createtable(L, 0, 1); // table - table2
+                lua_pushstring(L, "errmsg"); // table - table2 - "errmsg"
+                lua_pushstring(L, errors[i].empty() ? "Request not finished" : errors[i].c_str());
+                lua_rawset(L, -3); // table - table2
             }
-        } catch (HttpError &err) {
-            lua_settop(L, 0); // clear stack
-            lua_pushboolean(L, false);
-            lua_pushstring(L, err.what().c_str()); // table - "errmsg" - errorMsg
-            return 2;
+            lua_rawseti(L, -2, i + 1); // table
         }
 
-        lua_settop(L, 0); // clear stack
-        lua_pushboolean(L, false);
-        lua_pushstring(L, "Unknown error"); // table - "errmsg" - errorMsg
+        for (auto &connection : connections) {
+            if (connection != nullptr) curl_multi_remove_handle(multi, connection->handle());
+        }
+        curl_multi_cleanup(multi);
+
         return 2;
     }
     //=========================================================================
@@ -2430,6 +2683,10 @@ namespace shttps {
         lua_pushcfunction(L, lua_http_client); // table1 - "index_L1" - function
         lua_rawset(L, -3); // table1
 
+        lua_pushstring(L, "http_multi"); // table1 - "index_L1"
+        lua_pushcfunction(L, lua_http_multi); // table1 - "index_L1" - function
+        lua_rawset(L, -3); // table1
+
         lua_pushstring(L, "sendStatus"); // table1 - "index_L1"
         lua_pushcfunction(L, lua_send_status); // table1 - "index_L1" - function
         lua_rawset(L, -3); // table1
@@ -2507,6 +2764,124 @@ namespace shttps {
     //=========================================================================
 
 
+    //
+    // the addresses of these variables are the keys of the pristine state in the Lua registry: a table mapping
+    // every table reachable from the globals to a copy of its fields, and a table mapping them to their metatables
+    //
+    static const char pristine_tables_key = 0;
+    static const char pristine_metatables_key = 0;
+
+    /*!
+     * Records the fields and the metatable of a table, and of all tables reachable from it
+     *
+     * \param[in] L Lua state
+     * \param[in] table Absolute stack index of the table
+     * \param[in] tables Absolute stack index of the table of copies
+     * \param[in] metatables Absolute stack index of the table of metatables
+     */
+    static void snapshot_table(lua_State *L, int table, int tables, int metatables) {
+        lua_pushvalue(L, table); // table
+        if (lua_rawget(L, tables) != LUA_TNIL) { // copy
+            lua_pop(L, 1); // -
+            return; // already recorded
+        }
+        lua_pop(L, 1); // -
+
+        luaL_checkstack(L, 8, "snapshot of the Lua globals");
+        lua_newtable(L); // copy
+        int copy = lua_gettop(L);
+        lua_pushvalue(L, table); // copy - table
+        lua_pushvalue(L, copy); // copy - table - copy
+        lua_rawset(L, tables); // copy
+
+        if (lua_getmetatable(L, table)) { // copy - metatable
+            lua_pushvalue(L, table); // copy - metatable - table
+            lua_pushvalue(L, -2); // copy - metatable - table - metatable
+            lua_rawset(L, metatables); // copy - metatable
+            snapshot_table(L, lua_gettop(L), tables, metatables);
+            lua_pop(L, 1); // copy
+        }
+
+        lua_pushnil(L); // copy - nil
+        while (lua_next(L, table) != 0) { // copy - key - value
+            lua_pushvalue(L, -2); // copy - key - value - key
+            lua_pushvalue(L, -2); // copy - key - value - key - value
+            lua_rawset(L, copy); // copy - key - value
+            if (lua_istable(L, -1)) snapshot_table(L, lua_gettop(L), tables, metatables);
+            lua_pop(L, 1); // copy - key
+        }
+
+        lua_pop(L, 1); // -
+    }
+    //=========================================================================
+
+    /*!
+     * Gives a table the fields of its copy again
+     *
+     * \param[in] L Lua state
+     * \param[in] table Absolute stack index of the table
+     * \param[in] copy Absolute stack index of the copy
+     */
+    static void restore_table(lua_State *L, int table, int copy) {
+        lua_pushnil(L); // nil
+        while (lua_next(L, table) != 0) { // key - value
+            lua_pop(L, 1); // key
+            lua_pushvalue(L, -1); // key - key
+            if (lua_rawget(L, copy) == LUA_TNIL) { // key - nil
+                // clearing an existing field during the traversal is allowed
+                lua_pushvalue(L, -2); // key - nil - key
+                lua_pushnil(L); // key - nil - key - nil
+                lua_rawset(L, table); // key - nil
+            }
+            lua_pop(L, 1); // key
+        }
+
+        lua_pushnil(L); // nil
+        while (lua_next(L, copy) != 0) { // key - value
+            lua_pushvalue(L, -2); // key - value - key
+            lua_insert(L, -2); // key - key - value
+            lua_rawset(L, table); // key
+        }
+    }
+    //=========================================================================
+
+    void LuaServer::snapshotGlobals(void) {
+        lua_settop(L, 0);
+        lua_newtable(L); // tables
+        lua_newtable(L); // tables - metatables
+        lua_pushglobaltable(L); // tables - metatables - globals
+        snapshot_table(L, 3, 1, 2);
+        lua_pop(L, 1); // tables - metatables
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &pristine_metatables_key); // tables
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &pristine_tables_key); // -
+    }
+    //=========================================================================
+
+    void LuaServer::resetGlobals(void) {
+        lua_settop(L, 0);
+
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &pristine_tables_key); // tables
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &pristine_metatables_key); // tables - metatables
+        if (lua_istable(L, 1) && lua_istable(L, 2)) {
+            lua_pushnil(L); // tables - metatables - nil
+
+            while (lua_next(L, 1) != 0) { // tables - metatables - table - copy
+                restore_table(L, 3, 4);
+                lua_pushvalue(L, 3); // tables - metatables - table - copy - table
+                lua_rawget(L, 2); // tables - metatables - table - copy - metatable (or nil)
+                lua_setmetatable(L, 3); // tables - metatables - table - copy
+                lua_pop(L, 1); // tables - metatables - table
+            }
+        }
+        lua_settop(L, 0);
+
+        lua_pushnil(L);
+        lua_setglobal(L, luaconnection);
+
+        lua_gc(L, LUA_GCCOLLECT, 0);
+    }
+    //=========================================================================
+
     void LuaServer::add_servertableentry(const std::string &name, const std::string &value) {
         lua_getglobal(L, servertablename); // "table1"
 
@@ -151,6 +151,24 @@ namespace shttps {
          */
         void createGlobals(Connection &conn);
 
+        /*!
+         * Records the pristine state of the interpreter: the fields and metatables of the table of
+         * global variables and of all tables reachable from it (e.g. the tables created by the init
+         * script). It is called once the interpreter has been initialized (init script and global
+         * functions) and before it is used for the first request.
+         */
+        void snapshotGlobals(void);
+
+        /*!
+         * Resets the interpreter after a request, so that it can be reused for the next one without
+         * anything of the request leaking into it: the tables of the pristine state get back their
+         * fields and metatables (new global variables are removed, modified ones get their old value),
+         * the reference to the connection is cleared and a full garbage collection is done (which
+         * frees e.g. the images created by the scripts). Tables created during the request are not
+         * part of the pristine state.
+         */
+        void resetGlobals(void);
+
 
         std::string configString(const std::string table, const std::string variable, const std::string defval);
 
@@ -31,6 +31,12 @@
 #include <cstring>      // Needed for memset
 #include <utility>
 #include <regex>
+#include <deque>
+#include <unordered_set>
+#include <list>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
 
 #include <sys/types.h>
 #include <sys/select.h>
@@ -46,6 +52,10 @@
 #include <pthread.h>
 #include <pwd.h>
 #include <syslog.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 //
 // openssl includes
 //#include "openssl/applink.c"
@@ -60,12 +70,12 @@
 
 static const char __file__[] = __FILE__;
 
-static std::mutex threadlock; // mutex to protect map of active threads
-static std::mutex idlelock; // mutex to protect vector of idle threads (keep alive condition)
+static std::mutex idlelock; // mutex to protect the list of idle connections (keep alive condition)
+static std::mutex queuelock; // mutex to protect the queue of connections waiting for a worker
+static std::mutex activelock; // mutex to protect the set of connections served by a worker
+static std::condition_variable queuecond; // signals the workers that a connection is waiting or that they should stop
 static std::mutex debugio; // mutex to protect debugging messages from threads
 
-static std::vector<pthread_t> idle_thread_ids;
-
 // The signal caught by the sig_thread function, used only for debugging.
 static int signal_result = 0;
 
@@ -73,21 +83,50 @@ namespace shttps {
 
     const char loggername[] = "Sipi"; // see Global.h !!
 
-    typedef struct {
+    /*!
+     * Holds everything we need to know about an open connection. The socket stream is kept
+     * between the requests of a keep-alive connection, since it may already hold the next request.
+     */
+    typedef struct TData {
         int sock;
 #ifdef SHTTPS_ENABLE_SSL
         SSL *cSSL;
 #endif
         std::string peer_ip;
         int peer_port;
-        int commpipe_read;
+        int keep_alive; //!< keep alive timeout in seconds
+        int read_timeout; //!< seconds a client may pause while sending a request or before the first request
+        std::chrono::steady_clock::time_point idle_until; //!< an idle connection is closed at this time
+        std::list<TData *>::iterator idle_pos; //!< position in the list of idle connections while idle
+        bool want_write; //!< true, if the idle connection waits until the socket is writable (TLS handshake)
+#ifdef SHTTPS_ENABLE_SSL
+        std::chrono::steady_clock::time_point handshake_until; //!< the TLS handshake has to be done until this time
+#endif
+#ifdef __linux__
+        bool in_epoll; //!< true, if the socket has been registered with the epoll instance
+#endif
+        std::unique_ptr<SockStream> sockstream;
+        std::unique_ptr<std::istream> ins;
+        std::unique_ptr<std::ostream> os;
         Server *serv;
     } TData;
+
+    static std::deque<TData *> waiting_conns; // connections with a request, waiting for a worker (queuelock)
+    static bool workers_stop = false; // tells the workers to terminate (queuelock)
+    static std::list<TData *> idle_conns; // keep-alive connections waiting for the next request, ordered by idle_until (idlelock)
+    static bool idle_closed = false; // the server is shutting down, connections are closed instead of becoming idle (idlelock)
+    static std::unordered_set<TData *> active_conns; // connections being served by a worker (activelock)
+    static int idlepipe[2]; // a worker writes to this pipe to wake up the main loop if the next idle timeout changed
+#ifdef __linux__
+    static int epollfd = -1; // epoll instance watching the idle connections; it is itself watched by the main loop
+    static const int max_epoll_events = 256; // maximal number of ready idle connections taken per round
+#endif
     //=========================================================================
 
     /*!
      * Starts a thread just to catch all signals sent to the server process.
-     * If it receives SIGINT or SIGTERM, tells the server to stop.
+     * If it receives SIGINT or SIGTERM, tells the server to stop. If it receives
+     * SIGHUP, the SSL certificate and key are reloaded.
      */
     static void *sig_thread(void *arg) {
         Server *serverptr = static_cast<Server *>(arg);
@@ -96,6 +135,7 @@ namespace shttps {
         sigaddset(&set, SIGPIPE);
         sigaddset(&set, SIGINT);
         sigaddset(&set, SIGTERM);
+        sigaddset(&set, SIGHUP);
 
         int sig;
 
@@ -114,6 +154,14 @@ namespace shttps {
                 serverptr->stop();
                 return nullptr;
             }
+
+#ifdef SHTTPS_ENABLE_SSL
+            if ((sig == SIGHUP) && (serverptr->ssl_port() > 0)) {
+                if (serverptr->reloadSSLContext()) {
+                    syslog(LOG_INFO, "Reloaded SSL certificate and key");
+                }
+            }
+#endif
         }
     }
     //=========================================================================
@@ -466,12 +514,10 @@ namespace shttps {
                    const std::string &loglevel_p) : port(port_p), _nthreads(nthreads_p), _logfilename(logfile_p),
                                                     _loglevel(loglevel_p) {
         _ssl_port = -1;
+#ifdef SHTTPS_ENABLE_SSL
+        _sslctx = nullptr;
+#endif
 
-        //
-        // we use a semaphore object to control the number of threads
-        //
-        semname = "shttps";
-        semname += std::to_string(port);
         _user_data = nullptr;
         running = false;
         _keep_alive_timeout = 20;
@@ -542,10 +588,6 @@ namespace shttps {
         SSL_library_init();
         OpenSSL_add_all_algorithms();
 #endif
-
-        ::sem_unlink(semname.c_str()); // unlink to be sure that we start from scratch
-        _semaphore = ::sem_open(semname.c_str(), O_CREAT, 0x755, _nthreads);
-        _semcnt = _nthreads;
     }
     //=========================================================================
 
@@ -562,6 +604,73 @@ namespace shttps {
         }
     }
     //=========================================================================
+
+    bool Server::reloadSSLContext(void) {
+        SSL_CTX *sslctx = nullptr;
+
+        try {
+            if ((sslctx = SSL_CTX_new(SSLv23_server_method())) == nullptr) {
+                throw SSLError(__file__, __LINE__, "OpenSSL error: SSL_CTX_new() failed");
+            }
+            SSL_CTX_set_options(sslctx, SSL_OP_SINGLE_DH_USE);
+            if (SSL_CTX_use_certificate_file(sslctx, _ssl_certificate.c_str(), SSL_FILETYPE_PEM) != 1) {
+                throw SSLError(__file__, __LINE__,
+                               "OpenSSL error: SSL_CTX_use_certificate_file(" + _ssl_certificate + ") failed");
+            }
+            if (SSL_CTX_use_PrivateKey_file(sslctx, _ssl_key.c_str(), SSL_FILETYPE_PEM) != 1) {
+                throw SSLError(__file__, __LINE__, "OpenSSL error: SSL_CTX_use_PrivateKey_file(" + _ssl_key + ") failed");
+            }
+            if (!SSL_CTX_check_private_key(sslctx)) {
+                throw SSLError(__file__, __LINE__, "OpenSSL error: SSL_CTX_check_private_key() failed");
+            }
+        } catch (SSLError &err) {
+            syslog(LOG_ERR, "%s", err.to_string().c_str());
+            if (sslctx != nullptr) SSL_CTX_free(sslctx);
+            return false;
+        }
+
+        //
+        // sessions are resumed either from the server side cache or from a session ticket
+        //
+        static const unsigned char session_id_context[] = "shttps";
+        SSL_CTX_set_session_id_context(sslctx, session_id_context, sizeof(session_id_context) - 1);
+        SSL_CTX_set_session_cache_mode(sslctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(sslctx, 20480);
+        SSL_CTX_set_timeout(sslctx, 300);
+        SSL_CTX_clear_options(sslctx, SSL_OP_NO_TICKET);
+
+        SSL_CTX *oldctx;
+        {
+            std::lock_guard<std::mutex> sslctx_guard(_sslctx_lock);
+            oldctx = _sslctx;
+
+            if (oldctx != nullptr) {
+                //
+                // the size of the ticket keys depends on the OpenSSL version (48 bytes up to 1.0.2,
+                // 80 bytes since 1.1.0); called without a buffer, OpenSSL returns the size it expects
+                //
+                long keys_len = SSL_CTX_get_tlsext_ticket_keys(oldctx, nullptr, 0);
+                std::vector<unsigned char> ticket_keys(keys_len > 0 ? (size_t) keys_len : 0);
+                if (ticket_keys.empty() ||
+                    (SSL_CTX_get_tlsext_ticket_keys(oldctx, ticket_keys.data(), keys_len) != 1) ||
+                    (SSL_CTX_set_tlsext_ticket_keys(sslctx, ticket_keys.data(), keys_len) != 1)) {
+                    syslog(LOG_WARNING, "Could not copy the TLS session ticket keys to the new SSL context; "
+                                        "existing session tickets will not be resumed");
+                }
+            }
+
+            _sslctx = sslctx;
+        }
+
+        //
+        // every SSL object holds a reference to its context, thus the old context lives on
+        // until its last connection has been closed
+        //
+        if (oldctx != nullptr) SSL_CTX_free(oldctx);
+
+        return true;
+    }
+    //=========================================================================
 #endif
 
 
@@ -634,43 +743,34 @@ namespace shttps {
     //=========================================================================
 
 
-    static void idle_add(pthread_t tid_p) {
-        std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
-
-        idle_thread_ids.push_back(tid_p);
-    }
-    //=========================================================================
-
-    static void idle_remove(pthread_t tid_p) {
-        int index = 0;
-        bool in_idle = false;
-        std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
-
-        for (auto tid : idle_thread_ids) {
-            if (tid == tid_p) {
-                in_idle = true;
-                break;
-            }
-
-            index++;
-        }
-
-        if (in_idle) {
-            //
-            // the vector is in idle state, remove it from the idle vector
-            //
-            idle_thread_ids.erase(idle_thread_ids.begin() + index);
-        }
+    /*!
+     * Switches a socket between blocking and non-blocking mode
+     */
+    static bool set_nonblocking(int sock, bool nonblocking) {
+        int flags = fcntl(sock, F_GETFL, 0);
+        if (flags < 0) return false;
+        flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        return fcntl(sock, F_SETFL, flags) == 0;
     }
     //=========================================================================
 
+    /*!
+     * Closes the socket of a connection. For TLS connections, close_notify is sent once on the
+     * non-blocking socket, without waiting for the answer of the client: a client which never
+     * answers must not block the thread closing the connection.
+     */
     static int close_socket(TData *tdata) {
 
 #ifdef SHTTPS_ENABLE_SSL
+        if ((tdata->cSSL != nullptr) && !SSL_is_init_finished(tdata->cSSL)) {
+            SSL_free(tdata->cSSL); // no shutdown, there is no established SSL connection
+            tdata->cSSL = nullptr;
+        }
+
         if (tdata->cSSL != nullptr) {
-            int sstat;
-            while ((sstat = SSL_shutdown(tdata->cSSL)) == 0);
-            if (sstat < 0) {
+            (void) set_nonblocking(tdata->sock, true);
+            int sstat = SSL_shutdown(tdata->cSSL);
+            if ((sstat < 0) && (SSL_get_error(tdata->cSSL, sstat) != SSL_ERROR_WANT_WRITE)) {
                 syslog(LOG_WARNING, "SSL socket error: shutdown of socket failed at [%s: %d] with error code %d",
                        __file__, __LINE__, SSL_get_error(tdata->cSSL, sstat));
             }
@@ -692,161 +792,229 @@ namespace shttps {
     }
     //=========================================================================
 
+    /*!
+     * Puts a connection with a waiting request into the queue served by the worker threads
+     */
+    static void enqueue_conn(TData *tdata) {
+        {
+            std::lock_guard<std::mutex> queue_mutex_guard(queuelock);
+            waiting_conns.push_back(tdata);
+        }
+        queuecond.notify_one();
+    }
+    //=========================================================================
 
     /*!
-     * Runs a request-handling thread.
+     * Parks a connection in the list of idle connections which is watched by the main loop, until
+     * the client sends data (or, if want_write is set, the socket is writable). These are new
+     * connections, keep-alive connections and connections in the middle of the TLS handshake.
+     * On Linux the socket is (re-)armed in the epoll instance, and the main loop is woken up only
+     * if the connection has the earliest timeout of all idle connections. Otherwise the main loop
+     * has to rebuild its poll set and is always woken up.
      *
-     * @param arg a pointer to a TData, which this function will delete before returning.
-     * @return NULL.
+     * @param tdata The connection
+     * @param until The connection is closed if nothing happened until this time
      */
-    static void *process_request(void *arg) {
-        TData *tdata = static_cast<TData *>(arg);
-        pthread_t my_tid = pthread_self();
+    static void idle_add(TData *tdata, std::chrono::steady_clock::time_point until) {
+        tdata->idle_until = until;
+        bool wakeup = false;
+        bool closed;
+        {
+            std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
+            closed = idle_closed;
 
-        //
-        // now we create the socket's SockStream
-        //
-        std::unique_ptr<SockStream> sockstream;
-#ifdef SHTTPS_ENABLE_SSL
-        if (tdata->cSSL != nullptr) {
-            sockstream = make_unique<SockStream>(tdata->cSSL);
-        } else {
-            sockstream = make_unique<SockStream>(tdata->sock);
-        }
+            if (!closed) {
+                //
+                // most connections have the same timeout, so we usually append at the end
+                //
+                auto pos = idle_conns.end();
+                while ((pos != idle_conns.begin()) && ((*std::prev(pos))->idle_until > tdata->idle_until)) --pos;
+                tdata->idle_pos = idle_conns.insert(pos, tdata);
+
+#ifdef __linux__
+                wakeup = (tdata->idle_pos == idle_conns.begin());
+
+                // one shot: the socket is reported once and then disarmed until it is idle again
+                struct epoll_event ev;
+                ev.events = (tdata->want_write ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+                ev.data.ptr = tdata;
+                if (epoll_ctl(epollfd, tdata->in_epoll ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, tdata->sock, &ev) != 0) {
+                    syslog(LOG_ERR, "epoll_ctl failed at [%s: %d]: %m", __file__, __LINE__);
+                    wakeup = true; // the main loop will close the connection when the timeout expires
+                } else {
+                    tdata->in_epoll = true;
+                }
 #else
-        sockstream = make_unique<SockStream>(tdata->sock);
+                wakeup = true;
 #endif
-        std::istream ins(sockstream.get());
-        std::ostream os(sockstream.get());
-
-        ThreadStatus tstatus;
-        int keep_alive = 1;
-        do {
-#ifdef SHTTPS_ENABLE_SSL
-            if (tdata->cSSL != nullptr) {
-                tstatus = tdata->serv->processRequest(&ins, &os, tdata->peer_ip, tdata->peer_port, true, keep_alive);
-            } else {
-                tstatus = tdata->serv->processRequest(&ins, &os, tdata->peer_ip, tdata->peer_port, false, keep_alive);
             }
-#else
-            tstatus = tdata->serv->processRequest(&ins, &os, tdata->peer_ip, tdata->peer_port, false, keep_alive);
-#endif
+        }
 
-            if (tstatus == CLOSE) break; // it's CLOSE , let's get out of the loop
+        if (closed) {
+            // the server is shutting down
+            close_socket(tdata);
+            delete tdata;
+            return;
+        }
 
-            //
-            // tstatus is CONTINUE. Let's check if we got in the meantime a CLOSE message from the main...
-            //
-            pollfd readfds[2];
-            readfds[0] = {tdata->commpipe_read, POLLIN, 0};
-            readfds[1] = {tdata->sock, POLLIN, 0};
+        if (wakeup && (write(idlepipe[1], "I", 1) != 1)) {
+            syslog(LOG_ERR, "Writing to idle pipe failed at [%s: %d]: %m", __file__, __LINE__);
+        }
+    }
+    //=========================================================================
 
-            if (poll(readfds, 2, 0) < 0) { // no blocking here!!!
-                syslog(LOG_ERR, "Non-blocking poll failed at [%s: %d]", __file__, __LINE__);
-                tstatus = CLOSE;
-                break; // accept returned something strange – probably we want to shutdown the server
-            }
+    /*!
+     * Removes a connection from the set of connections served by a worker. This has to be done
+     * before the connection is closed or becomes idle, where the next worker may pick it up.
+     */
+    static void active_remove(TData *tdata) {
+        std::lock_guard<std::mutex> active_mutex_guard(activelock);
+        active_conns.erase(tdata);
+    }
+    //=========================================================================
 
-            if (readfds[1].revents & POLLIN) {
-                continue;
-            }
+    /*!
+     * Returns true, if data from the client is waiting in the socket
+     */
+    static bool socket_readable(int sock) {
+        pollfd pfd = {sock, POLLIN, 0};
+        return (poll(&pfd, 1, 0) > 0) && (pfd.revents != 0);
+    }
+    //=========================================================================
+
+    /*!
+     * Returns true, if the next request has already been read (partially) into the buffers
+     */
+    static bool has_buffered_input(TData *tdata) {
+        if (tdata->ins->rdbuf()->in_avail() > 0) return true;
+#ifdef SHTTPS_ENABLE_SSL
+        if ((tdata->cSSL != nullptr) && (SSL_pending(tdata->cSSL) > 0)) return true;
+#endif
+        return false;
+    }
+    //=========================================================================
 
-            if (readfds[0].revents & POLLIN) { // something on the pipe from the main
+    /*!
+     * Serves the waiting request(s) of a connection. Afterwards the connection is
+     * either closed or, if it is a keep-alive connection, put back into the list of idle connections.
+     *
+     * @param tdata The connection; it is deleted if the connection is closed.
+     */
+    static void serve_connection(TData *tdata) {
+        //
+        // the socket's SockStream is created with the first request
+        //
+        if (tdata->sockstream == nullptr) {
+#ifdef SHTTPS_ENABLE_SSL
+            if (tdata->cSSL != nullptr) {
                 //
-                // we got a message on the communication channel from the main thread...
+                // the socket is non-blocking during the TLS handshake. If the handshake needs more
+                // data from the client (or has to wait until it can send), the connection goes back
+                // to the idle connections instead of blocking the worker.
                 //
-                if (Server::CommMsg::read(tdata->commpipe_read) != 0) {
-                    keep_alive = -1;
-                    break;
-                }
-                keep_alive = -1;
-                if (readfds[1].revents & POLLIN) { // but we already have data...
-                    continue; // continue loop
-                } else {
-                    break;
-                }
-            }
+                int sstat = SSL_accept(tdata->cSSL);
 
-            //
-            // we check if a new request is waiting for the semaphore which limits the number of threads
-            //
-            if (tdata->serv->semaphore_get() < 0) { //Another thread is waiting, give him a chance...
-                keep_alive = -1;
-                if (readfds[1].revents & POLLIN) { // but we already have data...
-                    continue; // we have data, we will close after the next round...
-                } else {
-                    break;
-                }
-            }
+                if (sstat <= 0) {
+                    int ssl_error = SSL_get_error(tdata->cSSL, sstat);
 
-            //
-            // if we can continue and have a keep_alive, let's set the thread to idle...
-            //
-            idle_add(my_tid);
-
-            //
-            // use poll to wait...
-            //
-            readfds[0] = {tdata->commpipe_read, POLLIN, 0};
-            readfds[1] = {tdata->sock, POLLIN, 0};
-            if (poll(readfds, 2, keep_alive * 1000) < 0) {
-                syslog(LOG_ERR, "Blocking poll failed at [%s: %d]", __file__, __LINE__);
-                tstatus = CLOSE;
-                idle_remove(my_tid);
-                break; // accept returned something strange – probably we want to shutdown the server
-            }
-
-            if (!(readfds[0].revents | readfds[1].revents)) { // we got a timeout from poll
-                //
-                // timeout from poll
-                //
-                tstatus = CLOSE;
-                idle_remove(my_tid);
-                break;
-            }
+                    if ((ssl_error == SSL_ERROR_WANT_READ) || (ssl_error == SSL_ERROR_WANT_WRITE)) {
+                        tdata->want_write = (ssl_error == SSL_ERROR_WANT_WRITE);
+                        active_remove(tdata);
+                        idle_add(tdata, tdata->handshake_until);
+                        return;
+                    }
 
-            if (readfds[0].revents & POLLIN) { // something on the pipe...
-                //
-                // we got a message on the communication channel from the main thread...
-                //
-                if (Server::CommMsg::read(tdata->commpipe_read) != 0) {
-                    keep_alive = -1;
-                    idle_remove(my_tid);
-                    break;
+                    syslog(LOG_ERR, "OpenSSL error: SSL_accept() failed with error code %d", ssl_error);
+                    active_remove(tdata);
+                    close_socket(tdata);
+                    delete tdata;
+                    return;
                 }
 
-                keep_alive = -1;
-                idle_remove(my_tid);
+                tdata->want_write = false;
 
-                if (readfds[1].revents & POLLIN) { // but we already have data...
-                    continue; // continue loop
-                } else {
-                    break;
+                if (!set_nonblocking(tdata->sock, false)) {
+                    syslog(LOG_ERR, "Could not make socket blocking at [%s: %d]: %m", __file__, __LINE__);
+                    active_remove(tdata);
+                    close_socket(tdata);
+                    delete tdata;
+                    return;
                 }
+
+                tdata->sockstream = make_unique<SockStream>(tdata->cSSL);
+            } else {
+                tdata->sockstream = make_unique<SockStream>(tdata->sock);
             }
-        } while (tstatus == CONTINUE);
+#else
+            tdata->sockstream = make_unique<SockStream>(tdata->sock);
+#endif
+            tdata->ins = shttps::make_unique<std::istream>(tdata->sockstream.get());
+            tdata->os = shttps::make_unique<std::ostream>(tdata->sockstream.get());
 
-        //
-        // let's close the socket
-        //
-        close_socket(tdata);
+            //
+            // after the handshake, the first request has usually not yet arrived
+            //
+            if (!has_buffered_input(tdata) && !socket_readable(tdata->sock)) {
+                active_remove(tdata);
+                idle_add(tdata, std::chrono::steady_clock::now() + std::chrono::seconds(tdata->read_timeout));
+                return;
+            }
+        }
 
-        if (close(tdata->commpipe_read) == -1) {
-            syslog(LOG_ERR, "Commpipe_write close error at [%s: %d]: %m", __file__, __LINE__);
+        ThreadStatus tstatus = CLOSE;
+        try {
+            do {
+#ifdef SHTTPS_ENABLE_SSL
+                bool secure = tdata->cSSL != nullptr;
+#else
+                bool secure = false;
+#endif
+                tstatus = tdata->serv->processRequest(tdata->ins.get(), tdata->os.get(), tdata->peer_ip,
+                                                      tdata->peer_port, secure, tdata->keep_alive,
+                                                      secure ? -1 : tdata->sock);
+            } while ((tstatus == CONTINUE) && has_buffered_input(tdata));
+        } catch (Error &err) {
+            syslog(LOG_ERR, "Error processing request: %s", err.to_string().c_str());
+            tstatus = CLOSE;
         }
 
-        int compipe_write = tdata->serv->get_thread_pipe(pthread_self());
-        if (compipe_write > 0) {
-            if (close(compipe_write) == -1) {
-                syslog(LOG_ERR, "Commpipe_write close error at [%s: %d]: %m", __file__, __LINE__);
-            }
+        if ((tstatus == CONTINUE) && (tdata->keep_alive > 0)) {
+            active_remove(tdata);
+            idle_add(tdata, std::chrono::steady_clock::now() + std::chrono::seconds(tdata->keep_alive));
         } else {
-            syslog(LOG_DEBUG, "Thread to stop does not exist");
+            active_remove(tdata);
+            close_socket(tdata);
+            delete tdata;
         }
+    }
+    //=========================================================================
 
-        tdata->serv->remove_thread(pthread_self());
-        tdata->serv->semaphore_leave();
-        delete tdata;
+    /*!
+     * Runs a worker thread of the pool. The worker takes the connections from the queue
+     * of waiting connections and serves them, until the server is stopped.
+     *
+     * @param arg unused
+     * @return NULL.
+     */
+    static void *worker_thread(void *arg) {
+        while (true) {
+            TData *tdata;
+            {
+                std::unique_lock<std::mutex> queue_mutex_guard(queuelock);
+                queuecond.wait(queue_mutex_guard, [] { return workers_stop || !waiting_conns.empty(); });
+                if (workers_stop) break;
+                tdata = waiting_conns.front();
+                waiting_conns.pop_front();
+
+                //
+                // the connection is registered while queuelock is held, so that the shutdown, which
+                // sets workers_stop under the same lock, is sure to find it
+                //
+                std::lock_guard<std::mutex> active_mutex_guard(activelock);
+                active_conns.insert(tdata);
+            }
+            serve_connection(tdata);
+        }
         return nullptr;
     }
     //=========================================================================
@@ -860,6 +1028,7 @@ namespace shttps {
         sigaddset(&set, SIGINT);
         sigaddset(&set, SIGTERM);
         sigaddset(&set, SIGPIPE);
+        sigaddset(&set, SIGHUP);
 
         int pthread_sigmask_result = pthread_sigmask(SIG_BLOCK, &set, nullptr);
 
@@ -890,6 +1059,15 @@ namespace shttps {
         syslog(LOG_INFO, "Server listening on port %d", port);
         setlogmask(old_ll);
 
+#ifdef SHTTPS_ENABLE_SSL
+        if (_ssl_port > 0) {
+            if (!reloadSSLContext()) {
+                syslog(LOG_ERR, "Could not create SSL context, not listening on SSL port %d", _ssl_port);
+                _ssl_port = -1;
+            }
+        }
+#endif
+
         if (_ssl_port > 0) {
             _ssl_sockfd = prepare_socket(_ssl_port);
             old_ll = setlogmask(LOG_MASK(LOG_INFO));
@@ -898,46 +1076,155 @@ namespace shttps {
         }
 
         pipe(stoppipe); // ToDo: Errorcheck
-        pthread_t thread_id;
-        running = true;
-        int count = 0;
 
-        while (running) {
-            int sock;
-            pollfd readfds[3];
-            int n_readfds = 0;
-            readfds[0] = {_sockfd, POLLIN, 0};
-            n_readfds++;
-            readfds[1] = {stoppipe[0], POLLIN, 0};
-            n_readfds++;
+        if (pipe(idlepipe) != 0) {
+            syslog(LOG_ERR, "Could not create idle pipe at [%s: %d]: %m", __file__, __LINE__);
+            exit(1);
+        }
+
+#ifdef __linux__
+        if ((epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            syslog(LOG_ERR, "Could not create epoll instance at [%s: %d]: %m", __file__, __LINE__);
+            exit(1);
+        }
+        std::vector<struct epoll_event> epoll_events(max_epoll_events);
+#endif
+
+        //
+        // start the pool of worker threads which process the requests
+        //
+        workers_stop = false;
+        idle_closed = false;
+        std::vector<pthread_t> worker_ids;
+
+        for (unsigned i = 0; i < _nthreads; i++) {
+            pthread_t thread_id;
+            if (pthread_create(&thread_id, nullptr, worker_thread, nullptr) != 0) {
+                syslog(LOG_ERR, "Could not create thread at [%s: %d]: %m", __file__, __LINE__);
+                break;
+            }
+            worker_ids.push_back(thread_id);
+        }
 
+        running = (worker_ids.size() > 0);
+        std::vector<pollfd> readfds;
+        std::vector<TData *> polled_conns;
+
+        while (running) {
+            //
+            // we watch the listening sockets, the stop pipe, the idle pipe and the idle keep-alive
+            // connections. On Linux the idle connections are watched by the epoll instance, which
+            // is itself part of the poll set, otherwise every idle socket is added to the poll set.
+            //
+            readfds.clear();
+            readfds.push_back({_sockfd, POLLIN, 0});
+            readfds.push_back({stoppipe[0], POLLIN, 0});
+            readfds.push_back({idlepipe[0], POLLIN, 0});
             if (_ssl_port > 0) {
-                readfds[2] = {_ssl_sockfd, POLLIN, 0};
-                n_readfds++;
+                readfds.push_back({_ssl_sockfd, POLLIN, 0});
+            }
+#ifdef __linux__
+            readfds.push_back({epollfd, POLLIN, 0});
+#endif
+            size_t n_fixed = readfds.size();
+
+            //
+            // idle connections whose keep-alive timeout has expired are closed. The list is ordered
+            // by the timeout, so the first remaining connection determines how long we may wait.
+            //
+            int timeout = -1;
+            std::vector<TData *> expired;
+            {
+                std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
+                auto now = std::chrono::steady_clock::now();
+
+                while (!idle_conns.empty() && (idle_conns.front()->idle_until <= now)) {
+                    expired.push_back(idle_conns.front());
+                    idle_conns.pop_front();
+                }
+
+                if (!idle_conns.empty()) {
+                    timeout = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+                            idle_conns.front()->idle_until - now).count() + 1;
+                }
+
+#ifndef __linux__
+                polled_conns.assign(idle_conns.begin(), idle_conns.end());
+                for (auto tdata : polled_conns) {
+                    readfds.push_back({tdata->sock, (short) (tdata->want_write ? POLLOUT : POLLIN), 0});
+                }
+#endif
             }
 
-            if (poll(readfds, n_readfds, -1) < 0) {
+            //
+            // the expired connections are closed without holding idlelock, which the workers need to park connections
+            //
+            for (auto tdata : expired) {
+                close_socket(tdata); // closing the socket removes it from the epoll instance
+                delete tdata;
+            }
+
+            if (poll(readfds.data(), readfds.size(), timeout) < 0) {
+                if (errno == EINTR) continue;
                 syslog(LOG_ERR, "Blocking poll failed at [%s: %d]: %m", __file__, __LINE__);
                 running = false;
                 break;
             }
 
-            count++;
-
-            if (readfds[0].revents & POLLIN) {
-                sock = _sockfd;
-            } else if (readfds[1].revents & POLLIN) {
-                sock = stoppipe[0];
+            if (readfds[1].revents & POLLIN) {
                 char buf[2];
                 read(stoppipe[0], buf, 1);
                 running = false;
                 break;
-            } else if ((_ssl_port > 0) && (readfds[2].revents & POLLIN)) {
+            }
+
+            if (readfds[2].revents & POLLIN) {
+                char buf[64];
+                read(idlepipe[0], buf, sizeof(buf)); // the timeout is recalculated in the next round
+            }
+
+            //
+            // idle connections with a new request are handed over to the workers. Only the
+            // main loop removes connections from the list of idle connections, thus the
+            // connections we got from poll are still in the list.
+            //
+#ifdef __linux__
+            if (readfds[n_fixed - 1].revents & POLLIN) {
+                std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
+                int n_ready = epoll_wait(epollfd, epoll_events.data(), max_epoll_events, 0);
+
+                for (int i = 0; i < n_ready; i++) {
+                    TData *tdata = static_cast<TData *>(epoll_events[i].data.ptr);
+                    idle_conns.erase(tdata->idle_pos);
+                    enqueue_conn(tdata);
+                }
+            }
+#else
+            {
+                std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
+
+                for (size_t i = n_fixed; i < readfds.size(); i++) {
+                    if (readfds[i].revents != 0) {
+                        TData *tdata = polled_conns[i - n_fixed];
+                        idle_conns.erase(tdata->idle_pos);
+                        enqueue_conn(tdata);
+                    }
+                }
+            }
+#endif
+
+            int sock;
+
+            if (readfds[0].revents & POLLIN) {
+                sock = _sockfd;
+            } else if ((_ssl_port > 0) && (readfds[3].revents & POLLIN)) {
                 sock = _ssl_sockfd;
-            } else {
-                syslog(LOG_ERR, "Blocking poll failed at [%s: %d]: unknown error", __file__, __LINE__);
+            } else if ((readfds[0].revents | ((_ssl_port > 0) ? readfds[3].revents : 0)) & (POLLERR | POLLNVAL)) {
+                syslog(LOG_ERR, "Blocking poll failed at [%s: %d]: error on listening socket", __file__, __LINE__);
                 running = false;
                 break; // accept returned something strange – probably we want to shutdown the server
+            } else {
+                continue; // no new connection
             }
 
             struct sockaddr_storage cli_addr;
@@ -971,161 +1258,153 @@ namespace shttps {
             syslog(LOG_INFO, "Accepted connection from %s", client_ip);
             setlogmask(old_ll);
 
-            // Construct a TData for the thread that will handle the request. The TData will
-            // be deleted by process_request() when it completes.
+            //
+            // a client which stops sending in the middle of a request must not block a worker forever,
+            // thus reads time out after the keep alive timeout
+            //
+            int read_timeout = (_keep_alive_timeout > 0) ? _keep_alive_timeout : 20;
+            struct timeval tv = {read_timeout, 0};
+
+            if (::setsockopt(newsockfs, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+                syslog(LOG_WARNING, "Could not set read timeout at [%s: %d]: %m", __file__, __LINE__);
+            }
+
+            // Construct a TData for the connection. The TData will be deleted
+            // when the connection is closed.
             TData *thread_data = new TData();
             thread_data->sock = newsockfs;
             thread_data->peer_ip = client_ip;
             thread_data->peer_port = peer_port;
+            thread_data->keep_alive = 1;
+            thread_data->read_timeout = read_timeout;
+            thread_data->want_write = false;
+#ifdef __linux__
+            thread_data->in_epoll = false;
+#endif
             thread_data->serv = this;
 
+            auto first_request_until = std::chrono::steady_clock::now() + std::chrono::seconds(read_timeout);
+
 #ifdef SHTTPS_ENABLE_SSL
-            SSL *cSSL = nullptr;
+            //
+            // the handshake is done by the workers on the non-blocking socket, step by step as the
+            // data from the client arrives
+            //
+            thread_data->cSSL = nullptr;
+            thread_data->handshake_until = first_request_until;
 
             if (sock == _ssl_sockfd) {
-                SSL_CTX *sslctx;
-                try {
-                    if ((sslctx = SSL_CTX_new(SSLv23_server_method())) == nullptr) {
-                        syslog(LOG_ERR, "OpenSSL error: SSL_CTX_new() failed");
-                        throw SSLError(__file__, __LINE__, "OpenSSL error: SSL_CTX_new() failed");
-                    }
-                    SSL_CTX_set_options(sslctx, SSL_OP_SINGLE_DH_USE);
-                    if (SSL_CTX_use_certificate_file(sslctx, _ssl_certificate.c_str(), SSL_FILETYPE_PEM) != 1) {
-                        std::string msg =
-                                "OpenSSL error: SSL_CTX_use_certificate_file(" + _ssl_certificate + ") failed";
-                        syslog(LOG_ERR, "%s", msg.c_str());
-                        throw SSLError(__file__, __LINE__, msg);
-                    }
-                    if (SSL_CTX_use_PrivateKey_file(sslctx, _ssl_key.c_str(), SSL_FILETYPE_PEM) != 1) {
-                        std::string msg = "OpenSSL error: SSL_CTX_use_PrivateKey_file(" + _ssl_certificate + ") failed";
-                        syslog(LOG_ERR, "%s", msg.c_str());
-                        throw SSLError(__file__, __LINE__, msg);
-                    }
-                    if (!SSL_CTX_check_private_key(sslctx)) {
-                        std::string msg = "OpenSSL error: SSL_CTX_check_private_key() failed";
-                        syslog(LOG_ERR, "%s", msg.c_str());
-                        throw SSLError(__file__, __LINE__, msg);
-                    }
-                    if ((cSSL = SSL_new(sslctx)) == nullptr) {
-                        std::string msg = "OpenSSL error: SSL_new() failed";
-                        syslog(LOG_ERR, "%s", msg.c_str());
-                        throw SSLError(__file__, __LINE__, msg);
-                    }
-                    if (SSL_set_fd(cSSL, newsockfs) != 1) {
-                        std::string msg = "OpenSSL error: SSL_set_fd() failed";
-                        syslog(LOG_ERR, "%s", msg.c_str());
-                        throw SSLError(__file__, __LINE__, msg);
-                    }
-
-                    //Here is the SSL Accept portion.  Now all reads and writes must use SS
-                    if ((SSL_accept(cSSL)) <= 0) {
-                        std::string msg = "OpenSSL error: SSL_accept() failed";
-                        syslog(LOG_ERR, "%s", msg.c_str());
-                        throw SSLError(__file__, __LINE__, msg);
-                    }
-                } catch (SSLError &err) {
-                    syslog(LOG_ERR, "%s", err.to_string().c_str());
-                    int sstat;
+                SSL *cSSL;
+                {
+                    std::lock_guard<std::mutex> sslctx_guard(_sslctx_lock);
+                    cSSL = SSL_new(_sslctx);
+                }
 
-                    while ((sstat = SSL_shutdown(cSSL)) == 0);
+                if ((cSSL == nullptr) || (SSL_set_fd(cSSL, newsockfs) != 1)) {
+                    syslog(LOG_ERR, "OpenSSL error: creating SSL connection failed at [%s: %d]", __file__, __LINE__);
+                    if (cSSL != nullptr) SSL_free(cSSL);
+                    close_socket(thread_data);
+                    delete thread_data;
+                    continue;
+                }
 
-                    if (sstat < 0) {
-                        syslog(LOG_WARNING, "SSL socket error: shutdown (2) of socket failed: %d",
-                               SSL_get_error(cSSL, sstat));
-                    }
+                thread_data->cSSL = cSSL;
 
-                    SSL_free(cSSL);
-                    cSSL = nullptr;
+                if (!set_nonblocking(newsockfs, true)) {
+                    syslog(LOG_ERR, "Could not make socket non-blocking at [%s: %d]: %m", __file__, __LINE__);
+                    close_socket(thread_data);
+                    delete thread_data;
+                    continue;
                 }
             }
-
-            thread_data->cSSL = cSSL;
 #endif
 
-            if (semaphore_get() <= 0) {
-                //
-                // we would be blocked by the semaphore... Get an idle thread...
-                //
-                {
-                    std::unique_lock<std::mutex> idle_mutex_guard(idlelock);
-
-                    if (idle_thread_ids.size() > 0) {
-                        pthread_t tid = idle_thread_ids.front();
-                        idle_mutex_guard.unlock();
-
-                        int pipe_id = get_thread_pipe(tid);
+            //
+            // the connection is handed over to a worker as soon as the client has sent something
+            //
+            idle_add(thread_data, first_request_until);
+        }
 
-                        if (pipe_id > 0) {
-                            Server::CommMsg::send(pipe_id);
-                        } else {
-                            syslog(LOG_DEBUG, "The thread to stop no longer exists");
-                        }
-                    }
-                }
-            }
+        old_ll = setlogmask(LOG_MASK(LOG_INFO));
+        syslog(LOG_INFO, "Server shutting down");
+        setlogmask(old_ll);
 
-            semaphore_wait();
-            int commpipe[2];
+        //
+        // stop the workers. Connections which would become idle are closed from now on. The sockets
+        // of the connections served at the moment are shut down, so that workers waiting for a slow
+        // or silent client return at once instead of blocking the join below.
+        //
+        {
+            std::lock_guard<std::mutex> queue_mutex_guard(queuelock);
+            workers_stop = true;
+        }
+        queuecond.notify_all();
 
-            if (socketpair(PF_LOCAL, SOCK_STREAM, 0, commpipe) != 0) {
-                syslog(LOG_WARNING, "Creating pipe failed at [%s: %d]: %m", __file__, __LINE__);
-                running = false;
-                break;
-            }
+        std::list<TData *> idle_left;
+        {
+            std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
+            idle_closed = true;
+            idle_left.swap(idle_conns);
+        }
 
-            thread_data->commpipe_read = commpipe[1]; // read end;
+        for (auto tdata : idle_left) {
+            close_socket(tdata);
+            delete tdata;
+        }
 
-            pthread_attr_t tattr;
-            pthread_attr_init(&tattr);
+        {
+            std::lock_guard<std::mutex> active_mutex_guard(activelock);
 
-            if (pthread_create(&thread_id, &tattr, process_request, (void *) thread_data) < 0) {
-                syslog(LOG_ERR, "Could not create thread at [%s: %d]: %m", __file__, __LINE__);
-                running = false;
-                break;
+            for (auto tdata : active_conns) {
+                if (shutdown(tdata->sock, SHUT_RDWR) < 0) {
+                    syslog(LOG_DEBUG, "Debug: shutting down socket at [%s: %d]: %m failed", __file__, __LINE__);
+                }
             }
+        }
 
-#ifdef SHTTPS_ENABLE_SSL
-            if (thread_data->cSSL != nullptr) {
-                add_thread(thread_id, commpipe[0], thread_data->sock, thread_data->cSSL);
-            } else {
-                add_thread(thread_id, commpipe[0], thread_data->sock);
+        for (auto const &worker_id : worker_ids) {
+            int err = pthread_join(worker_id, nullptr);
+
+            if (err != 0) {
+                syslog(LOG_ERR, "pthread_join failed with error code %d", err);
             }
-#else
-            add_thread(thread_id, commpipe[0], thread_data->sock);
-#endif
         }
 
-        old_ll = setlogmask(LOG_MASK(LOG_INFO));
-        syslog(LOG_INFO, "Server shutting down");
-        setlogmask(old_ll);
-        std::vector<pthread_t> threads_to_join;
-        threads_to_join.push_back(sighandler_thread);
+        int err = pthread_join(sighandler_thread, nullptr);
 
-        {
-            std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
+        if (err != 0) {
+            syslog(LOG_ERR, "pthread_join failed with error code %d", err);
+        }
 
-            // Send the close message to all running threads.
-            for (auto const &tid : thread_ids) {
-                threads_to_join.push_back(tid.first);
-                Server::CommMsg::send(tid.second.commpipe_write);
-            }
+        //
+        // now we close the connections which have not been taken by a worker
+        //
+        for (auto tdata : waiting_conns) {
+            close_socket(tdata);
+            delete tdata;
         }
+        waiting_conns.clear();
 
         close(stoppipe[0]);
         close(stoppipe[1]);
+        close(idlepipe[0]);
+        close(idlepipe[1]);
 
-        // We have closed all sockets, now wait for the threads to terminate.
-
-        for (auto const &thread_to_join : threads_to_join) {
-            int err = pthread_join(thread_to_join, nullptr);
-
-            if (err != 0) {
-                syslog(LOG_ERR, "pthread_join failed with error code %d", err);
-            }
+        for (auto luaserver : _lua_pool) {
+            delete luaserver;
         }
+        _lua_pool.clear();
 
-        // Close the semaphore.
-        ::sem_close(_semaphore);
+#ifdef SHTTPS_ENABLE_SSL
+        if (_sslctx != nullptr) {
+            SSL_CTX_free(_sslctx);
+            _sslctx = nullptr;
+        }
+#endif
+#ifdef __linux__
+        close(epollfd);
+        epollfd = -1;
+#endif
 
         // std::cerr << "signal_result is " << signal_result << std::endl;
     }
@@ -1140,9 +1419,54 @@ namespace shttps {
     //=========================================================================
 
 
+    LuaServer *Server::acquireLuaServer(Connection &conn) {
+        LuaServer *luaserver = nullptr;
+        {
+            std::lock_guard<std::mutex> pool_guard(_lua_pool_lock);
+            if (!_lua_pool.empty()) {
+                luaserver = _lua_pool.back();
+                _lua_pool.pop_back();
+            }
+        }
+
+        if (luaserver != nullptr) {
+            luaserver->createGlobals(conn);
+            return luaserver;
+        }
+
+        // pattern to be added to the Lua package.path
+        // includes Lua files in the Lua script directory
+        std::string lua_scriptdir = _scriptdir + "/?.lua";
+
+        luaserver = new LuaServer(conn, _initscript, true, lua_scriptdir);
+
+        try {
+            for (auto &global_func : lua_globals) {
+                global_func.func(luaserver->lua(), conn, global_func.func_dataptr);
+            }
+        } catch (...) {
+            delete luaserver;
+            throw;
+        }
+
+        luaserver->snapshotGlobals();
+        return luaserver;
+    }
+    //=========================================================================
+
+
+    void Server::releaseLuaServer(LuaServer *luaserver) {
+        luaserver->resetGlobals();
+
+        std::lock_guard<std::mutex> pool_guard(_lua_pool_lock);
+        _lua_pool.push_back(luaserver);
+    }
+    //=========================================================================
+
+
     ThreadStatus
     Server::processRequest(std::istream *ins, std::ostream *os, std::string &peer_ip, int peer_port, bool secure,
-                           int &keep_alive) {
+                           int &keep_alive, int sock) {
         if (_tmpdir.empty()) {
             syslog(LOG_WARNING, "_tmpdir is empty");
             throw Error(__file__, __LINE__, "_tmpdir is empty");
@@ -1161,6 +1485,7 @@ namespace shttps {
             conn.peer_ip(peer_ip);
             conn.peer_port(peer_port);
             conn.secure(secure);
+            conn.sock(sock);
 
             if (conn.resetConnection()) {
                 if (conn.keepAlive()) {
@@ -1171,29 +1496,23 @@ namespace shttps {
             }
 
             //
-            // Setting up the Lua server
+            // Getting an initialized Lua server. If the request fails, the Lua server
+            // is not put back into the pool but destroyed with the unique_ptr
             //
-
-            // pattern to be added to the Lua package.path
-            // includes Lua files in the Lua script directory
-            std::string lua_scriptdir = _scriptdir + "/?.lua";
-
-            LuaServer luaserver(conn, _initscript, true, lua_scriptdir);
-
-            for (auto &global_func : lua_globals) {
-                global_func.func(luaserver.lua(), conn, global_func.func_dataptr);
-            }
+            std::unique_ptr<LuaServer> luaserver(acquireLuaServer(conn));
 
             void *hd = nullptr;
 
             try {
                 RequestHandler handler = getHandler(conn, &hd);
-                handler(conn, luaserver, _user_data, hd);
+                handler(conn, *luaserver, _user_data, hd);
             } catch (InputFailure iofail) {
                 syslog(LOG_ERR, "Possibly socket closed by peer");
                 return CLOSE; // or CLOSE ??
             }
 
+            releaseLuaServer(luaserver.release());
+
             if (!conn.cleanupUploads()) {
                 syslog(LOG_ERR, "Cleanup of uploaded files failed");
             }
@@ -1225,97 +1544,6 @@ namespace shttps {
     }
     //=========================================================================
 
-    void Server::add_thread(pthread_t thread_id_p, int commpipe_write_p, int sock_id) {
-        std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
-#ifdef SHTTPS_ENABLE_SSL
-        GenericSockId sid = {sock_id, nullptr, commpipe_write_p};
-#else
-        GenericSockId sid = {sock_id, commpipe_write_p};
-#endif
-        thread_ids[thread_id_p] = sid;
-    }
-    //=========================================================================
-
-#ifdef SHTTPS_ENABLE_SSL
-
-    void Server::add_thread(pthread_t thread_id_p, int commpipe_write_p, int sock_id, SSL *cSSL) {
-        std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
-
-        GenericSockId sid = {sock_id, cSSL, commpipe_write_p};
-        thread_ids[thread_id_p] = sid;
-    }
-
-#endif
-    //=========================================================================
-
-    int Server::get_thread_sock(pthread_t thread_id_p) {
-        std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
-
-        try {
-            return thread_ids.at(thread_id_p).sid;
-        } catch (const std::out_of_range &oor) {
-            return -1;
-        }
-    }
-    //=========================================================================
-
-    int Server::get_thread_pipe(pthread_t thread_id_p) {
-        std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
-
-        try {
-            return thread_ids.at(thread_id_p).commpipe_write;
-        } catch (const std::out_of_range &oor) {
-            return -1;
-        }
-    }
-    //=========================================================================
-
-
-#ifdef SHTTPS_ENABLE_SSL
-
-    SSL *Server::get_thread_ssl(pthread_t thread_id_p) {
-        std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
-
-        try {
-            return thread_ids.at(thread_id_p).ssl_sid;
-        } catch (const std::out_of_range &oor) {
-            return nullptr;
-        }
-    }
-    //=========================================================================
-#endif
-
-
-    void Server::remove_thread(pthread_t thread_id_p) {
-        int index = 0;
-        bool in_idle = false;
-
-        {
-            std::lock_guard<std::mutex> idle_mutex_guard(idlelock);
-
-            for (auto tid : idle_thread_ids) {
-                if (tid == thread_id_p) {
-                    in_idle = true;
-                    break;
-                }
-                index++;
-            }
-
-            if (in_idle) {
-                //
-                // the thread is in idle state, remove it from the idle vector
-                //
-                idle_thread_ids.erase(idle_thread_ids.begin() + index);
-            }
-        }
-
-        {
-            std::lock_guard<std::mutex> thread_mutex_guard(threadlock);
-            thread_ids.erase(thread_id_p);
-        }
-    }
-    //=========================================================================
-
     void Server::debugmsg(const std::string &msg) {
         std::lock_guard<std::mutex> debug_mutex_guard(debugio);
 
@@ -36,7 +36,6 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <pthread.h> //for threading , link with lpthread
-#include <semaphore.h>
 #include <syslog.h>
 
 #include <atomic>
@@ -130,17 +129,6 @@ namespace shttps {
             void *func_dataptr;
         } GlobalFunc;
 
-        /*!
-         * Struct to hold the information about threads and open sockets, used for proper shutdown
-         */
-        typedef struct {
-            int sid;    //!< socket id
-#           ifdef SHTTPS_ENABLE_SSL
-            SSL *ssl_sid; //!< Pointer to SLL socket struct
-#           endif
-            int commpipe_write; //!< socket id of pipe connecting main thread
-        } GenericSockId;
-
 #       ifdef SHTTPS_ENABLE_SSL
 
         /*!
@@ -176,31 +164,6 @@ namespace shttps {
 
 #       endif
 
-    public:
-        /*!
-        * Used to send a message between main thread and worker threads. A pipe is
-        * used and the worker theads use poll to detect an incoming message.
-        */
-        class CommMsg {
-        public:
-
-            static inline int send(int pipe_id) {
-                if ((::send(pipe_id, "X", 1, 0)) != 1) {
-                    return -1;
-                }
-                return 0;
-            };
-
-            static inline int read(int pipe_id) {
-                char c;
-                if (::read(pipe_id, &c, 1) != 1) {
-                    return -1;
-                }
-                return 0;
-            };
-        };
-        //=========================================================================
-
     private:
         int port; //!< listening Port for server
         int _ssl_port; //!< listening port for openssl
@@ -212,17 +175,15 @@ namespace shttps {
         std::string _ssl_certificate; //!< Path to SSL certificate
         std::string _ssl_key; //!< Path to SSL certificate
         std::string _jwt_secret;
+        SSL_CTX *_sslctx; //!< SSL context shared by all secure connections
+        std::mutex _sslctx_lock; //!< protects _sslctx while it is replaced by reloadSSLContext()
 
 #       endif
 
         int stoppipe[2];
         std::string _tmpdir; //!< path to directory, where uplaods are being stored
         std::string _scriptdir; //!< Path to directory, where scripts for the "Lua"-routes are found
-        unsigned _nthreads; //!< maximum number of parallel threads for processing requests
-        std::string semname; //!< name of the semaphore for restricting the number of threads
-        sem_t *_semaphore; //!< semaphore
-        std::atomic<int> _semcnt; //!< current value of semaphore (sem_getvalue() is not available on all systems)
-        std::map<pthread_t, GenericSockId> thread_ids; //!< Map of active worker threads
+        unsigned _nthreads; //!< number of worker threads in the pool processing the requests
         int _keep_alive_timeout;
         bool running; //!< Main runloop should keep on going
         std::map<std::string, RequestHandler> handler[9]; // request handlers for the different 9 request methods
@@ -232,45 +193,43 @@ namespace shttps {
         std::vector<shttps::LuaRoute> _lua_routes; //!< This vector holds the routes that are served by lua scripts
         std::vector<GlobalFunc> lua_globals;
         size_t _max_post_size;
+        std::vector<LuaServer *> _lua_pool; //!< initialized Lua interpreters which are not serving a request
+        std::mutex _lua_pool_lock; //!< protects _lua_pool
 
         RequestHandler getHandler(Connection &conn, void **handler_data_p);
 
+        /*!
+         * Gets an initialized Lua interpreter for a request. An interpreter of the pool
+         * is reused if there is one, otherwise a new one is created: it runs the init script
+         * and the functions added with add_lua_globals_func(). In both cases the server table
+         * is set up for the given connection.
+         *
+         * \param[in] conn Connection of the request
+         * \returns Lua interpreter, which is given back with releaseLuaServer()
+         */
+        LuaServer *acquireLuaServer(Connection &conn);
+
+        /*!
+         * Resets a Lua interpreter after a request and puts it back into the pool
+         *
+         * \param[in] luaserver Lua interpreter obtained by acquireLuaServer()
+         */
+        void releaseLuaServer(LuaServer *luaserver);
+
         std::string _logfilename;
         std::string _loglevel;
 
     public:
         /*!
-        * Create a server listening on the given port with the maximal number of threads
+        * Create a server listening on the given port with a pool of worker threads
         *
         * \param[in] port_p Listening port of HTTP server
-        * \param[in] nthreads_p Maximal number of parallel threads serving the requests
+        * \param[in] nthreads_p Number of worker threads serving the requests. Idle keep-alive
+        * connections do not occupy a worker.
         */
         Server(int port_p, unsigned nthreads_p = 4, const std::string userid_str = "",
                const std::string &logfile_p = "shttps.log", const std::string &loglevel_p = "DEBUG");
 
-        /*!
-        * Decrease the semaphore, wait if semaphore would be smaller than zero
-        */
-        inline void semaphore_wait() {
-            _semcnt--;
-            ::sem_wait(_semaphore);
-        }
-
-        /*!
-        * Increase the semaphore
-        */
-        inline void semaphore_leave() {
-            _semcnt++;
-            ::sem_post(_semaphore);
-        }
-
-        /*!
-        * Get the semaphore value
-        */
-        inline int semaphore_get() {
-            return _semcnt;
-        }
-
 #       ifdef SHTTPS_ENABLE_SSL
 
         /*!
@@ -330,12 +289,25 @@ namespace shttps {
          */
         inline std::string jwt_secret(void) { return _jwt_secret; }
 
+        /*!
+         * (Re-)creates the SSL context used for all secure connections from the certificate and
+         * key files. The context enables the server side session cache and TLS session tickets,
+         * and the ticket keys of the old context are taken over so that clients can still resume
+         * their sessions. Connections established before keep using the old context, which is
+         * freed when the last of them is closed. The server calls this method at startup and
+         * whenever it receives SIGHUP, so that certificates can be rotated without a restart.
+         *
+         * \returns true on success. If the certificate or the key cannot be loaded, the error is
+         * logged, the old context is kept and false is returned.
+         */
+        bool reloadSSLContext(void);
+
 #       endif
 
         /*!
-         * Returns the maximum number of parallel threads allowed
+         * Returns the number of worker threads
          *
-         * \returns Number of parallel threads allowed
+         * \returns Number of worker threads
          */
         inline unsigned nthreads(void) { return _nthreads; }
 
@@ -434,33 +406,6 @@ namespace shttps {
          */
         inline int keep_alive_timeout(void) { return _keep_alive_timeout; }
 
-        /*!
-         * Return the internal semaphore structure
-         *
-         * \returns The semaphore controlling the maximal number of threads
-         */
-        inline sem_t *semaphore(void) { return _semaphore; }
-
-        void add_thread(pthread_t thread_id_p, int commpipe_write_p, int sock_id);
-
-#       ifdef SHTTPS_ENABLE_SSL
-
-        void add_thread(pthread_t thread_id_p, int commpipe_write_p, int sock_id, SSL *cSSL);
-
-#       endif
-
-        int get_thread_sock(pthread_t thread_id_p);
-
-        int get_thread_pipe(pthread_t thread_id_p);
-
-#       ifdef SHTTPS_ENABLE_SSL
-
-        SSL *get_thread_ssl(pthread_t thread_id_p);
-
-#       endif
-
-        void remove_thread(pthread_t thread_id_p);
-
         /*!
          * Sets the path to the initialization script (lua script) which is executed for each request
          *
@@ -480,8 +425,11 @@ namespace shttps {
         }
 
         /*!
-         * adds a function which is called before processing each request to initialize
-         * special Lua variables and add special Lua functions
+         * adds a function which is called to initialize special Lua variables and add special
+         * Lua functions. Since the Lua interpreters are reused for many requests, the function is
+         * called only once for each interpreter, after the init script. It must therefore not store
+         * anything that depends on the connection it gets; the functions called from Lua find the
+         * current connection in the global variable named by shttps::luaconnection.
          *
          * \param[in] func C++ function which extends the Lua
          */
@@ -511,13 +459,13 @@ namespace shttps {
         /*!
          * Process a request... (Eventually should be private method)
          *
-         * \param[in] sock Socket id
          * \param[in] peer_ip String containing IP (IP4 or IP6) of client/peer
          * \param[in] peer_port Port number of peer/client
+         * \param[in] sock Plain socket used to send files with sendfile(), or -1 (e.g. for SSL connections)
          */
         ThreadStatus
         processRequest(std::istream *ins, std::ostream *os, std::string &peer_ip, int peer_port, bool secure,
-                       int &keep_alive);
+                       int &keep_alive, int sock = -1);
 
         /*!
         * Return the user data that has been added previously
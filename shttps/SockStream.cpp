@@ -119,29 +119,9 @@ streambuf::int_type SockStream::overflow(streambuf::int_type ch) {
     }
 
     if (pptr() >= epptr()) {
-        size_t n = out_bufsize;
-        size_t nn = 0;
-        while (n > 0) {
-            ssize_t tmp_n;
-#ifdef SHTTPS_ENABLE_SSL
-            if (cSSL == nullptr) {
-                tmp_n = send(sock, out_buf + nn, n - nn, MSG_NOSIGNAL);
-            } else {
-                if (SSL_get_shutdown(cSSL) == 0) {
-                    tmp_n = SSL_write(cSSL, out_buf + nn, n - nn);
-                } else {
-                    tmp_n = 0;
-                }
-            }
-#else
-            tmp_n = send(sock, out_buf + nn, n - nn, MSG_NOSIGNAL);
-#endif
-            if (tmp_n <= 0) {
-                return traits_type::eof();
-                // we have a problem.... Possibly a broken pipe
-            }
-            n -= tmp_n;
-            nn += tmp_n;
+        size_t nn = send_all(out_buf, out_bufsize);
+        if (nn < (size_t) out_bufsize) {
+            return traits_type::eof();
         }
 
         pbump(-nn);
@@ -157,32 +137,60 @@ streambuf::int_type SockStream::overflow(streambuf::int_type ch) {
 
 int SockStream::sync(void) {
     std::ptrdiff_t n = pptr() - out_buf;
+
+    if (n > 0) {
+        if (send_all(out_buf, n) < (size_t) n) {
+            return -1;
+        }
+        pbump(-n);
+    }
+
+    return 0;
+}
+
+streamsize SockStream::xsputn(const char *s, streamsize n) {
+    if (n < epptr() - pptr()) {
+        memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
+    }
+
+    if (sync() != 0) {
+        return 0;
+    }
+
+    if (n < out_bufsize) {
+        memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
+    }
+
+    return send_all(s, n);
+}
+
+size_t SockStream::send_all(const char *buf, size_t n) {
     size_t nn = 0;
 
-    while (n > 0) {
+    while (nn < n) {
         ssize_t tmp_n;
 #ifdef SHTTPS_ENABLE_SSL
         if (cSSL == nullptr) {
-            tmp_n = send(sock, out_buf + nn, n - nn, MSG_NOSIGNAL);
+            tmp_n = send(sock, buf + nn, n - nn, MSG_NOSIGNAL);
         } else {
             if (SSL_get_shutdown(cSSL) == 0) {
-                tmp_n = SSL_write(cSSL, out_buf + nn, n - nn);
+                tmp_n = SSL_write(cSSL, buf + nn, n - nn);
             } else {
                 tmp_n = 0;
             }
         }
 #else
-        tmp_n = send(sock, out_buf + nn, n - nn, MSG_NOSIGNAL);
+        tmp_n = send(sock, buf + nn, n - nn, MSG_NOSIGNAL);
 #endif
         if (tmp_n <= 0) {
-            return -1;
+            break;
         }
-
-        n -= tmp_n;
         nn += tmp_n;
     }
 
-    pbump(-nn);
-
-    return 0;
+    return nn;
 }
@@ -100,6 +100,28 @@ namespace shttps {
          */
         virtual int sync(void);
 
+        /*!
+         * Writes a block of data. Blocks which are at least as large as the output buffer are sent
+         * directly from the caller's memory after flushing the buffer, instead of being copied
+         * through the buffer piece by piece.
+         *
+         * \param[in] s Data to be written
+         * \param[in] n Number of bytes
+         *
+         * \returns Number of bytes written
+         */
+        virtual std::streamsize xsputn(const char *s, std::streamsize n);
+
+        /*!
+         * Sends data to the socket (or SSL connection) until all is sent or an error occurs
+         *
+         * \param[in] buf Data to be sent
+         * \param[in] n Number of bytes
+         *
+         * \returns Number of bytes sent
+         */
+        size_t send_all(const char *buf, size_t n);
+
     protected:
     public:
         inline SockStream() {
@@ -28,9 +28,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
 #include <vector>
 #include <cmath>
 #include <memory>
+#include <chrono>
+#include <functional>
 
 
 #ifdef HAVE_MALLOC_H
@@ -47,8 +50,14 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <syslog.h>
 
+#if defined(__linux__)
+#include <stddef.h>
+#include <sys/syscall.h>
+#endif
+
 
 #include "SipiCache.h"
 #include "shttps/Global.h"
@@ -76,10 +85,165 @@ namespace Sipi {
         }
     } AListEle;
 
+    //
+    // Records of the journal: 'A' adds (or replaces) an entry, 'R' removes it. Both start with the
+    // canonical URL; an 'A' record is followed by the fields of the CacheRecord.
+    //
+    static const char journal_add = 'A';
+    static const char journal_remove = 'R';
+
+    static void put_int(std::string &buf, int64_t value) {
+        buf.append((const char *) &value, sizeof(value));
+    }
+    //============================================================================
+
+    static void put_string(std::string &buf, const std::string &str) {
+        uint32_t len = (uint32_t) str.size();
+        buf.append((const char *) &len, sizeof(len));
+        buf.append(str);
+    }
+    //============================================================================
+
+    /*!
+     * Reads the fields of a journal record. If the record is too short, ok is set to false.
+     */
+    class RecordReader {
+    private:
+        const std::string &buf;
+        size_t pos;
+
+        bool get(void *value, size_t n) {
+            if (!ok || (buf.size() - pos < n)) return ok = false;
+            memcpy(value, buf.data() + pos, n);
+            pos += n;
+            return true;
+        }
+
+    public:
+        bool ok;
+
+        RecordReader(const std::string &buf_p) : buf(buf_p), pos(0), ok(true) {}
+
+        char getChar(void) {
+            char c = '\0';
+            get(&c, sizeof(c));
+            return c;
+        }
+
+        int64_t getInt(void) {
+            int64_t value = 0;
+            get(&value, sizeof(value));
+            return value;
+        }
+
+        std::string getString(void) {
+            uint32_t len = 0;
+            if (!get(&len, sizeof(len)) || (buf.size() - pos < len)) {
+                ok = false;
+                return std::string();
+            }
+            pos += len;
+            return buf.substr(pos - len, len);
+        }
+    };
+    //============================================================================
+
+    static std::string add_record(const std::string &canonical, const SipiCache::CacheRecord &cr) {
+        std::string record(1, journal_add);
+        record.reserve(128 + canonical.size() + cr.origpath.size() + cr.cachepath.size());
+        put_string(record, canonical);
+        put_string(record, cr.origpath);
+        put_string(record, cr.cachepath);
+        put_int(record, cr.img_w);
+        put_int(record, cr.img_h);
+#if defined(HAVE_ST_ATIMESPEC)
+        put_int(record, cr.mtime.tv_sec);
+        put_int(record, cr.mtime.tv_nsec);
+#else
+        put_int(record, cr.mtime);
+        put_int(record, 0);
+#endif
+        put_int(record, cr.access_time);
+        put_int(record, cr.fsize);
+        return record;
+    }
+    //============================================================================
+
+    static std::string remove_record(const std::string &canonical) {
+        std::string record(1, journal_remove);
+        put_string(record, canonical);
+        return record;
+    }
+    //============================================================================
+
+
+#if defined(__linux__)
+    //
+    // layout of the entries returned by the getdents64 system call
+    //
+    typedef struct {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    } DirEntry64;
+#endif
+
+    /*!
+     * Calls visit with the name of every entry of a directory, without reading the whole directory into
+     * memory first. On Linux, the entries are read with getdents64 in large chunks.
+     *
+     * \param[in] dirpath Path of the directory
+     * \param[in] visit Function called for each entry; the scan stops if it returns false
+     *
+     * \returns false if the directory couldn't be read
+     */
+    static bool scan_directory(const std::string &dirpath, const std::function<bool(const char *)> &visit) {
+#if defined(__linux__)
+        int fd = ::open(dirpath.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return false;
+
+        std::vector<char> buf(1024 * 1024);
+
+        while (true) {
+            long n = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+
+            if (n <= 0) {
+                ::close(fd);
+                return n == 0;
+            }
+
+            for (long pos = 0; pos < n;) {
+                DirEntry64 *entry = (DirEntry64 *) (buf.data() + pos);
+                pos += entry->d_reclen;
+
+                if (!visit(buf.data() + (pos - entry->d_reclen) + offsetof(DirEntry64, d_name))) {
+                    ::close(fd);
+                    return true;
+                }
+            }
+        }
+#else
+        DIR *dir = opendir(dirpath.c_str());
+        if (dir == nullptr) return false;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (!visit(entry->d_name)) break;
+        }
+
+        closedir(dir);
+        return true;
+#endif
+    }
+    //============================================================================
+
 
     SipiCache::SipiCache(const std::string &cachedir_p, long long max_cachesize_p, unsigned max_nfiles_p,
-                         float cache_hysteresis_p) : _cachedir(cachedir_p), max_cachesize(max_cachesize_p),
-                                                     max_nfiles(max_nfiles_p), cache_hysteresis(cache_hysteresis_p) {
+                         float cache_hysteresis_p) : _cachedir(cachedir_p), journal(cachedir_p + "/.sipicache.journal"),
+                                                     max_cachesize(max_cachesize_p), max_nfiles(max_nfiles_p),
+                                                     cache_hysteresis(cache_hysteresis_p) {
 
         if (access(_cachedir.c_str(), R_OK | W_OK | X_OK) != 0) {
             throw SipiError(__file__, __LINE__, "Cache directory not available", errno);
@@ -88,15 +252,53 @@ namespace Sipi {
         std::string cachefilename = _cachedir + "/.sipicache";
         cachesize = 0;
         nfiles = 0;
+        closing = false;
+        nwaiting = 0;
 
         syslog(LOG_INFO, "Cache at \"%s\" cachesize=%lld nfiles=%d hysteresis=%f", _cachedir.c_str(), max_cachesize,
                max_nfiles, cache_hysteresis);
-        std::ifstream cachefile(cachefilename, std::ofstream::in | std::ofstream::binary);
 
-        struct dirent **namelist;
-        int n;
+        //
+        // rebuild the index from the journal
+        //
+        std::unordered_map<std::string, CacheRecord> replayed;
+        size_t nrecords = journal.replay([&replayed](const std::string &record) {
+            RecordReader reader(record);
+            char type = reader.getChar();
+            std::string canonical = reader.getString();
+
+            if (type == journal_add) {
+                CacheRecord cr;
+                cr.origpath = reader.getString();
+                cr.cachepath = reader.getString();
+                cr.img_w = reader.getInt();
+                cr.img_h = reader.getInt();
+#if defined(HAVE_ST_ATIMESPEC)
+                cr.mtime.tv_sec = reader.getInt();
+                cr.mtime.tv_nsec = reader.getInt();
+#else
+                cr.mtime = reader.getInt();
+                (void) reader.getInt();
+#endif
+                cr.access_time = reader.getInt();
+                cr.fsize = reader.getInt();
+                if (reader.ok) replayed[canonical] = cr;
+            } else if ((type == journal_remove) && reader.ok) {
+                replayed.erase(canonical);
+            }
+        });
 
-        if (!cachefile.fail()) {
+        if (nrecords > 0) {
+            syslog(LOG_INFO, "Read %zu records from the cache journal", nrecords);
+        }
+
+        std::ifstream cachefile(cachefilename, std::ofstream::in | std::ofstream::binary);
+        bool legacy = !cachefile.fail();
+
+        if (legacy && (nrecords == 0)) {
+            //
+            // index written by an older version on shutdown
+            //
             cachefile.seekg(0, cachefile.end);
             std::streampos length = cachefile.tellg();
             cachefile.seekg(0, cachefile.beg);
@@ -106,15 +308,6 @@ namespace Sipi {
             for (int i = 0; i < n; i++) {
                 SipiCache::FileCacheRecord fr;
                 cachefile.read((char *) &fr, sizeof(SipiCache::FileCacheRecord));
-                std::string accesspath = _cachedir + "/" + fr.cachepath;
-
-                if (access(accesspath.c_str(), R_OK) != 0) {
-                    //
-                    // we cannot find the file – probably it has been deleted => skip it
-                    //
-                    syslog(LOG_DEBUG, "Cache could'nt find file \"%s\" on disk!", fr.cachepath);
-                    continue;
-                }
 
                 CacheRecord cr;
                 cr.img_w = fr.img_w;
@@ -124,77 +317,252 @@ namespace Sipi {
                 cr.mtime = fr.mtime;
                 cr.access_time = fr.access_time;
                 cr.fsize = fr.fsize;
-                cachesize += fr.fsize;
-                nfiles++;
-                cachetable[fr.canonical] = cr;
-                syslog(LOG_INFO, "FIle \"%s\" adding to cache", cr.cachepath.c_str());
+                replayed[fr.canonical] = cr;
             }
         }
 
+        cachefile.close();
+
         //
-        // now we looking for files that are not in the list of cached files
-        // and we delete them
+        // whether the files of the entries still exist is checked by the reconciler
         //
+        std::vector<std::pair<std::string, CacheRecord>> records(replayed.begin(), replayed.end());
+        replayed.clear();
 
-        n = scandir(_cachedir.c_str(), &namelist, nullptr, alphasort);
+        //
+        // the entries are inserted from the least to the most recently used, so that the LRU lists
+        // of the shards are in the right order
+        //
+        std::stable_sort(records.begin(), records.end(),
+                         [](const std::pair<std::string, CacheRecord> &r1,
+                            const std::pair<std::string, CacheRecord> &r2) {
+                             return difftime(r1.second.access_time, r2.second.access_time) < 0.0;
+                         });
+
+        for (const auto &record : records) {
+            insert(shard(record.first), record.first, record.second);
+            startup_files[record.second.cachepath] = record.first;
+
+            Shard &size_shard = shard(record.second.origpath);
+            if (size_shard.sizetable.find(record.second.origpath) == size_shard.sizetable.end()) {
+                SipiCache::SizeRecord tmp_cr = {record.second.img_w, record.second.img_h, record.second.mtime};
+                size_shard.sizetable[record.second.origpath] = tmp_cr;
+            }
+        }
 
-        if (n < 0) {
-            perror("scandir");
+        if (legacy) {
+            //
+            // start the journal with the entries of the old index file
+            //
+            journal.rewrite(snapshot());
+            ::remove(cachefilename.c_str());
         } else {
-            while (n--) {
-                if (namelist[n]->d_name[0] == '.') continue; // files beginning with "." are not removed
-                std::string file_on_disk = namelist[n]->d_name;
-                bool found = false;
+            journal.open();
+        }
 
-                for (const auto &ele : cachetable) {
-                    if (ele.second.cachepath == file_on_disk) found = true;
-                }
+        if (cache_hysteresis < 0.0) cache_hysteresis = 0.0;
+        if (cache_hysteresis > 1.0) cache_hysteresis = 1.0;
 
-                if (!found) {
-                    std::string ff = _cachedir + "/" + file_on_disk;
-                    syslog(LOG_INFO, "File \"%s\" not in cache file! Deleting...", file_on_disk.c_str());
-                    remove(ff.c_str());
-                }
+        reconcile_scanned = 0;
+        reconcile_removed = 0;
+        reconcile_missing = 0;
+        reconciling = true;
+
+        evictor = std::thread(&SipiCache::evict, this);
+        reconciler = std::thread(&SipiCache::reconcile, this, time(nullptr));
+    }
+    //============================================================================
+
+    SipiCache::~SipiCache() {
+        syslog(LOG_DEBUG, "Closing cache...");
+
+        {
+            std::lock_guard<std::mutex> evictor_guard(evictor_lock);
+            closing = true;
+        }
+        evictor_cond.notify_one();
+        reconciler.join();
+        evictor.join();
+
+        compact();
+    }
+    //============================================================================
 
-                free(namelist[n]);
+    void SipiCache::evict(void) {
+        std::unique_lock<std::mutex> evictor_guard(evictor_lock);
+        auto last_flush = std::chrono::steady_clock::now();
+
+        while (true) {
+            evictor_cond.wait_for(evictor_guard, std::chrono::seconds(1),
+                                  [this] { return closing || !doomed.empty() || full(); });
+
+            if (full()) {
+                evictor_guard.unlock();
+                int n = purge();
+                syslog(LOG_DEBUG, "Purged %d files from the cache", n);
+                evictor_guard.lock();
+                continue;
             }
 
-            free(namelist);
+            if (!doomed.empty()) {
+                std::string delpath = doomed.front();
+                doomed.pop_front();
+                evictor_guard.unlock();
+                ::remove(delpath.c_str());
+                evictor_guard.lock();
+            }
+
+            //
+            // the changes of the index are written to the journal once per second. The journal is compacted
+            // when most of its records are obsolete; the destructor compacts it a last time.
+            //
+            auto now = std::chrono::steady_clock::now();
+            if (!closing && (now - last_flush >= std::chrono::seconds(1))) {
+                evictor_guard.unlock();
+                journal.flush();
+                if (journal.size() > 2 * (size_t) nfiles + 10000) compact();
+                evictor_guard.lock();
+                last_flush = now;
+            }
+
+            if (closing && doomed.empty()) return; // all files are removed
         }
+    }
+    //============================================================================
+
+    void SipiCache::reconcile(time_t started) {
+        syslog(LOG_INFO, "Reconciling the cache directory with %zu cached files...", startup_files.size());
+        bool stopped = false;
+
+        //
+        // the names are looked up in a hash table, and the files not in the index are removed by the evictor
+        // thread while the scan goes on
+        //
+        bool readable = scan_directory(_cachedir, [this, started, &stopped](const char *name) {
+            if (name[0] == '.') return true; // files beginning with "." are not removed
+
+            unsigned long long scanned = ++reconcile_scanned;
+            if ((scanned % 100000) == 0) {
+                syslog(LOG_INFO, "Reconciling the cache directory: %llu files checked", scanned);
+            }
 
-        for (const auto &ele : cachetable) {
-            try {
-                (void) sizetable.at(ele.second.origpath);
-            } catch (const std::out_of_range &oor) {
-                SipiCache::SizeRecord tmp_cr = {ele.second.img_w, ele.second.img_h, ele.second.mtime};
-                sizetable[ele.second.origpath] = tmp_cr;
+            if ((scanned % 4096) == 0) {
+                std::lock_guard<std::mutex> evictor_guard(evictor_lock);
+                if (closing) {
+                    stopped = true;
+                    return false;
+                }
             }
+
+            std::string file_on_disk = name;
+            auto known = startup_files.find(file_on_disk);
+            if (known != startup_files.end()) {
+                startup_files.erase(known);
+                return true;
+            }
+
+            std::string ff = _cachedir + "/" + file_on_disk;
+            struct stat fileinfo;
+            if (stat(ff.c_str(), &fileinfo) != 0) return true;
+            if (fileinfo.st_mtime >= started) return true; // created since the startup
+
+            syslog(LOG_DEBUG, "File \"%s\" not in cache file! Deleting...", file_on_disk.c_str());
+            {
+                std::lock_guard<std::mutex> evictor_guard(evictor_lock);
+                doomed.push_back(ff);
+            }
+            evictor_cond.notify_one();
+            ++reconcile_removed;
+            return true;
+        });
+
+        if (!readable) {
+            syslog(LOG_ERR, "Couldn't read the cache directory \"%s\": %s", _cachedir.c_str(), strerror(errno));
+        } else if (!stopped) {
+            //
+            // the remaining entries have no file (unless they have been replaced in the meantime)
+            //
+            for (const auto &missing : startup_files) {
+                Shard &s = shard(missing.second);
+                std::lock_guard<std::mutex> shard_guard(s.lock);
+
+                auto entry = s.cachetable.find(missing.second);
+                if ((entry != s.cachetable.end()) && (entry->second.record.cachepath == missing.first)) {
+                    syslog(LOG_DEBUG, "Cache could'nt find file \"%s\" on disk!", missing.first.c_str());
+                    erase(s, entry);
+                    ++reconcile_missing;
+                }
+            }
+
+            syslog(LOG_INFO, "Cache directory reconciled: %llu files checked, %llu files not in the index removed, "
+                             "%llu entries without file dropped", (unsigned long long) reconcile_scanned,
+                   (unsigned long long) reconcile_removed, (unsigned long long) reconcile_missing);
         }
+
+        startup_files.clear();
+        reconciling = false;
     }
     //============================================================================
 
-    SipiCache::~SipiCache() {
-        syslog(LOG_DEBUG, "Closing cache...");
-        std::string cachefilename = _cachedir + "/.sipicache";
-        std::ofstream cachefile(cachefilename, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+    std::vector<std::string> SipiCache::snapshot(void) {
+        std::vector<std::string> records;
+        records.reserve(nfiles);
 
-        if (!cachefile.fail()) {
-            for (const auto &ele : cachetable) {
-                SipiCache::FileCacheRecord fr;
-                fr.img_w = ele.second.img_w;
-                fr.img_h = ele.second.img_h;
-                (void) snprintf(fr.canonical, 256, "%s", ele.first.c_str());
-                (void) snprintf(fr.origpath, 256, "%s", ele.second.origpath.c_str());
-                (void) snprintf(fr.cachepath, 256, "%s", ele.second.cachepath.c_str());
-                fr.mtime = ele.second.mtime;
-                fr.fsize = ele.second.fsize;
-                fr.access_time = ele.second.access_time;
-                cachefile.write((char *) &fr, sizeof(SipiCache::FileCacheRecord));
-                syslog(LOG_DEBUG, "Writing \"%s\" to cache file...", ele.second.cachepath.c_str());
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> shard_guard(s.lock);
+
+            //
+            // from the least to the most recently used, like the LRU list after a replay
+            //
+            for (auto canonical = s.lru.rbegin(); canonical != s.lru.rend(); ++canonical) {
+                records.push_back(add_record(*canonical, s.cachetable.find(*canonical)->second.record));
             }
         }
 
-        cachefile.close();
+        return records;
+    }
+    //============================================================================
+
+    void SipiCache::compact(void) {
+        journal.flush();
+
+        try {
+            journal.rewrite(snapshot());
+        } catch (SipiError &err) {
+            syslog(LOG_ERR, "Couldn't compact the cache journal: %s", err.to_string().c_str());
+        }
+    }
+    //============================================================================
+
+    void SipiCache::insert(Shard &shard_p, const std::string &canonical_p, const CacheRecord &record_p) {
+        auto entry = shard_p.cachetable.find(canonical_p);
+
+        if (entry != shard_p.cachetable.end()) {
+            erase(shard_p, entry);
+        }
+
+        journal.append(add_record(canonical_p, record_p));
+        shard_p.lru.push_front(canonical_p);
+        CacheEntry &new_entry = shard_p.cachetable[canonical_p];
+        new_entry.record = record_p;
+        new_entry.lru = shard_p.lru.begin();
+        cachesize += record_p.fsize;
+        ++nfiles;
+    }
+    //============================================================================
+
+    void SipiCache::erase(Shard &shard_p, std::unordered_map<std::string, CacheEntry>::iterator entry_p) {
+        {
+            std::lock_guard<std::mutex> evictor_guard(evictor_lock);
+            doomed.push_back(_cachedir + "/" + entry_p->second.record.cachepath);
+        }
+        evictor_cond.notify_one();
+
+        journal.append(remove_record(entry_p->first));
+        cachesize -= entry_p->second.record.fsize;
+        --nfiles;
+        shard_p.lru.erase(entry_p->second.lru);
+        shard_p.cachetable.erase(entry_p);
     }
     //============================================================================
 
@@ -259,36 +627,55 @@ namespace Sipi {
     }
     //============================================================================
 
-    int SipiCache::purge(bool use_lock) {
+    bool SipiCache::exceeds(double fraction) {
+        return ((max_cachesize > 0) && (cachesize >= fraction * max_cachesize)) ||
+               ((max_nfiles > 0) && (nfiles >= fraction * max_nfiles));
+    }
+    //============================================================================
+
+    int SipiCache::purge(void) {
         if ((max_cachesize == 0) && (max_nfiles == 0)) return 0; // allow cache to grow indefinitely! dangerous!!
+        if (!full()) return 0;
+
+        std::lock_guard<std::mutex> purge_guard(purging);
+        if (!full()) return 0; // another thread purged in the meantime
+
+        //
+        // purge down to the low watermark, so that the next purge is not needed right after the next add
+        //
+        double low_watermark = 1.0 - cache_hysteresis;
         int n = 0;
 
-        if (((max_cachesize > 0) && (cachesize >= max_cachesize)) || ((max_nfiles > 0) && (nfiles >= max_nfiles))) {
-            std::vector<AListEle> alist;
-            std::unique_lock<std::mutex> locking_mutex_guard(locking, std::defer_lock);
-            if (use_lock) locking_mutex_guard.lock();
+        while (exceeds(low_watermark)) {
+            //
+            // the least recently used file is at the end of the LRU list of one of the shards
+            //
+            Shard *victim = nullptr;
+            time_t oldest = 0;
 
-            for (const auto &ele : cachetable) {
-                AListEle al = {ele.first, ele.second.access_time, ele.second.fsize};
-                alist.push_back(al);
+            for (auto &s : shards) {
+                std::lock_guard<std::mutex> shard_guard(s.lock);
+                if (s.lru.empty()) continue;
+
+                time_t at = s.cachetable.find(s.lru.back())->second.record.access_time;
+                if ((victim == nullptr) || (difftime(at, oldest) < 0.0)) {
+                    victim = &s;
+                    oldest = at;
+                }
             }
 
-            sort(alist.begin(), alist.end(), _compare_access_time_asc);
+            if (victim == nullptr) break; // the cache is empty
 
-            long long cachesize_goal = max_cachesize * cache_hysteresis;
-            int nfiles_goal = max_nfiles * cache_hysteresis;
+            {
+                std::lock_guard<std::mutex> shard_guard(victim->lock);
+                if (victim->lru.empty()) continue;
 
-            for (const auto &ele : alist) {
-                syslog(LOG_DEBUG, "Purging from cache \"%s\"...", cachetable[ele.canonical].cachepath.c_str());
-                std::string delpath = _cachedir + "/" + cachetable[ele.canonical].cachepath;
-                ::remove(delpath.c_str());
-                cachesize -= cachetable[ele.canonical].fsize;
-                --nfiles;
-                ++n;
-                (void) cachetable.erase(ele.canonical);
-                if ((max_cachesize > 0) && (cachesize < cachesize_goal)) break;
-                if ((max_nfiles > 0) && (nfiles < nfiles_goal)) break;
+                auto entry = victim->cachetable.find(victim->lru.back());
+                syslog(LOG_DEBUG, "Purging from cache \"%s\"...", entry->second.record.cachepath.c_str());
+                erase(*victim, entry);
             }
+
+            ++n;
         }
 
         return n;
@@ -297,41 +684,131 @@ namespace Sipi {
 
     std::string SipiCache::check(const std::string &origpath_p, const std::string &canonical_p) {
         struct stat fileinfo;
-        SipiCache::CacheRecord fr;
 
         if (stat(origpath_p.c_str(), &fileinfo) != 0) {
             throw SipiError(__file__, __LINE__, "Couldn't stat file \"" + origpath_p + "\"!", errno);
         }
 #if defined(HAVE_ST_ATIMESPEC)
         struct timespec mtime = fileinfo.st_mtimespec;
+        struct timespec cache_mtime;
 #else
         time_t mtime = fileinfo.st_mtime;
+        time_t cache_mtime;
 #endif
 
         std::string res;
+        std::string cachepath;
 
         {
-            std::lock_guard<std::mutex> locking_mutex_guard(locking);
+            Shard &s = shard(canonical_p);
+            std::lock_guard<std::mutex> shard_guard(s.lock);
 
-            try {
-                fr = cachetable.at(canonical_p);
-            } catch (const std::out_of_range &oor) {
+            auto entry = s.cachetable.find(canonical_p);
+            if (entry == s.cachetable.end()) {
                 return res; // return empty string, because we didn't find the file in cache
             }
 
             //
-            // get the current time (seconds since Epoch)
+            // update the access time (seconds since Epoch) and move the file to the front of the LRU list
             //
-            time_t at;
-            time(&at);
-            fr.access_time = at; // update the access time!
+            time(&entry->second.record.access_time);
+            s.lru.splice(s.lru.begin(), s.lru, entry->second.lru);
+
+            cachepath = entry->second.record.cachepath;
+            cache_mtime = entry->second.record.mtime;
         }
 
-        if (tcompare(mtime, fr.mtime) > 0) { // original file is newer than cache, we have to replace it..
+        if (tcompare(mtime, cache_mtime) > 0) { // original file is newer than cache, we have to replace it..
             return res; // return empty string, means "replace the file in the cache!"
-        } else {
-            return _cachedir + "/" + fr.cachepath;
         }
+
+        std::string path = _cachedir + "/" + cachepath;
+
+        if (reconciling && (access(path.c_str(), R_OK) != 0)) {
+            return res; // the file has been lost, and the reconciler has not yet dropped the entry
+        }
+
+        return path;
+    }
+    //============================================================================
+
+    int SipiCache::render_wait = 30;
+
+    unsigned SipiCache::render_waiters = 4;
+
+    SipiCache::Rendering::Rendering(SipiCache *cache_p, const std::string &canonical_p) : cache(cache_p),
+                                                                                          canonical(canonical_p) {
+        finished = false;
+    }
+    //============================================================================
+
+    SipiCache::Rendering::~Rendering() {
+        finish(false);
+    }
+    //============================================================================
+
+    void SipiCache::Rendering::finish(bool ok) {
+        if (finished) return;
+        finished = true;
+        if (canonical.empty()) return;
+
+        std::lock_guard<std::mutex> flights_guard(cache->flights_lock);
+        auto flight = cache->flights.find(canonical);
+        if (flight == cache->flights.end()) return;
+
+        flight->second->done = true;
+        flight->second->ok = ok;
+        flight->second->cond.notify_all();
+        cache->flights.erase(flight);
+    }
+    //============================================================================
+
+    std::shared_ptr<SipiCache::Rendering> SipiCache::startRendering(const std::string &origpath_p,
+                                                                    const std::string &canonical_p,
+                                                                    std::string &cachepath_p) {
+        cachepath_p = check(origpath_p, canonical_p);
+        if (!cachepath_p.empty()) return nullptr;
+
+        bool rendered;
+        {
+            std::unique_lock<std::mutex> flights_guard(flights_lock);
+            auto pos = flights.find(canonical_p);
+
+            if (pos == flights.end()) {
+                std::shared_ptr<Flight> flight = std::make_shared<Flight>();
+                flight->done = false;
+                flight->ok = false;
+                flights[canonical_p] = flight;
+                return std::shared_ptr<Rendering>(new Rendering(this, canonical_p));
+            }
+
+            //
+            // the waiting requests block worker threads: if too many of them are waiting already, this
+            // one is rendered without waiting, so that a slow client of the other request cannot stall the pool
+            //
+            if (nwaiting >= render_waiters) {
+                syslog(LOG_DEBUG, "Too many requests waiting, rendering %s again", canonical_p.c_str());
+                return std::shared_ptr<Rendering>(new Rendering(this, ""));
+            }
+
+            std::shared_ptr<Flight> flight = pos->second;
+            syslog(LOG_DEBUG, "Waiting for the rendering of %s", canonical_p.c_str());
+            nwaiting++;
+            flight->cond.wait_for(flights_guard, std::chrono::seconds(render_wait),
+                                  [&flight] { return flight->done; });
+            nwaiting--;
+            rendered = flight->done && flight->ok;
+        }
+
+        if (rendered) {
+            cachepath_p = check(origpath_p, canonical_p);
+            if (!cachepath_p.empty()) return nullptr;
+        }
+
+        //
+        // the other request failed or takes too long: render it here, without making others wait for it
+        //
+        return std::shared_ptr<Rendering>(new Rendering(this, ""));
     }
     //============================================================================
 
@@ -367,17 +844,14 @@ namespace Sipi {
 
         struct stat fileinfo;
         SipiCache::CacheRecord fr;
-        SipiCache::SizeRecord sr;
 
-        fr.img_w = sr.img_w = img_w_p;
-        fr.img_h = sr.img_h = img_h_p;
+        fr.img_w = img_w_p;
+        fr.img_h = img_h_p;
         fr.origpath = origpath_p;
         fr.cachepath = cachepath;
 
-        std::lock_guard<std::mutex> locking_mutex_guard(locking);
-
         if (stat(cachepath_p.c_str(), &fileinfo) != 0) {
-            throw SipiError(__file__, __LINE__, "Couldn't stat file \"" + origpath_p + "\"!", errno);
+            throw SipiError(__file__, __LINE__, "Couldn't stat file \"" + cachepath_p + "\"!", errno);
         }
 #if defined(HAVE_ST_ATIMESPEC)
         fr.mtime = fileinfo.st_mtimespec;
@@ -393,55 +867,43 @@ namespace Sipi {
         fr.access_time = at;
         fr.fsize = fileinfo.st_size;
 
-        //
-        // we check if there is already a file with the same canonical name. If so,
-        // we remove it
-        //
-        try {
-            SipiCache::CacheRecord tmp_fr = cachetable.at(canonical_p);
-            std::string toremove = _cachedir + "/" + tmp_fr.cachepath;
-            ::remove(toremove.c_str());
-            cachesize -= tmp_fr.fsize;
-            --nfiles;
-        } catch (const std::out_of_range &oor) {
-            // do nothing...
+        {
+            //
+            // a file with the same canonical name is replaced (and removed)
+            //
+            Shard &s = shard(canonical_p);
+            std::lock_guard<std::mutex> shard_guard(s.lock);
+            insert(s, canonical_p, fr);
         }
 
-        purge(false);
-
-        cachetable[canonical_p] = fr;
-        cachesize += fr.fsize;
-
-        /*
-        try {
-            (void) sizetable.at(origpath_p);
+        {
+            Shard &s = shard(origpath_p);
+            std::lock_guard<std::mutex> shard_guard(s.lock);
+            SipiCache::SizeRecord tmp_cr = {img_w_p, img_h_p, fr.mtime};
+            s.sizetable[origpath_p] = tmp_cr;
         }
-        catch(const std::out_of_range& oor) {
-         */
-        SipiCache::SizeRecord tmp_cr = {img_w_p, img_h_p};
-        sizetable[origpath_p] = tmp_cr;
-        //}
 
-        ++nfiles;
+        if (full()) {
+            //
+            // the evictor thread purges the cache; taking its lock makes sure that it does not miss the wakeup
+            //
+            { std::lock_guard<std::mutex> evictor_guard(evictor_lock); }
+            evictor_cond.notify_one();
+        }
     }
     //============================================================================
 
     bool SipiCache::remove(const std::string &canonical_p) {
-        SipiCache::CacheRecord fr;
-        std::lock_guard<std::mutex> locking_mutex_guard(locking);
+        Shard &s = shard(canonical_p);
+        std::lock_guard<std::mutex> shard_guard(s.lock);
 
-        try {
-            fr = cachetable.at(canonical_p);
-        } catch (const std::out_of_range &oor) {
-            return false; // return empty string, because we didn't find the file in cache
+        auto entry = s.cachetable.find(canonical_p);
+        if (entry == s.cachetable.end()) {
+            return false; // we didn't find the file in cache
         }
 
-        syslog(LOG_DEBUG, "Delete from cache \"%s\"...", cachetable[canonical_p].cachepath.c_str());
-        std::string delpath = _cachedir + "/" + cachetable[canonical_p].cachepath;
-        ::remove(delpath.c_str());
-        cachesize -= cachetable[canonical_p].fsize;
-        cachetable.erase(canonical_p);
-        --nfiles;
+        syslog(LOG_DEBUG, "Delete from cache \"%s\"...", entry->second.record.cachepath.c_str());
+        erase(s, entry);
 
         return true;
     }
@@ -449,10 +911,16 @@ namespace Sipi {
 
     void SipiCache::loop(ProcessOneCacheFile worker, void *userdata, SortMethod sm) {
         std::vector<AListEle> alist;
+        std::unordered_map<std::string, CacheRecord> records;
+
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> shard_guard(s.lock);
 
-        for (const auto &ele : cachetable) {
-            AListEle al = {ele.first, ele.second.access_time, ele.second.fsize};
-            alist.push_back(al);
+            for (const auto &ele : s.cachetable) {
+                AListEle al = {ele.first, ele.second.record.access_time, ele.second.record.fsize};
+                alist.push_back(al);
+                records[ele.first] = ele.second.record;
+            }
         }
 
         switch (sm) {
@@ -480,7 +948,7 @@ namespace Sipi {
         int i = 1;
 
         for (const auto &ele : alist) {
-            worker(i, ele.canonical, cachetable[ele.canonical], userdata);
+            worker(i, ele.canonical, records[ele.canonical], userdata);
             i++;
         }
     }
@@ -497,21 +965,22 @@ namespace Sipi {
         time_t mtime = fileinfo.st_mtime;
 #endif
 
-        try {
-            SipiCache::SizeRecord sr = sizetable.at(origname_p);
-            if (tcompare(mtime, sr.mtime) > 0) { // original file is newer than cache, we have to replace it..
-                std::lock_guard<std::mutex> locking_mutex_guard(locking);
-
-                sizetable.erase(origname_p);
-                return false; // means "replace the file in the cache"
-            }
+        Shard &s = shard(origname_p);
+        std::lock_guard<std::mutex> shard_guard(s.lock);
 
-            img_w = sr.img_w;
-            img_h = sr.img_h;
-        } catch (const std::out_of_range &oor) {
+        auto sr = s.sizetable.find(origname_p);
+        if (sr == s.sizetable.end()) {
             return false;
         }
 
+        if (tcompare(mtime, sr->second.mtime) > 0) { // original file is newer than cache, we have to replace it..
+            s.sizetable.erase(sr);
+            return false; // means "replace the file in the cache"
+        }
+
+        img_w = sr->second.img_w;
+        img_h = sr->second.img_h;
+
         return true;
     }
     //============================================================================
@@ -0,0 +1,264 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <zlib.h>
+
+#include "SipiCacheJournal.h"
+#include "SipiError.h"
+
+static const char __file__[] = __FILE__;
+
+namespace Sipi {
+
+    static const char journal_magic[8] = {'S', 'I', 'P', 'I', 'J', 'R', 'N', '1'};
+
+    static const uint32_t max_record_size = 1024 * 1024; //!< larger records are considered to be garbage
+
+    /*!
+     * Syncs the directory containing a file, so that a file created or renamed in it survives a crash
+     */
+    static bool sync_directory(const std::string &path) {
+        size_t pos = path.rfind('/');
+        std::string dir = (pos == std::string::npos) ? "." : ((pos == 0) ? "/" : path.substr(0, pos));
+
+        int dirfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirfd < 0) return false;
+
+        bool ok = (::fsync(dirfd) == 0);
+        ::close(dirfd);
+        return ok;
+    }
+    //============================================================================
+
+    SipiCacheJournal::SipiCacheJournal(const std::string &path_p) : path(path_p) {
+        fd = -1;
+        npending = 0;
+        nwritten = 0;
+        valid_end = 0;
+    }
+    //============================================================================
+
+    SipiCacheJournal::~SipiCacheJournal() {
+        flush();
+        if (fd >= 0) ::close(fd);
+    }
+    //============================================================================
+
+    void SipiCacheJournal::frame(std::string &buf, const std::string &record) {
+        uint32_t header[2];
+        header[0] = (uint32_t) record.size();
+        header[1] = (uint32_t) crc32(0L, (const Bytef *) record.data(), (uInt) record.size());
+        buf.append((const char *) header, sizeof(header));
+        buf.append(record);
+    }
+    //============================================================================
+
+    bool SipiCacheJournal::writeAll(int fd_p, const std::string &buf) {
+        const char *ptr = buf.data();
+        size_t left = buf.size();
+
+        while (left > 0) {
+            ssize_t n = ::write(fd_p, ptr, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            ptr += n;
+            left -= n;
+        }
+
+        return true;
+    }
+    //============================================================================
+
+    size_t SipiCacheJournal::replay(const std::function<void(const std::string &)> &apply) {
+        std::ifstream journal(path, std::ifstream::in | std::ifstream::binary);
+        if (journal.fail()) return 0;
+
+        char magic[sizeof(journal_magic)];
+        if (!journal.read(magic, sizeof(magic)) || (memcmp(magic, journal_magic, sizeof(magic)) != 0)) {
+            syslog(LOG_WARNING, "Cache journal \"%s\" has an unknown format, ignored", path.c_str());
+            return 0;
+        }
+
+        valid_end = sizeof(journal_magic);
+
+        size_t n = 0;
+        std::string record;
+
+        while (true) {
+            uint32_t header[2];
+            if (!journal.read((char *) header, sizeof(header))) break; // end of the journal
+
+            if (header[0] > max_record_size) {
+                syslog(LOG_WARNING, "Cache journal \"%s\" is corrupt after %zu records", path.c_str(), n);
+                break;
+            }
+
+            record.resize(header[0]);
+            if (!journal.read(&record[0], header[0]) ||
+                ((uint32_t) crc32(0L, (const Bytef *) record.data(), (uInt) record.size()) != header[1])) {
+                // usually the last record, torn by a crash
+                syslog(LOG_WARNING, "Cache journal \"%s\" has an incomplete record after %zu records", path.c_str(), n);
+                break;
+            }
+
+            apply(record);
+            ++n;
+            valid_end = journal.tellg();
+        }
+
+        nwritten = n;
+        return n;
+    }
+    //============================================================================
+
+    void SipiCacheJournal::open(void) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+
+        if (valid_end > 0) {
+            fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+            if ((fd >= 0) && (::ftruncate(fd, valid_end) != 0)) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        if (fd < 0) {
+            // no valid journal yet
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if ((fd < 0) || !writeAll(fd, std::string(journal_magic, sizeof(journal_magic)))) {
+                throw SipiError(__file__, __LINE__, "Couldn't open cache journal \"" + path + "\"", errno);
+            }
+            if (!sync_directory(path)) {
+                syslog(LOG_ERR, "Couldn't sync the directory of cache journal \"%s\": %s", path.c_str(),
+                       strerror(errno));
+            }
+            nwritten = 0;
+        }
+    }
+    //============================================================================
+
+    void SipiCacheJournal::rewrite(const std::vector<std::string> &records) {
+        std::string tmppath = path + ".tmp";
+        int tmpfd = ::open(tmppath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (tmpfd < 0) {
+            throw SipiError(__file__, __LINE__, "Couldn't create cache journal \"" + tmppath + "\"", errno);
+        }
+
+        std::string buf(journal_magic, sizeof(journal_magic));
+        bool ok = true;
+
+        for (const auto &record : records) {
+            frame(buf, record);
+            if (buf.size() >= 1024 * 1024) {
+                ok = ok && writeAll(tmpfd, buf);
+                buf.clear();
+            }
+        }
+
+        ok = ok && writeAll(tmpfd, buf) && (::fsync(tmpfd) == 0);
+        int err = errno;
+        ::close(tmpfd);
+
+        if (!ok) {
+            ::unlink(tmppath.c_str());
+            throw SipiError(__file__, __LINE__, "Couldn't write cache journal \"" + tmppath + "\"", err);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock_guard(lock);
+
+            if (::rename(tmppath.c_str(), path.c_str()) != 0) {
+                err = errno;
+                ::unlink(tmppath.c_str());
+                throw SipiError(__file__, __LINE__, "Couldn't replace cache journal \"" + path + "\"", err);
+            }
+
+            //
+            // the rename has to be on the disk before records are appended to the new journal; otherwise a
+            // crash could bring back the old journal, without the records appended in the meantime
+            //
+            if (!sync_directory(path)) {
+                syslog(LOG_ERR, "Couldn't sync the directory of cache journal \"%s\": %s", path.c_str(),
+                       strerror(errno));
+            }
+
+            if (fd >= 0) ::close(fd);
+            fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+
+            if (fd < 0) {
+                throw SipiError(__file__, __LINE__, "Couldn't open cache journal \"" + path + "\"", errno);
+            }
+
+            nwritten = records.size();
+        }
+    }
+    //============================================================================
+
+    void SipiCacheJournal::append(const std::string &record) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+        if (fd < 0) return;
+
+        frame(pending, record);
+        ++npending;
+    }
+    //============================================================================
+
+    void SipiCacheJournal::flush(void) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+        if ((fd < 0) || pending.empty()) return;
+
+        off_t end = ::lseek(fd, 0, SEEK_END);
+
+        if (writeAll(fd, pending) && (::fdatasync(fd) == 0)) {
+            nwritten += npending;
+        } else {
+            //
+            // cut off a partially written record, so that the records appended later are still valid
+            //
+            syslog(LOG_ERR, "Couldn't write cache journal \"%s\": %s", path.c_str(), strerror(errno));
+            if (end >= 0) (void) ::ftruncate(fd, end);
+        }
+
+        pending.clear();
+        npending = 0;
+    }
+    //============================================================================
+
+    size_t SipiCacheJournal::size(void) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+        return nwritten + npending;
+    }
+    //============================================================================
+
+}
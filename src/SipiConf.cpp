@@ -60,7 +60,12 @@ namespace Sipi {
         keep_alive = luacfg.configInteger("sipi", "keep_alive", 20);
         thumb_size = luacfg.configString("sipi", "thumb_size", "!128,128");
         cache_n_files = luacfg.configInteger("sipi", "cache_nfiles", 0);
+        preflight_ttl = luacfg.configInteger("sipi", "preflight_ttl", 0);
+        preflight_negative_ttl = luacfg.configInteger("sipi", "preflight_negative_ttl", 0);
         n_threads = luacfg.configInteger("sipi", "nthreads", 2 * std::thread::hardware_concurrency());
+        jpx_threads = luacfg.configInteger("sipi", "jpx_threads", 0);
+        image_threads = luacfg.configInteger("sipi", "image_threads", 0);
+        jpx_profile = luacfg.configString("sipi", "jpx_profile", "default");
         std::string max_post_size_str = luacfg.configString("sipi", "max_post_size", "0");
 
         if (!max_post_size_str.empty()) {
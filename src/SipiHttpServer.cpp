@@ -37,6 +37,8 @@
 #include <vector>
 #include <cmath>
 #include <utility>
+#include <ctime>
+#include <sys/stat.h>
 #include <SipiFilenameHash.h>
 
 
@@ -176,6 +178,208 @@ namespace Sipi {
     }
     //=========================================================================
 
+    /*!
+     * Formats a time as HTTP-date (RFC 7231), e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+     *
+     * \param t the time.
+     */
+    static std::string http_date(time_t t) {
+        struct tm tm;
+        char buf[64];
+        gmtime_r(&t, &tm);
+        strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        return std::string(buf);
+    }
+    //=========================================================================
+
+    /*!
+     * Calculates the strong entity tag of an image response. The response is determined by the
+     * canonical URL, the source file (through its modification time) and the watermark.
+     *
+     * \param canonical the canonical URL of the request.
+     * \param mtime the modification time of the source file.
+     * \param watermark the watermark, or empty if no watermark is applied.
+     */
+    static std::string make_etag(const std::string &canonical, time_t mtime, const std::string &watermark) {
+        std::string tag = canonical + "|" + std::to_string((long long) mtime) + "|" + watermark;
+        shttps::Hash hash(shttps::md5);
+        hash.add_data(tag.data(), tag.size());
+        return "\"" + hash.hash() + "\"";
+    }
+    //=========================================================================
+
+    /*!
+     * Checks the conditional headers of a GET request (RFC 7232). If-None-Match takes precedence over
+     * If-Modified-Since.
+     *
+     * \param conn_obj the server connection.
+     * \param etag the entity tag of the current response.
+     * \param mtime the modification time of the source file.
+     * \return true if the client's copy is up to date and "304 Not Modified" can be sent.
+     */
+    static bool not_modified(Connection &conn_obj, const std::string &etag, time_t mtime) {
+        std::string if_none_match = conn_obj.header("if-none-match");
+
+        if (!if_none_match.empty()) {
+            std::stringstream tags(if_none_match);
+            std::string tag;
+
+            while (std::getline(tags, tag, ',')) {
+                size_t first = tag.find_first_not_of(" \t");
+                if (first == std::string::npos) continue;
+                size_t last = tag.find_last_not_of(" \t");
+                tag = tag.substr(first, last - first + 1);
+                if (tag.compare(0, 2, "W/") == 0) tag = tag.substr(2); // weak comparison
+
+                if ((tag == "*") || (tag == etag)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        std::string if_modified_since = conn_obj.header("if-modified-since");
+
+        if (!if_modified_since.empty()) {
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+
+            if (strptime(if_modified_since.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) != nullptr) {
+                return mtime <= timegm(&tm);
+            }
+        }
+
+        return false;
+    }
+    //=========================================================================
+
+    /*!
+     * Adds the validators (ETag and Last-Modified) to the response, if known.
+     *
+     * \param conn_obj the server connection.
+     * \param etag the entity tag, or empty.
+     * \param last_modified the modification time as HTTP-date, or empty.
+     */
+    static void add_validators(Connection &conn_obj, const std::string &etag, const std::string &last_modified) {
+        if (!etag.empty()) conn_obj.header("ETag", etag);
+        if (!last_modified.empty()) conn_obj.header("Last-Modified", last_modified);
+    }
+    //=========================================================================
+
+    /*!
+     * Sends a file, or the part of it requested by a single "Range: bytes=..." header (RFC 7233).
+     * Ranges are ignored if an If-Range header doesn't match the entity tag, and requests for
+     * several ranges are answered with the whole file.
+     *
+     * \param conn_obj the server connection.
+     * \param path the path of the file.
+     * \param etag the entity tag of the response.
+     */
+    static void send_file_range(Connection &conn_obj, const std::string &path, const std::string &etag) {
+        conn_obj.header("Accept-Ranges", "bytes");
+
+        std::string range = conn_obj.header("range");
+        std::string if_range = conn_obj.header("if-range");
+
+        if (range.empty() || (!if_range.empty() && (if_range != etag)) || (range.compare(0, 6, "bytes=") != 0) ||
+            (range.find(',') != std::string::npos)) {
+            conn_obj.sendFile(path);
+            return;
+        }
+
+        struct stat fileinfo;
+
+        if (stat(path.c_str(), &fileinfo) != 0) {
+            throw SipiError(__file__, __LINE__, "Cannot stat file " + path);
+        }
+
+        size_t fsize = fileinfo.st_size;
+        std::string spec = range.substr(6);
+        size_t dash = spec.find('-');
+
+        if ((dash == std::string::npos) || (spec.find_first_not_of("0123456789- ") != std::string::npos)) {
+            conn_obj.sendFile(path); // a syntactically invalid range is ignored
+            return;
+        }
+
+        std::string first_str = spec.substr(0, dash);
+        std::string last_str = spec.substr(dash + 1);
+        size_t first = 0;
+        size_t last = 0;
+        bool valid = true;
+
+        try {
+            if (first_str.empty()) { // suffix range: the last n bytes
+                if (last_str.empty()) {
+                    valid = false;
+                } else {
+                    size_t n = std::stoull(last_str);
+                    first = (n >= fsize) ? 0 : fsize - n;
+                    last = (fsize > 0) ? fsize - 1 : 0;
+                    if (n == 0) first = fsize; // unsatisfiable
+                }
+            } else {
+                first = std::stoull(first_str);
+                if (last_str.empty()) {
+                    last = fsize - 1;
+                } else {
+                    size_t n = std::stoull(last_str);
+                    last = std::min(n, fsize - 1);
+                    if (n < first) valid = false;
+                }
+            }
+        } catch (const std::exception &err) { // numbers out of range
+            valid = false;
+        }
+
+        if (!valid) {
+            conn_obj.sendFile(path); // an invalid range is ignored
+            return;
+        }
+
+        if (first >= fsize) {
+            conn_obj.status(Connection::REQUEST_RANGE_NOT_SATISFIABLE);
+            conn_obj.header("Content-Range", "bytes */" + std::to_string(fsize));
+            conn_obj.flush();
+            return;
+        }
+
+        conn_obj.status(Connection::PARTIAL_CONTENT);
+        conn_obj.header("Content-Range",
+                        "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(fsize));
+        conn_obj.sendFile(path, 8192, first, last + 1);
+    }
+    //=========================================================================
+
+    /*!
+     * Closes the cache file of a response. The file is added to the cache by the background
+     * writer once it has been written completely, so that the response is not delayed by the disk.
+     *
+     * \param conn_obj the server connection.
+     * \param cache the cache.
+     * \param infile the path of the original image.
+     * \param canonical the canonical URL of the response.
+     * \param cachefile the path of the cache file.
+     * \param img_w the width of the original image.
+     * \param img_h the height of the original image.
+     * \param rendering the handle of the rendering, finished once the file is in the cache.
+     */
+    static void close_cache_file(Connection &conn_obj, std::shared_ptr<SipiCache> cache, const std::string &infile,
+                                 const std::string &canonical, const std::string &cachefile, size_t img_w,
+                                 size_t img_h, std::shared_ptr<SipiCache::Rendering> rendering) {
+        conn_obj.closeCacheFile([cache, infile, canonical, cachefile, img_w, img_h, rendering](bool ok) {
+            if (ok) {
+                syslog(LOG_DEBUG, "Adding cachefile %s to internal list", cachefile.c_str());
+                cache->add(infile, canonical, cachefile, img_w, img_h);
+                if (rendering) rendering->finish(true);
+            } else {
+                syslog(LOG_WARNING, "Cachefile %s could not be written", cachefile.c_str());
+            }
+        });
+    }
+    //=========================================================================
+
     /*!
      * Gets the IIIF prefix, IIIF identifier, and cookie from the HTTP request, and passes them to the Lua pre-flight function (whose
      * name is given by the constant pre_flight_func_name).
@@ -183,34 +387,48 @@ namespace Sipi {
      * Returns the return values of the pre-flight function as a std::pair containing a permission string and (optionally) a file path.
      * Throws SipiError if an error occurs.
      *
+     * If the server keeps pre-flight decisions (see SipiPreflightCache), a recent decision for the same
+     * prefix, identifier and cookie is returned without calling the function. A decision is only kept if the
+     * function returns true as its last value, since the cache key ignores all other request data (headers other
+     * than the cookie, client address, query parameters).
+     *
      * \param conn_obj the server connection.
      * \param luaserver the Lua server that will be used to call the function.
      * \param params the HTTP request parameters.
+     * \param decisions the pre-flight decision cache, or nullptr.
      */
     static std::pair<std::string, std::string>
-    call_pre_flight(Connection &conn_obj, shttps::LuaServer &luaserver, std::vector<std::string> &params) {
+    call_pre_flight(Connection &conn_obj, shttps::LuaServer &luaserver, std::vector<std::string> &params,
+                    std::shared_ptr<SipiPreflightCache> decisions) {
         // The permission and optional file path that the pre_fight function returns.
         std::string permission;
         std::string infile;
 
+        std::string prefix = urldecode(params[iiif_prefix]);
+        std::string identifier = urldecode(params[iiif_identifier]);
+        std::string cookie = conn_obj.header("cookie");
+
+        if ((decisions != nullptr) && decisions->get(prefix, identifier, cookie, permission, infile)) {
+            return std::make_pair(permission, infile);
+        }
+
         // The paramters to be passed to the pre-flight function.
         std::vector<LuaValstruct> lvals;
 
         // The first parameter is the IIIF prefix.
         LuaValstruct iiif_prefix_param;
         iiif_prefix_param.type = LuaValstruct::STRING_TYPE;
-        iiif_prefix_param.value.s = urldecode(params[iiif_prefix]);
+        iiif_prefix_param.value.s = prefix;
         lvals.push_back(iiif_prefix_param);
 
         // The second parameter is the IIIF identifier.
         LuaValstruct iiif_identifier_param;
         iiif_identifier_param.type = LuaValstruct::STRING_TYPE;
-        iiif_identifier_param.value.s = urldecode(params[iiif_identifier]);
+        iiif_identifier_param.value.s = identifier;
         lvals.push_back(iiif_identifier_param);
 
         // The third parameter is the HTTP cookie.
         LuaValstruct cookie_param;
-        std::string cookie = conn_obj.header("cookie");
         cookie_param.type = LuaValstruct::STRING_TYPE;
         cookie_param.value.s = cookie;
         lvals.push_back(cookie_param);
@@ -225,6 +443,13 @@ namespace Sipi {
             throw SipiError(__file__, __LINE__, err_msg.str());
         }
 
+        // An optional boolean last return value says whether the decision may be cached.
+        bool cacheable = false;
+        if ((rvals.size() > 1) && (rvals.back().type == LuaValstruct::BOOLEAN_TYPE)) {
+            cacheable = rvals.back().value.b;
+            rvals.pop_back();
+        }
+
         // The first return value is the permission code.
         auto permission_return_val = rvals.at(0);
 
@@ -258,6 +483,10 @@ namespace Sipi {
             }
         }
 
+        if ((decisions != nullptr) && cacheable) {
+            decisions->put(prefix, identifier, cookie, permission, infile);
+        }
+
         // Return the permission code and file path, if any, as a std::pair.
         return std::make_pair(permission, infile);
     }
@@ -305,7 +534,7 @@ namespace Sipi {
             std::pair<std::string, std::string> pre_flight_return_values;
 
             try {
-                pre_flight_return_values = call_pre_flight(conn_obj, luaserver, params);
+                pre_flight_return_values = call_pre_flight(conn_obj, luaserver, params, serv->preflight_cache());
             } catch (SipiError &err) {
                 send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err);
                 return;
@@ -820,7 +1049,7 @@ namespace Sipi {
             std::pair<std::string, std::string> pre_flight_return_values;
 
             try {
-                pre_flight_return_values = call_pre_flight(conn_obj, luaserver, params);
+                pre_flight_return_values = call_pre_flight(conn_obj, luaserver, params, serv->preflight_cache());
             } catch (SipiError &err) {
                 send_error(conn_obj, Connection::INTERNAL_SERVER_ERROR, err);
                 return;
@@ -1002,6 +1231,28 @@ namespace Sipi {
         std::string canonical_header = tmppair.first;
         std::string canonical = tmppair.second;
 
+        //
+        // the validators of the response. A client with an up-to-date copy gets "304 Not Modified"
+        // before anything is read from the cache or decoded.
+        //
+        std::string etag;
+        std::string last_modified;
+        struct stat fileinfo;
+
+        if (stat(infile.c_str(), &fileinfo) == 0) {
+            etag = make_etag(canonical, fileinfo.st_mtime, watermark);
+            last_modified = http_date(fileinfo.st_mtime);
+
+            if (not_modified(conn_obj, etag, fileinfo.st_mtime)) {
+                conn_obj.status(Connection::NOT_MODIFIED);
+                conn_obj.header("Cache-Control", "must-revalidate, post-check=0, pre-check=0");
+                conn_obj.header("Link", canonical_header);
+                add_validators(conn_obj, etag, last_modified);
+                conn_obj.flush();
+                return;
+            }
+        }
+
         //
         // now we check if we can send the file directly
         //
@@ -1013,6 +1264,7 @@ namespace Sipi {
             conn_obj.status(Connection::OK);
             conn_obj.header("Cache-Control", "must-revalidate, post-check=0, pre-check=0");
             conn_obj.header("Link", canonical_header);
+            add_validators(conn_obj, etag, last_modified);
 
             switch (quality_format.format()) {
                 case SipiQualityFormat::TIF: {
@@ -1046,7 +1298,7 @@ namespace Sipi {
 
             try {
                 syslog(LOG_INFO, "Sending file %s", infile.c_str());
-                conn_obj.sendFile(infile);
+                send_file_range(conn_obj, infile, etag);
             } catch (shttps::InputFailure iofail) {
                 // -1 was thrown
                 syslog(LOG_WARNING, "Browser unexpectedly closed connection");
@@ -1066,15 +1318,23 @@ namespace Sipi {
 
         syslog(LOG_DEBUG, "Checking for cache...");
 
+        //
+        // identical requests which miss the cache at the same time are rendered only once: the
+        // others wait here until the file has been added to the cache and send it from there
+        //
+        std::shared_ptr<SipiCache::Rendering> rendering;
+
         if (cache != nullptr) {
             syslog(LOG_DEBUG, "Cache found, testing for canonical %s", canonical.c_str());
-            std::string cachefile = cache->check(infile, canonical);
+            std::string cachefile;
+            rendering = cache->startRendering(infile, canonical, cachefile);
 
             if (!cachefile.empty()) {
                 syslog(LOG_DEBUG, "Using cachefile %s", cachefile.c_str());
                 conn_obj.status(Connection::OK);
                 conn_obj.header("Cache-Control", "must-revalidate, post-check=0, pre-check=0");
                 conn_obj.header("Link", canonical_header);
+                add_validators(conn_obj, etag, last_modified);
 
                 switch (quality_format.format()) {
                     case SipiQualityFormat::TIF: {
@@ -1103,7 +1363,7 @@ namespace Sipi {
 
                 try {
                     syslog(LOG_DEBUG, "Sending cachefile %s", cachefile.c_str());
-                    conn_obj.sendFile(cachefile);
+                    send_file_range(conn_obj, cachefile, etag);
                 } catch (shttps::InputFailure err) {
                     // -1 was thrown
                     syslog(LOG_WARNING, "Browser unexpectedly closed connection");
@@ -1142,12 +1402,12 @@ namespace Sipi {
         if (quality_format.quality() != SipiQualityFormat::DEFAULT) {
             switch (quality_format.quality()) {
                 case SipiQualityFormat::COLOR: {
-                    img.convertToIcc(SipiIcc(icc_sRGB), 8); // for now, force 8 bit/sample
+                    img.convertToIcc(SipiIcc::predefined(icc_sRGB), 8); // for now, force 8 bit/sample
                     break;
                 }
 
                 case SipiQualityFormat::GRAY: {
-                    img.convertToIcc(SipiIcc(icc_GRAY_D50), 8); // for now, force 8 bit/sample
+                    img.convertToIcc(SipiIcc::predefined(icc_GRAY_D50), 8); // for now, force 8 bit/sample
                     break;
                 }
 
@@ -1181,6 +1441,7 @@ namespace Sipi {
 
         img.connection(&conn_obj);
         conn_obj.header("Cache-Control", "must-revalidate, post-check=0, pre-check=0");
+        add_validators(conn_obj, etag, last_modified);
         std::string cachefile;
 
         if (cache != nullptr) {
@@ -1199,8 +1460,7 @@ namespace Sipi {
                         for (size_t i = 3; i < (img.getNalpha() + 3); i++) img.removeChan(i);
                     }
 
-                    Sipi::SipiIcc icc = Sipi::SipiIcc(Sipi::icc_sRGB); // force sRGB !!
-                    img.convertToIcc(icc, 8);
+                    img.convertToIcc(Sipi::SipiIcc::predefined(Sipi::icc_sRGB), 8); // force sRGB !!
                     conn_obj.setChunkedTransfer();
 
                     if (cache != nullptr) {
@@ -1215,8 +1475,7 @@ namespace Sipi {
                         syslog(LOG_ERR, "%s", err.to_string().c_str());
 
                         if (cache != nullptr) {
-                            conn_obj.closeCacheFile();
-                            unlink(cachefile.c_str());
+                            conn_obj.discardCacheFile();
                         }
 
                         break;
@@ -1225,9 +1484,7 @@ namespace Sipi {
                     syslog(LOG_DEBUG, "After writing JPG...");
 
                     if (cache != nullptr) {
-                        conn_obj.closeCacheFile();
-                        syslog(LOG_INFO, "Adding cachefile %s to internal list", cachefile.c_str());
-                        cache->add(infile, canonical, cachefile, img_w, img_h);
+                        close_cache_file(conn_obj, cache, infile, canonical, cachefile, img_w, img_h, rendering);
                     }
 
                     break;
@@ -1250,8 +1507,7 @@ namespace Sipi {
                         syslog(LOG_ERR, "%s", err.to_string().c_str());
 
                         if (cache != nullptr) {
-                            conn_obj.closeCacheFile();
-                            unlink(cachefile.c_str());
+                            conn_obj.discardCacheFile();
                         }
                     }
 
@@ -1276,8 +1532,7 @@ namespace Sipi {
                         syslog(LOG_ERR, "%s", err.to_string().c_str());
 
                         if (cache != nullptr) {
-                            conn_obj.closeCacheFile();
-                            unlink(cachefile.c_str());
+                            conn_obj.discardCacheFile();
                         }
 
                         break;
@@ -1286,9 +1541,7 @@ namespace Sipi {
                     syslog(LOG_DEBUG, "After writing TIF...");
 
                     if (cache != nullptr) {
-                        conn_obj.closeCacheFile();
-                        syslog(LOG_DEBUG, "Adding cachefile %s to internal list", cachefile.c_str());
-                        cache->add(infile, canonical, cachefile, img_w, img_h);
+                        close_cache_file(conn_obj, cache, infile, canonical, cachefile, img_w, img_h, rendering);
                     }
 
                     break;
@@ -1304,10 +1557,6 @@ namespace Sipi {
                         conn_obj.openCacheFile(cachefile);
                     }
 
-                    if (cache != nullptr) {
-                        conn_obj.openCacheFile(cachefile);
-                    }
-
                     syslog(LOG_DEBUG, "Before writing PNG...");
 
                     try {
@@ -1316,8 +1565,7 @@ namespace Sipi {
                         syslog(LOG_ERR, "%s", err.to_string().c_str());
 
                         if (cache != nullptr) {
-                            conn_obj.closeCacheFile();
-                            unlink(cachefile.c_str());
+                            conn_obj.discardCacheFile();
                         }
 
                         break;
@@ -1326,9 +1574,7 @@ namespace Sipi {
                     syslog(LOG_DEBUG, "After writing PNG...");
 
                     if (cache != nullptr) {
-                        conn_obj.closeCacheFile();
-                        syslog(LOG_DEBUG, "Adding cachefile %s to internal list", cachefile.c_str());
-                        cache->add(infile, canonical, cachefile, img_w, img_h);
+                        close_cache_file(conn_obj, cache, infile, canonical, cachefile, img_w, img_h, rendering);
                     }
                     break;
                 }
@@ -1392,11 +1638,17 @@ namespace Sipi {
                                                                                                                  loglevel_p) {
         _salsah_prefix = "imgrep";
         _cache = nullptr;
+        _preflight_cache = nullptr;
     }
     //=========================================================================
 
     void SipiHttpServer::cache(const std::string &cachedir_p, long long max_cachesize_p, unsigned max_nfiles_p,
                                float cache_hysteresis_p) {
+        //
+        // identical requests waiting for each other may occupy at most half of the worker threads
+        //
+        SipiCache::render_waiters = nthreads() / 2;
+
         try {
             _cache = std::make_shared<SipiCache>(cachedir_p, max_cachesize_p, max_nfiles_p, cache_hysteresis_p);
         } catch (const SipiError &err) {
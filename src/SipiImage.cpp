@@ -29,6 +29,8 @@
 #include "shttps/Global.h"
 #include "shttps/Hash.h"
 #include "SipiImage.h"
+#include "SipiParallel.h"
+#include "SipiRotate.h"
 #include "formats/SipiIOTiff.h"
 #include "formats/SipiIOJ2k.h"
 //#include "formats/SipiIOOpenJ2k.h"
@@ -47,6 +49,11 @@ namespace Sipi {
                                                                                {"jpg", std::make_shared<SipiIOJpeg>()},
                                                                                {"png", std::make_shared<SipiIOPng>()}};
 
+    //
+    // pyramidal TIFFs are read by the "tif" instance, thus these formats are only used for writing
+    //
+    std::unordered_map<std::string, std::shared_ptr<SipiIO> > SipiImage::write_only_io = {{"ptif", std::make_shared<SipiIOTiff>(true)}};
+
     std::unordered_map<std::string, std::string> SipiImage::mimetypes = {{"jpx",  "image/jp2"},
                                                                          {"jp2",  "image/jp2"},
                                                                          {"jpg",  "image/jpeg"},
@@ -372,10 +379,13 @@ namespace Sipi {
     //============================================================================
 
     void SipiImage::write(std::string ftype, std::string filepath, int quality) {
+        auto write_only = write_only_io.find(ftype);
+        std::shared_ptr<SipiIO> writer = (write_only != write_only_io.end()) ? write_only->second : io[ftype];
+
         if (quality == -1) {
-            io[ftype]->write(this, filepath, 80);
+            writer->write(this, filepath, 80);
         } else {
-            io[ftype]->write(this, filepath, quality);
+            writer->write(this, filepath, quality);
         }
     }
     //============================================================================
@@ -385,52 +395,55 @@ namespace Sipi {
             byte *inbuf = pixels;
             byte *outbuf = new byte[(size_t) nc * (size_t) nx * (size_t) ny];
 
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    double Y = (double) inbuf[nc * (j * nx + i) + 2];
-                    double Cb = (double) inbuf[nc * (j * nx + i) + 1];;
-                    double Cr = (double) inbuf[nc * (j * nx + i) + 0];
+            RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+                for (size_t j = jbegin; j < jend; j++) {
+                    for (size_t i = 0; i < nx; i++) {
+                        double Y = (double) inbuf[nc * (j * nx + i) + 2];
+                        double Cb = (double) inbuf[nc * (j * nx + i) + 1];;
+                        double Cr = (double) inbuf[nc * (j * nx + i) + 0];
 
-                    int r = (int) (Y + 1.40200 * (Cr - 0x80));
-                    int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
-                    int b = (int) (Y + 1.77200 * (Cb - 0x80));
+                        int r = (int) (Y + 1.40200 * (Cr - 0x80));
+                        int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
+                        int b = (int) (Y + 1.77200 * (Cb - 0x80));
 
-                    outbuf[nc * (j * nx + i) + 0] = std::max(0, std::min(255, r));
-                    outbuf[nc * (j * nx + i) + 1] = std::max(0, std::min(255, g));
-                    outbuf[nc * (j * nx + i) + 2] = std::max(0, std::min(255, b));
+                        outbuf[nc * (j * nx + i) + 0] = std::max(0, std::min(255, r));
+                        outbuf[nc * (j * nx + i) + 1] = std::max(0, std::min(255, g));
+                        outbuf[nc * (j * nx + i) + 2] = std::max(0, std::min(255, b));
 
-                    for (size_t k = 3; k < nc; k++) {
-                        outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
+                        for (size_t k = 3; k < nc; k++) {
+                            outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
+                        }
                     }
                 }
-            }
+            });
 
             pixels = outbuf;
             delete[] inbuf;
         } else if (bps == 16) {
             word *inbuf = (word *) pixels;
-            size_t nnc = nc - 1;
-            unsigned short *outbuf = new unsigned short[nnc * nx * ny];
+            unsigned short *outbuf = new unsigned short[(size_t) nc * (size_t) nx * (size_t) ny];
 
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    double Y = (double) inbuf[nc * (j * nx + i) + 2];
-                    double Cb = (double) inbuf[nc * (j * nx + i) + 1];;
-                    double Cr = (double) inbuf[nc * (j * nx + i) + 0];
+            RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+                for (size_t j = jbegin; j < jend; j++) {
+                    for (size_t i = 0; i < nx; i++) {
+                        double Y = (double) inbuf[nc * (j * nx + i) + 2];
+                        double Cb = (double) inbuf[nc * (j * nx + i) + 1];;
+                        double Cr = (double) inbuf[nc * (j * nx + i) + 0];
 
-                    int r = (int) (Y + 1.40200 * (Cr - 0x80));
-                    int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
-                    int b = (int) (Y + 1.77200 * (Cb - 0x80));
+                        int r = (int) (Y + 1.40200 * (Cr - 0x80));
+                        int g = (int) (Y - 0.34414 * (Cb - 0x80) - 0.71414 * (Cr - 0x80));
+                        int b = (int) (Y + 1.77200 * (Cb - 0x80));
 
-                    outbuf[nc * (j * nx + i) + 0] = std::max(0, std::min(65535, r));
-                    outbuf[nc * (j * nx + i) + 1] = std::max(0, std::min(65535, g));
-                    outbuf[nc * (j * nx + i) + 2] = std::max(0, std::min(65535, b));
+                        outbuf[nc * (j * nx + i) + 0] = std::max(0, std::min(65535, r));
+                        outbuf[nc * (j * nx + i) + 1] = std::max(0, std::min(65535, g));
+                        outbuf[nc * (j * nx + i) + 2] = std::max(0, std::min(65535, b));
 
-                    for (size_t k = 3; k < nc; k++) {
-                        outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
+                        for (size_t k = 3; k < nc; k++) {
+                            outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + i) + k];
+                        }
                     }
                 }
-            }
+            });
 
             pixels = (byte *) outbuf;
             delete[] inbuf;
@@ -448,17 +461,17 @@ namespace Sipi {
         if (icc == nullptr) {
             switch (nc) {
                 case 1: {
-                    icc = std::make_shared<SipiIcc>(icc_GRAY_D50); // assume gray value image with D50
+                    icc = std::make_shared<SipiIcc>(SipiIcc::predefined(icc_GRAY_D50)); // assume gray value image with D50
                     break;
                 }
 
                 case 3: {
-                    icc = std::make_shared<SipiIcc>(icc_sRGB); // assume sRGB
+                    icc = std::make_shared<SipiIcc>(SipiIcc::predefined(icc_sRGB)); // assume sRGB
                     break;
                 }
 
                 case 4: {
-                    icc = std::make_shared<SipiIcc>(icc_CYMK_standard); // assume CYMK
+                    icc = std::make_shared<SipiIcc>(SipiIcc::predefined(icc_CYMK_standard)); // assume CYMK
                     break;
                 }
 
@@ -474,21 +487,29 @@ namespace Sipi {
             throw SipiImageError(__file__, __LINE__, "Unsupported bits/sample (" + std::to_string(bps) + ")");
         }
 
-        cmsHTRANSFORM hTransform;
         in_formatter = icc->iccFormatter(this);
         out_formatter = target_icc_p.iccFormatter(new_bps);
 
-        hTransform = cmsCreateTransform(icc->getIccProfile(), in_formatter, target_icc_p.getIccProfile(), out_formatter,
-                                        INTENT_PERCEPTUAL, 0);
+        std::shared_ptr<void> hTransform = SipiIcc::transform(*icc, in_formatter, target_icc_p, out_formatter,
+                                                              INTENT_PERCEPTUAL);
 
         if (hTransform == nullptr) {
             throw SipiImageError(__file__, __LINE__, "Couldn't create color transform");
         }
 
+        //
+        // the transform converts directly into the requested bits/sample
+        //
         byte *inbuf = pixels;
         byte *outbuf = new byte[nx * ny * nnc * new_bps / 8];
-        cmsDoTransform(hTransform, inbuf, outbuf, nx * ny);
-        cmsDeleteTransform(hTransform);
+        size_t in_rowlen = (size_t) nx * nc * bps / 8;
+        size_t out_rowlen = (size_t) nx * nnc * new_bps / 8;
+
+        RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+            cmsDoTransformLineStride(hTransform.get(), inbuf + jbegin * in_rowlen, outbuf + jbegin * out_rowlen,
+                                     (cmsUInt32Number) nx, (cmsUInt32Number) (jend - jbegin),
+                                     (cmsUInt32Number) in_rowlen, (cmsUInt32Number) out_rowlen, 0, 0);
+        });
         icc = std::make_shared<SipiIcc>(target_icc_p);
         pixels = outbuf;
         delete[] inbuf;
@@ -761,133 +782,29 @@ namespace Sipi {
 #undef POSITION
 
 
-    bool SipiImage::scale(size_t nnx, size_t nny) {
-        size_t iix = 1, iiy = 1;
-        size_t nnnx, nnny;
+    bool SipiImage::scale(size_t nnx, size_t nny, ResampleFilter filter) {
+        if ((nnx == 0) || (nny == 0)) return false;
+        if ((nnx == nx) && (nny == ny)) return true;
 
         //
-        // if the scaling is less than 1 (that is, the image gets smaller), we first
-        // expand it to a integer multiple of the desired size, and then we just
-        // avarage the number of pixels. This is the "proper" way of downscale an
-        // image...
+        // the separable resampler filters horizontally and then vertically. It keeps only
+        // the few filtered rows needed for the current output row, so there is no
+        // intermediate image larger than the result.
         //
-        if (nnx < nx) {
-            while (nnx * iix < nx) iix++;
-            nnnx = nnx * iix;
-        } else {
-            nnnx = nnx;
-        }
-
-        if (nny < ny) {
-            while (nny * iiy < ny) iiy++;
-            nnny = nny * iiy;
-        } else {
-            nnny = nny;
-        }
-
-        float *xlut = new float[nnnx];
-
-        for (size_t i = 0; i < nnnx; i++) {
-            xlut[i] = (float) (i * (nx - 1)) / (float) (nnnx - 1);
-        }
-
-        float *ylut = new float[nnny];
-
-        for (size_t j = 0; j < nnny; j++) {
-            ylut[j] = (float) (j * (ny - 1)) / (float) (nnny - 1);
-        }
-
         if (bps == 8) {
             byte *inbuf = pixels;
-            byte *outbuf = new byte[nnnx * nnny * nc];
-            float rx, ry;
-
-            for (size_t j = 0; j < nnny; j++) {
-                ry = ylut[j];
-                for (size_t i = 0; i < nnnx; i++) {
-                    rx = xlut[i];
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * nnnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                    }
-                }
-            }
-
+            byte *outbuf = new byte[nnx * nny * nc];
+            resample(inbuf, nx, ny, nc, outbuf, nnx, nny, filter);
             pixels = outbuf;
             delete[] inbuf;
         } else if (bps == 16) {
             word *inbuf = (word *) pixels;
-            word *outbuf = new word[nnnx * nnny * nc];
-            float rx, ry;
-
-            for (size_t j = 0; j < nnny; j++) {
-                ry = ylut[j];
-                for (size_t i = 0; i < nnnx; i++) {
-                    rx = xlut[i];
-                    for (size_t k = 0; k < nc; k++) {
-                        outbuf[nc * (j * nnnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                    }
-                }
-            }
-
+            word *outbuf = new word[nnx * nny * nc];
+            resample(inbuf, nx, ny, nc, outbuf, nnx, nny, filter);
             pixels = (byte *) outbuf;
             delete[] inbuf;
         } else {
-            delete[] xlut;
-            delete[] ylut;
             return false;
-            // clean up and throw exception
-        }
-
-        delete[] xlut;
-        delete[] ylut;
-
-        //
-        // now we have to check if we have to avarage the pixels
-        //
-        if ((iix > 1) || (iiy > 1)) {
-            if (bps == 8) {
-                byte *inbuf = pixels;
-                byte *outbuf = new byte[nnx * nny * nc];
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            unsigned int accu = 0;
-
-                            for (size_t jj = 0; jj < iiy; jj++) {
-                                for (size_t ii = 0; ii < iix; ii++) {
-                                    accu += inbuf[nc * ((iiy * j + jj) * nnnx + (iix * i + ii)) + k];
-                                }
-                            }
-
-                            outbuf[nc * (j * nnx + i) + k] = accu / (iix * iiy);
-                        }
-                    }
-                }
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nnx * nny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            unsigned int accu = 0;
-
-                            for (size_t jj = 0; jj < iiy; jj++) {
-                                for (size_t ii = 0; ii < iix; ii++) {
-                                    accu += inbuf[nc * ((iiy * j + jj) * nnnx + (iix * i + ii)) + k];
-                                }
-                            }
-
-                            outbuf[nc * (j * nnx + i) + k] = accu / (iix * iiy);
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
         }
 
         nx = nnx;
@@ -898,242 +815,50 @@ namespace Sipi {
 
 
     bool SipiImage::rotate(float angle, bool mirror) {
-        if (mirror) {
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-                for (size_t j = 0; j < ny; j++) {
-                    for (size_t i = 0; i < nx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-
-                for (size_t j = 0; j < ny; j++) {
-                    for (size_t i = 0; i < nx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nx + i) + k] = inbuf[nc * (j * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            } else {
-                return false;
-                // clean up and throw exception
-            }
+        if ((bps != 8) && (bps != 16)) {
+            return false;
         }
 
         while (angle < 0.) angle += 360.;
         while (angle >= 360.) angle -= 360.;
 
-        if (angle == 90.) {
-            //
-            // abcdef     mga
-            // ghijkl ==> nhb
-            // mnopqr     oic
-            //            pjd
-            //            qke
-            //            rlf
-            //
-            size_t nnx = ny;
-            size_t nny = nx;
-
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - i - 1) * nx + j) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - i - 1) * nx + j) + k];
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
-            }
-
-            nx = nnx;
-            ny = nny;
-        } else if (angle == 180.) {
+        if ((angle == 0.) || (angle == 90.) || (angle == 180.) || (angle == 270.)) {
             //
-            // abcdef     rqponm
-            // ghijkl ==> lkjihg
-            // mnopqr     fedcba
+            // mirroring and rotation are done in one pass
             //
-            size_t nnx = nx;
-            size_t nny = ny;
             if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - j - 1) * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * ((ny - j - 1) * nx + (nx - i - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
+                rotate_orthogonal(pixels, nx, ny, nc, (int) angle, mirror);
+            } else {
+                word *buf = (word *) pixels;
+                rotate_orthogonal(buf, nx, ny, nc, (int) angle, mirror);
+                pixels = (byte *) buf;
             }
-            nx = nnx;
-            ny = nny;
-        } else if (angle == 270.) {
-            //
-            // abcdef     flr
-            // ghijkl ==> ekq
-            // mnopqr     djp
-            //            cio
-            //            bhn
-            //            agm
-            //
-            size_t nnx = ny;
-            size_t nny = nx;
-
-            if (bps == 8) {
-                byte *inbuf = (byte *) pixels;
-                byte *outbuf = new byte[nx * ny * nc];
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * (i * nx + (nx - j - 1)) + k];
-                        }
-                    }
-                }
-
-                pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
-                word *inbuf = (word *) pixels;
-                word *outbuf = new word[nx * ny * nc];
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        for (size_t k = 0; k < nc; k++) {
-                            outbuf[nc * (j * nnx + i) + k] = inbuf[nc * (i * nx + (nx - j - 1)) + k];
-                        }
-                    }
+        } else { // all other angles
+            if (mirror) {
+                if (bps == 8) {
+                    rotate_orthogonal(pixels, nx, ny, nc, 0, true);
+                } else {
+                    word *buf = (word *) pixels;
+                    rotate_orthogonal(buf, nx, ny, nc, 0, true);
+                    pixels = (byte *) buf;
                 }
-                pixels = (byte *) outbuf;
-                delete[] inbuf;
             }
 
-            nx = nnx;
-            ny = nny;
-        } else { // all other angles
-            float phi = -M_PI * angle / 180.0;
-            float ptx = nx / 2. - .5;
-            float pty = ny / 2. - .5;
-
-            float si = sinf(phi);
-            float co = cosf(phi);
             size_t nnx;
             size_t nny;
-
-            if ((angle > 0.) && (angle < 90.)) {
-                nnx = floor(nx * cosf(-phi) + ny * sinf(-phi) + .5);
-                nny = floor(nx * sinf(-phi) + ny * cosf(-phi) + .5);
-            } else if ((angle > 90.) && (angle < 180.)) {
-                nnx = floor(-nx * cosf(-phi) + ny * sinf(-phi) + .5);
-                nny = floor(nx * sinf(-phi) - ny * cosf(-phi) + .5);
-            } else if ((angle > 180.) && (angle < 270.)) {
-                nnx = floor(-nx * cosf(-phi) - ny * sinf(-phi) + .5);
-                nny = floor(-nx * sinf(-phi) - ny * cosf(-phi) + .5);
-            } else {
-                nnx = floor(nx * cosf(-phi) - ny * sinf(-phi) + .5);
-                nny = floor(-nx * sinf(-phi) + ny * cosf(-phi) + .5);
-            }
-
-            float pptx = ptx * (float) nnx / (float) nx;
-            float ppty = pty * (float) nny / (float) ny;
+            rotated_size(nx, ny, angle, nnx, nny);
 
             if (bps == 8) {
-                byte *inbuf = pixels;
                 byte *outbuf = new byte[nnx * nny * nc];
-                byte bg = 0;
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        float rx = ((float) i - pptx) * co - ((float) j - ppty) * si + ptx;
-                        float ry = ((float) i - pptx) * si + ((float) j - ppty) * co + pty;
-
-                        if ((rx < 0.0) || (rx >= (float) (nx - 1)) || (ry < 0.0) || (ry >= (float) (ny - 1))) {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bg;
-                            }
-                        } else {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                            }
-                        }
-                    }
-                }
-
+                rotate_affine(pixels, nx, ny, nc, outbuf, nnx, nny, angle);
+                delete[] pixels;
                 pixels = outbuf;
-                delete[] inbuf;
-            } else if (bps == 16) {
+            } else {
                 word *inbuf = (word *) pixels;
                 word *outbuf = new word[nnx * nny * nc];
-                word bg = 0;
-
-                for (size_t j = 0; j < nny; j++) {
-                    for (size_t i = 0; i < nnx; i++) {
-                        float rx = ((float) i - pptx) * co - ((float) j - ppty) * si + ptx;
-                        float ry = ((float) i - pptx) * si + ((float) j - ppty) * co + pty;
-
-                        if ((rx < 0.0) || (rx >= (float) (nx - 1)) || (ry < 0.0) || (ry >= (float) (ny - 1))) {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bg;
-                            }
-                        } else {
-                            for (size_t k = 0; k < nc; k++) {
-                                outbuf[nc * (j * nnx + i) + k] = bilinn(inbuf, nx, rx, ry, k, nc);
-                            }
-                        }
-                    }
-                }
-
-                pixels = (byte *) outbuf;
+                rotate_affine(inbuf, nx, ny, nc, outbuf, nnx, nny, angle);
                 delete[] inbuf;
+                pixels = (byte *) outbuf;
             }
             nx = nnx;
             ny = nny;
@@ -1155,14 +880,16 @@ namespace Sipi {
             //byte *outbuf = new(std::nothrow) Sipi::byte[nc*nx*ny];
             byte *outbuf = new(std::nothrow) byte[nc * nx * ny];
             if (outbuf == nullptr) return false;
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        // divide pixel values by 256 using ">> 8"
-                        outbuf[nc * (j * nx + i) + k] = (inbuf[nc * (j * nx + i) + k] >> 8);
+            RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+                for (size_t j = jbegin; j < jend; j++) {
+                    for (size_t i = 0; i < nx; i++) {
+                        for (size_t k = 0; k < nc; k++) {
+                            // divide pixel values by 256 using ">> 8"
+                            outbuf[nc * (j * nx + i) + k] = (inbuf[nc * (j * nx + i) + k] >> 8);
+                        }
                     }
                 }
-            }
+            });
 
             delete[] pixels;
             pixels = outbuf;
@@ -1176,7 +903,7 @@ namespace Sipi {
 
     bool SipiImage::toBitonal(void) {
         if ((photo != MINISBLACK) && (photo != MINISWHITE)) {
-            convertToIcc(SipiIcc(icc_GRAY_D50), 8);
+            convertToIcc(SipiIcc::predefined(icc_GRAY_D50), 8);
         }
 
         bool doit = false; // will be set true if we find a value not equal 0 or 255
@@ -1236,29 +963,33 @@ namespace Sipi {
         if (bps == 8) {
             byte *buf = pixels;
 
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    byte val = bilinn(wmbuf, wm_nx, xlut[i], ylut[j], 0, wm_nc);
+            RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+                for (size_t j = jbegin; j < jend; j++) {
+                    for (size_t i = 0; i < nx; i++) {
+                        byte val = bilinn(wmbuf, wm_nx, xlut[i], ylut[j], 0, wm_nc);
 
-                    for (size_t k = 0; k < nc; k++) {
-                        float nval = (buf[nc * (j * nx + i) + k] / 255.) * (1.0F + val / 2550.0F) + val / 2550.0F;
-                        buf[nc * (j * nx + i) + k] = (nval > 1.0) ? 255 : floor(nval * 255. + .5);
+                        for (size_t k = 0; k < nc; k++) {
+                            float nval = (buf[nc * (j * nx + i) + k] / 255.) * (1.0F + val / 2550.0F) + val / 2550.0F;
+                            buf[nc * (j * nx + i) + k] = (nval > 1.0) ? 255 : floor(nval * 255. + .5);
+                        }
                     }
                 }
-            }
+            });
         } else if (bps == 16) {
             word *buf = (word *) pixels;
 
-            for (size_t j = 0; j < ny; j++) {
-                for (size_t i = 0; i < nx; i++) {
-                    for (size_t k = 0; k < nc; k++) {
-                        byte val = bilinn(wmbuf, wm_nx, xlut[i], ylut[j], 0, wm_nc);
-                        float nval =
-                                (buf[nc * (j * nx + i) + k] / 65535.0F) * (1.0F + val / 655350.0F) + val / 352500.F;
-                        buf[nc * (j * nx + i) + k] = (nval > 1.0) ? (word) 65535 : (word) floor(nval * 65535. + .5);
+            RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+                for (size_t j = jbegin; j < jend; j++) {
+                    for (size_t i = 0; i < nx; i++) {
+                        for (size_t k = 0; k < nc; k++) {
+                            byte val = bilinn(wmbuf, wm_nx, xlut[i], ylut[j], 0, wm_nc);
+                            float nval =
+                                    (buf[nc * (j * nx + i) + k] / 65535.0F) * (1.0F + val / 655350.0F) + val / 352500.F;
+                            buf[nc * (j * nx + i) + k] = (nval > 1.0) ? (word) 65535 : (word) floor(nval * 65535. + .5);
+                        }
                     }
                 }
-            }
+            });
         }
 
         delete[] wmbuf;
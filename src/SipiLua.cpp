@@ -160,6 +160,46 @@ namespace Sipi {
     }
     //=========================================================================
 
+    /*!
+     * Get the progress of the reconciliation of the cache directory with the index after startup
+     * LUA: stats = cache.reconciliation()
+     *      stats.running, stats.scanned, stats.removed, stats.missing
+     */
+    static int lua_cache_reconciliation(lua_State *L) {
+        lua_getglobal(L, sipiserver);
+        SipiHttpServer *server = (SipiHttpServer *) lua_touserdata(L, -1);
+        lua_remove(L, -1); // remove from stack
+        std::shared_ptr<SipiCache> cache = server->cache();
+
+        if (cache == nullptr) {
+            lua_pushnil(L);
+            return 1;
+        }
+
+        SipiCache::ReconcileStats stats = cache->getReconcileStats();
+
+        lua_createtable(L, 0, 4); // table1
+
+        lua_pushstring(L, "running");
+        lua_pushboolean(L, stats.running);
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "scanned");
+        lua_pushinteger(L, stats.scanned);
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "removed");
+        lua_pushinteger(L, stats.removed);
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "missing");
+        lua_pushinteger(L, stats.missing);
+        lua_rawset(L, -3);
+
+        return 1;
+    }
+    //=========================================================================
+
     static void
     add_one_cache_file(int index, const std::string &canonical, const SipiCache::CacheRecord &cr, void *userdata) {
         lua_State *L = (lua_State *) userdata;
@@ -274,7 +314,7 @@ namespace Sipi {
             return 1;
         }
 
-        int n = cache->purge(true);
+        int n = cache->purge();
         lua_pushinteger(L, n);
 
         return 1;
@@ -286,12 +326,97 @@ namespace Sipi {
                                              {"nfiles",     lua_cache_nfiles},
                                              {"max_nfiles", lua_cache_max_nfiles},
                                              {"path",       lua_cache_path},
+                                             {"reconciliation", lua_cache_reconciliation},
                                              {"filelist",   lua_cache_filelist},
                                              {"delete",     lua_delete_cache_file},
                                              {"purge",      lua_purge_cache},
                                              {0,            0}};
     //=========================================================================
 
+    /*!
+     * Get the statistics of the pre-flight decision cache (nil, if decisions are not kept)
+     * LUA: stats = preflight_cache.stats()
+     *      stats.hits, stats.misses, stats.entries, stats.ttl, stats.negative_ttl
+     */
+    static int lua_preflight_cache_stats(lua_State *L) {
+        lua_getglobal(L, sipiserver);
+        SipiHttpServer *server = (SipiHttpServer *) lua_touserdata(L, -1);
+        lua_remove(L, -1); // remove from stack
+        std::shared_ptr<SipiPreflightCache> decisions = server->preflight_cache();
+
+        lua_settop(L, 0);
+
+        if (decisions == nullptr) {
+            lua_pushnil(L);
+            return 1;
+        }
+
+        lua_createtable(L, 0, 5); // table1
+
+        lua_pushstring(L, "hits");
+        lua_pushinteger(L, decisions->hits());
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "misses");
+        lua_pushinteger(L, decisions->misses());
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "entries");
+        lua_pushinteger(L, decisions->size());
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "ttl");
+        lua_pushinteger(L, decisions->ttl());
+        lua_rawset(L, -3);
+
+        lua_pushstring(L, "negative_ttl");
+        lua_pushinteger(L, decisions->negative_ttl());
+        lua_rawset(L, -3);
+
+        return 1;
+    }
+    //=========================================================================
+
+    /*!
+     * Forget the pre-flight decisions for one image (e.g. after its permissions changed), or all decisions
+     * LUA: n = preflight_cache.invalidate(prefix, identifier)
+     *      preflight_cache.invalidate()
+     */
+    static int lua_preflight_cache_invalidate(lua_State *L) {
+        lua_getglobal(L, sipiserver);
+        SipiHttpServer *server = (SipiHttpServer *) lua_touserdata(L, -1);
+        lua_remove(L, -1); // remove from stack
+        std::shared_ptr<SipiPreflightCache> decisions = server->preflight_cache();
+
+        int top = lua_gettop(L);
+
+        if (decisions == nullptr) {
+            lua_pop(L, top);
+            lua_pushnil(L);
+            return 1;
+        }
+
+        if (top == 2) {
+            std::string prefix = std::string(lua_tostring(L, 1));
+            std::string identifier = std::string(lua_tostring(L, 2));
+            lua_pop(L, top);
+            lua_pushinteger(L, decisions->invalidate(prefix, identifier));
+        } else {
+            lua_pop(L, top);
+            size_t n = decisions->size();
+            decisions->clear();
+            lua_pushinteger(L, n);
+        }
+
+        return 1;
+    }
+    //=========================================================================
+
+    static const luaL_Reg preflight_cache_methods[] = {{"stats",      lua_preflight_cache_stats},
+                                                       {"invalidate", lua_preflight_cache_invalidate},
+                                                       {0,            0}};
+    //=========================================================================
+
     static int lua_filenamehash_helper(lua_State *L) {
         int top = lua_gettop(L);
 
@@ -956,6 +1081,10 @@ namespace Sipi {
         luaL_setfuncs(L, cache_methods, 0);
         lua_setglobal(L, "cache");
 
+        lua_newtable(L); // table
+        luaL_setfuncs(L, preflight_cache_methods, 0);
+        lua_setglobal(L, "preflight_cache");
+
         lua_newtable(L); // table
         luaL_setfuncs(L, helper_methods, 0);
         lua_setglobal(L, "helper");
@@ -0,0 +1,182 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <algorithm>
+
+#include "SipiParallel.h"
+
+namespace Sipi {
+
+    int RowBands::max_threads = 0;
+
+    /*!
+     * An operation whose bands are being processed
+     */
+    typedef struct {
+        const std::function<void(size_t, size_t)> *func;
+        size_t nrows;
+        size_t band; //!< number of rows per band
+        size_t nbands;
+        std::atomic<size_t> next; //!< next band to be taken
+        int helpers; //!< number of pool threads which may still join (pool lock)
+        size_t done; //!< number of bands done (lock)
+        std::exception_ptr error; //!< first exception thrown by a band (lock)
+        std::mutex lock;
+        std::condition_variable cond;
+    } BandJob;
+
+    /*!
+     * The pool threads and the operations they may join
+     */
+    typedef struct {
+        size_t size; //!< number of pool threads
+        std::mutex lock; //!< protects the queue of operations
+        std::condition_variable cond; //!< signals the pool threads that an operation is waiting
+        std::deque<std::shared_ptr<BandJob>> jobs; //!< operations which pool threads may join (lock)
+    } BandPool;
+
+    //
+    // The pool is created on first use and never destroyed: its threads wait for work until
+    // the process ends, so the mutex and condition variable must outlive the static destructors.
+    //
+    static BandPool *pool = nullptr;
+    static std::once_flag pool_started;
+
+    static void run_bands(BandJob *job) {
+        size_t ndone = 0;
+        std::exception_ptr error;
+        size_t b;
+
+        while ((b = job->next.fetch_add(1)) < job->nbands) {
+            try {
+                (*job->func)(b * job->band, std::min(job->nrows, (b + 1) * job->band));
+            } catch (...) {
+                if (!error) error = std::current_exception();
+            }
+            ndone++;
+        }
+
+        if (ndone == 0) return;
+
+        std::lock_guard<std::mutex> job_guard(job->lock);
+        if (error && !job->error) job->error = error;
+        job->done += ndone;
+        if (job->done == job->nbands) job->cond.notify_all();
+    }
+    //============================================================================
+
+    static void pool_thread(void) {
+        while (true) {
+            std::shared_ptr<BandJob> job;
+            {
+                std::unique_lock<std::mutex> pool_guard(pool->lock);
+                pool->cond.wait(pool_guard, [] { return !pool->jobs.empty(); });
+                job = pool->jobs.front();
+                if (--job->helpers <= 0) pool->jobs.pop_front();
+            }
+            run_bands(job.get());
+        }
+    }
+    //============================================================================
+
+    static void start_pool(void) {
+        size_t nprocs = std::thread::hardware_concurrency();
+        if (nprocs < 2) return; // no use for a pool on a single processor
+
+        pool = new BandPool();
+        pool->size = nprocs;
+
+        for (size_t i = 0; i < pool->size; i++) {
+            std::thread(pool_thread).detach();
+        }
+    }
+    //============================================================================
+
+
+    void RowBands::setMaxThreads(int n) {
+        max_threads = (n < 0) ? 0 : n;
+    }
+    //============================================================================
+
+    void RowBands::run(size_t nrows, const std::function<void(size_t, size_t)> &func, size_t min_rows) {
+        if (nrows == 0) return;
+        if (min_rows == 0) min_rows = 1;
+
+        size_t nthreads = (max_threads > 0) ? (size_t) max_threads : std::thread::hardware_concurrency();
+        size_t nbands = std::min((nrows + min_rows - 1) / min_rows, 4 * nthreads); // some slack for load balancing
+
+        if ((nthreads < 2) || (nbands < 2)) {
+            func(0, nrows);
+            return;
+        }
+
+        std::call_once(pool_started, start_pool);
+        if (pool == nullptr) {
+            func(0, nrows);
+            return;
+        }
+
+        std::shared_ptr<BandJob> job = std::make_shared<BandJob>();
+        job->func = &func;
+        job->nrows = nrows;
+        job->band = (nrows + nbands - 1) / nbands;
+        job->nbands = (nrows + job->band - 1) / job->band;
+        job->next = 0;
+        job->helpers = (int) std::min(std::min(nthreads - 1, job->nbands - 1), pool->size);
+        job->done = 0;
+
+        {
+            std::lock_guard<std::mutex> pool_guard(pool->lock);
+            pool->jobs.push_back(job);
+        }
+        if (job->helpers == 1) {
+            pool->cond.notify_one();
+        } else {
+            pool->cond.notify_all();
+        }
+
+        run_bands(job.get());
+
+        //
+        // all bands are taken; pool threads which did not join yet need not do so anymore
+        //
+        {
+            std::lock_guard<std::mutex> pool_guard(pool->lock);
+            auto pos = std::find(pool->jobs.begin(), pool->jobs.end(), job);
+            if (pos != pool->jobs.end()) pool->jobs.erase(pos);
+        }
+
+        std::unique_lock<std::mutex> job_guard(job->lock);
+        job->cond.wait(job_guard, [&job] { return job->done == job->nbands; });
+
+        if (job->error) std::rethrow_exception(job->error);
+    }
+    //============================================================================
+
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SipiPreflightCache.h"
+
+namespace Sipi {
+
+    SipiPreflightCache::SipiPreflightCache(int ttl_p, int negative_ttl_p, size_t max_entries_p)
+            : _ttl(ttl_p), _negative_ttl(negative_ttl_p), max_entries(max_entries_p) {
+        _hits = 0;
+        _misses = 0;
+    }
+    //============================================================================
+
+    std::string SipiPreflightCache::key(const std::string &prefix, const std::string &identifier,
+                                        const std::string &cookie) {
+        std::string k;
+        k.reserve(prefix.size() + identifier.size() + cookie.size() + 2);
+        k.append(prefix).append(1, '\0').append(identifier).append(1, '\0').append(cookie);
+        return k;
+    }
+    //============================================================================
+
+    bool SipiPreflightCache::get(const std::string &prefix, const std::string &identifier, const std::string &cookie,
+                                 std::string &permission, std::string &infile) {
+        std::string k = key(prefix, identifier, cookie);
+        time_t now = time(nullptr);
+
+        {
+            std::lock_guard<std::mutex> lock_guard(lock);
+            auto decision = decisions.find(k);
+
+            if (decision != decisions.end()) {
+                if (decision->second.expires > now) {
+                    permission = decision->second.permission;
+                    infile = decision->second.infile;
+                    ++_hits;
+                    return true;
+                }
+
+                decisions.erase(decision);
+            }
+        }
+
+        ++_misses;
+        return false;
+    }
+    //============================================================================
+
+    void SipiPreflightCache::put(const std::string &prefix, const std::string &identifier, const std::string &cookie,
+                                 const std::string &permission, const std::string &infile) {
+        bool granted = (permission == "allow") || (permission.find("restrict") == 0);
+        int lifetime = granted ? _ttl : _negative_ttl;
+        if (lifetime <= 0) return;
+
+        time_t now = time(nullptr);
+        Decision decision = {permission, infile, now + lifetime};
+
+        std::lock_guard<std::mutex> lock_guard(lock);
+
+        if (decisions.size() >= max_entries) {
+            //
+            // first drop the expired decisions; if the cache is still full, start from scratch
+            //
+            for (auto d = decisions.begin(); d != decisions.end();) {
+                if (d->second.expires <= now) {
+                    d = decisions.erase(d);
+                } else {
+                    ++d;
+                }
+            }
+
+            if (decisions.size() >= max_entries) decisions.clear();
+        }
+
+        decisions[key(prefix, identifier, cookie)] = decision;
+    }
+    //============================================================================
+
+    size_t SipiPreflightCache::invalidate(const std::string &prefix, const std::string &identifier) {
+        std::string k = key(prefix, identifier, "");
+        size_t n = 0;
+
+        std::lock_guard<std::mutex> lock_guard(lock);
+
+        for (auto d = decisions.begin(); d != decisions.end();) {
+            if (d->first.compare(0, k.size(), k) == 0) {
+                d = decisions.erase(d);
+                n++;
+            } else {
+                ++d;
+            }
+        }
+
+        return n;
+    }
+    //============================================================================
+
+    void SipiPreflightCache::clear(void) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+        decisions.clear();
+    }
+    //============================================================================
+
+    size_t SipiPreflightCache::size(void) {
+        std::lock_guard<std::mutex> lock_guard(lock);
+        return decisions.size();
+    }
+    //============================================================================
+
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "SipiResample.h"
+#include "SipiParallel.h"
+
+namespace Sipi {
+
+    static double box_filter(double x) {
+        return ((x > -0.5) && (x <= 0.5)) ? 1.0 : 0.0;
+    }
+    //============================================================================
+
+    static double triangle_filter(double x) {
+        x = fabs(x);
+        return (x < 1.0) ? 1.0 - x : 0.0;
+    }
+    //============================================================================
+
+    static double sinc(double x) {
+        if (x == 0.0) return 1.0;
+        x *= M_PI;
+        return sin(x) / x;
+    }
+    //============================================================================
+
+    static double lanczos3_filter(double x) {
+        return ((x > -3.0) && (x < 3.0)) ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+    //============================================================================
+
+
+    ResampleWeights::ResampleWeights(size_t in_size, size_t out_size, ResampleFilter filter) {
+        double (*filter_func)(double);
+        double support;
+
+        switch (filter) {
+            case RESAMPLE_BOX:
+                filter_func = box_filter;
+                support = 0.5;
+                break;
+            case RESAMPLE_LANCZOS3:
+                filter_func = lanczos3_filter;
+                support = 3.0;
+                break;
+            case RESAMPLE_BILINEAR:
+            default:
+                filter_func = triangle_filter;
+                support = 1.0;
+                break;
+        }
+
+        //
+        // if we downscale, the filter is stretched so that it covers all input pixels
+        // which fall into an output pixel (antialiasing)
+        //
+        double scale = (double) in_size / (double) out_size;
+        double filterscale = (scale > 1.0) ? scale : 1.0;
+        support *= filterscale;
+
+        ntaps = (size_t) ceil(support) * 2 + 1;
+        first.resize(out_size);
+        count.resize(out_size);
+        weights.assign(out_size * ntaps, 0.0f);
+
+        std::vector<double> w(ntaps);
+        size_t maxcount = 1;
+
+        for (size_t i = 0; i < out_size; i++) {
+            double center = ((double) i + 0.5) * scale;
+            long xmin = (long) floor(center - support + 0.5);
+            long xmax = (long) floor(center + support + 0.5);
+            if (xmin < 0) xmin = 0;
+            if (xmax > (long) in_size) xmax = (long) in_size;
+            if (xmax - xmin > (long) ntaps) xmax = xmin + (long) ntaps;
+
+            //
+            // the weights are normalized, this takes also care of the image borders
+            //
+            double sum = 0.0;
+            size_t n = 0;
+            for (long x = xmin; x < xmax; x++) {
+                w[n] = filter_func(((double) x - center + 0.5) / filterscale);
+                sum += w[n];
+                n++;
+            }
+
+            size_t lead = 0;
+            while ((lead < n) && (w[lead] == 0.0)) lead++;
+            while ((n > lead) && (w[n - 1] == 0.0)) n--;
+
+            if ((n == lead) || (sum == 0.0)) {
+                // can only happen for degenerated sizes; take the nearest pixel
+                long x = (long) center;
+                first[i] = (size_t) ((x < (long) in_size) ? x : (long) in_size - 1);
+                count[i] = 1;
+                weights[i * ntaps] = 1.0f;
+                continue;
+            }
+
+            first[i] = (size_t) xmin + lead;
+            count[i] = n - lead;
+            for (size_t k = lead; k < n; k++) {
+                weights[i * ntaps + k - lead] = (float) (w[k] / sum);
+            }
+            if (count[i] > maxcount) maxcount = count[i];
+        }
+
+        //
+        // compact the table to the number of taps really used, so that the horizontal pass reads
+        // the weights of one output pixel as a short contiguous run of floats
+        //
+        if (maxcount < ntaps) {
+            for (size_t i = 1; i < out_size; i++) {
+                std::copy(weights.begin() + i * ntaps, weights.begin() + i * ntaps + maxcount,
+                          weights.begin() + i * maxcount);
+            }
+            ntaps = maxcount;
+            weights.resize(out_size * ntaps);
+        }
+    }
+    //============================================================================
+
+
+    /*!
+     * Filters one row horizontally. The number of channels is a template parameter for
+     * the common cases, so that the compiler keeps the NC accumulators in registers and
+     * unrolls the channel loop. Each input row is filtered only once (see resample_rows).
+     */
+    template<typename T, size_t NC>
+    static void resample_row(const T *in, float *out, const ResampleWeights &xw, size_t nnx) {
+        for (size_t i = 0; i < nnx; i++) {
+            const float *w = &xw.weights[i * xw.ntaps];
+            const T *src = in + xw.first[i] * NC;
+            float acc[NC];
+            for (size_t k = 0; k < NC; k++) acc[k] = 0.0f;
+
+            for (size_t t = 0; t < xw.count[i]; t++) {
+                for (size_t k = 0; k < NC; k++) {
+                    acc[k] += w[t] * (float) src[t * NC + k];
+                }
+            }
+
+            for (size_t k = 0; k < NC; k++) out[i * NC + k] = acc[k];
+        }
+    }
+    //============================================================================
+
+    template<typename T>
+    static void resample_row(const T *in, float *out, const ResampleWeights &xw, size_t nnx, size_t nc) {
+        switch (nc) {
+            case 1:
+                resample_row<T, 1>(in, out, xw, nnx);
+                return;
+            case 3:
+                resample_row<T, 3>(in, out, xw, nnx);
+                return;
+            case 4:
+                resample_row<T, 4>(in, out, xw, nnx);
+                return;
+            default:
+                break;
+        }
+
+        for (size_t i = 0; i < nnx; i++) {
+            const float *w = &xw.weights[i * xw.ntaps];
+            const T *src = in + xw.first[i] * nc;
+            float *dst = out + i * nc;
+            for (size_t k = 0; k < nc; k++) dst[k] = 0.0f;
+
+            for (size_t t = 0; t < xw.count[i]; t++) {
+                for (size_t k = 0; k < nc; k++) {
+                    dst[k] += w[t] * (float) src[t * nc + k];
+                }
+            }
+        }
+    }
+    //============================================================================
+
+
+    template<typename T>
+    void resample_rows(const T *in, size_t nx, size_t nc, T *out, size_t nnx,
+                       const ResampleWeights &xweights, const ResampleWeights &yweights,
+                       size_t row_begin, size_t row_end) {
+        if (row_begin >= row_end) return;
+
+        const size_t rowlen = nnx * nc;
+        const float maxval = (float) std::numeric_limits<T>::max();
+
+        //
+        // ring buffer of horizontally filtered input rows. The input rows needed for consecutive
+        // output rows overlap and never span more than ntaps rows, thus input row r can be kept in
+        // slot r % ntaps and every input row is filtered horizontally only once.
+        //
+        const size_t nslots = yweights.ntaps;
+        std::vector<float> ring(nslots * rowlen);
+        std::vector<long> slot_row(nslots, -1);
+        std::vector<float> acc(rowlen);
+
+        for (size_t j = row_begin; j < row_end; j++) {
+            const float *w = &yweights.weights[j * yweights.ntaps];
+            std::fill(acc.begin(), acc.end(), 0.0f);
+
+            for (size_t t = 0; t < yweights.count[j]; t++) {
+                size_t r = yweights.first[j] + t;
+                size_t slot = r % nslots;
+                float *row = &ring[slot * rowlen];
+
+                if (slot_row[slot] != (long) r) {
+                    resample_row(in + r * nx * nc, row, xweights, nnx, nc);
+                    slot_row[slot] = (long) r;
+                }
+
+                //
+                // this loop and the conversion below run over whole contiguous float rows, which
+                // the compiler vectorizes (see "Performance of the Image Kernels" in the manual)
+                //
+                const float wt = w[t];
+                float *a = acc.data();
+                for (size_t i = 0; i < rowlen; i++) {
+                    a[i] += wt * row[i];
+                }
+            }
+
+            T *dst = out + j * rowlen;
+            for (size_t i = 0; i < rowlen; i++) {
+                float v = acc[i] + 0.5f;
+                dst[i] = (v <= 0.0f) ? 0 : ((v >= maxval) ? (T) maxval : (T) v);
+            }
+        }
+    }
+    //============================================================================
+
+
+    template<typename T>
+    void resample(const T *in, size_t nx, size_t ny, size_t nc, T *out, size_t nnx, size_t nny,
+                  ResampleFilter filter) {
+        ResampleWeights xweights(nx, nnx, filter);
+        ResampleWeights yweights(ny, nny, filter);
+
+        //
+        // every band has to filter the input rows of its first output row, so a band should
+        // be clearly higher than the number of taps
+        //
+        RowBands::run(nny, [&](size_t row_begin, size_t row_end) {
+            resample_rows(in, nx, nc, out, nnx, xweights, yweights, row_begin, row_end);
+        }, std::max((size_t) 16, 2 * yweights.ntaps));
+    }
+    //============================================================================
+
+    template void resample<unsigned char>(const unsigned char *in, size_t nx, size_t ny, size_t nc,
+                                          unsigned char *out, size_t nnx, size_t nny, ResampleFilter filter);
+
+    template void resample<unsigned short>(const unsigned short *in, size_t nx, size_t ny, size_t nc,
+                                           unsigned short *out, size_t nnx, size_t nny, ResampleFilter filter);
+
+    template void resample_rows<unsigned char>(const unsigned char *in, size_t nx, size_t nc, unsigned char *out,
+                                               size_t nnx, const ResampleWeights &xweights,
+                                               const ResampleWeights &yweights, size_t row_begin, size_t row_end);
+
+    template void resample_rows<unsigned short>(const unsigned short *in, size_t nx, size_t nc, unsigned short *out,
+                                                size_t nnx, const ResampleWeights &xweights,
+                                                const ResampleWeights &yweights, size_t row_begin, size_t row_end);
+
+}
@@ -0,0 +1,373 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "SipiRotate.h"
+#include "SipiParallel.h"
+
+namespace Sipi {
+
+    //
+    // Side length of the tiles (in pixels) used for transposing. A tile of the source and of the
+    // destination (64*64 pixels of 4 channels with 16 bit are 32 KiB each) stay within the cache.
+    //
+    static const size_t tile_size = 64;
+
+    //
+    // The kernels have the number of channels as template parameter NC for the common cases
+    // 1, 3 and 4, so that a pixel is copied with a few fixed moves. NC == 0 means that the
+    // number of channels nc is only known at runtime.
+    //
+    // Flips and transposes only move pixels, so that the tiling matters more than vectorization
+    // (see "Performance of the Image Kernels" in the manual).
+    //
+    template<typename T, size_t NC>
+    static inline void copy_pixel(T *dst, const T *src, size_t nc) {
+        if (NC > 0) nc = NC;
+        for (size_t k = 0; k < nc; k++) dst[k] = src[k];
+    }
+    //============================================================================
+
+    template<typename T, size_t NC>
+    static inline void swap_pixel(T *a, T *b, size_t nc) {
+        if (NC > 0) nc = NC;
+        for (size_t k = 0; k < nc; k++) std::swap(a[k], b[k]);
+    }
+    //============================================================================
+
+
+    /*!
+     * Mirrors an image horizontally in place
+     */
+    template<typename T, size_t NC>
+    static void flip_horizontal(T *buf, size_t nx, size_t ny, size_t nc) {
+        RowBands::run(ny, [&](size_t jbegin, size_t jend) {
+            for (size_t j = jbegin; j < jend; j++) {
+                T *row = buf + j * nx * nc;
+                for (size_t i = 0; i < nx / 2; i++) {
+                    swap_pixel<T, NC>(row + i * nc, row + (nx - i - 1) * nc, nc);
+                }
+            }
+        }, 64);
+    }
+    //============================================================================
+
+    /*!
+     * Mirrors an image vertically in place (rotation by 180 degrees of a mirrored image)
+     */
+    template<typename T>
+    static void flip_vertical(T *buf, size_t nx, size_t ny, size_t nc) {
+        size_t rowlen = nx * nc;
+        RowBands::run(ny / 2, [&](size_t jbegin, size_t jend) {
+            for (size_t j = jbegin; j < jend; j++) {
+                std::swap_ranges(buf + j * rowlen, buf + (j + 1) * rowlen, buf + (ny - j - 1) * rowlen);
+            }
+        }, 64);
+    }
+    //============================================================================
+
+    /*!
+     * Rotates an image by 180 degrees in place, that is, reverses the order of the pixels
+     */
+    template<typename T, size_t NC>
+    static void reverse_pixels(T *buf, size_t nx, size_t ny, size_t nc) {
+        RowBands::run(ny / 2, [&](size_t jbegin, size_t jend) {
+            for (size_t j = jbegin; j < jend; j++) {
+                T *top = buf + j * nx * nc;
+                T *bottom = buf + (ny - j - 1) * nx * nc;
+                for (size_t i = 0; i < nx; i++) {
+                    swap_pixel<T, NC>(top + i * nc, bottom + (nx - i - 1) * nc, nc);
+                }
+            }
+        }, 64);
+
+        if (ny % 2 == 1) { // the middle row is reversed in itself
+            T *row = buf + (ny / 2) * nx * nc;
+            for (size_t i = 0; i < nx / 2; i++) {
+                swap_pixel<T, NC>(row + i * nc, row + (nx - i - 1) * nc, nc);
+            }
+        }
+    }
+    //============================================================================
+
+    /*!
+     * Rotates an image by 90 or 270 degrees (optionally mirrored). The output has nny = nx
+     * rows of nnx = ny pixels; output pixel (i, j) is the input pixel (x, y) with
+     * x = j or nx - 1 - j (flipx) and y = i or ny - 1 - i (flipy).
+     */
+    template<typename T, size_t NC>
+    static void transpose(const T *in, size_t nx, size_t ny, size_t nc, T *out, bool flipx, bool flipy) {
+        const size_t nnx = ny;
+        const size_t nny = nx;
+
+        RowBands::run((nny + tile_size - 1) / tile_size, [&](size_t tbegin, size_t tend) {
+            for (size_t j0 = tbegin * tile_size; j0 < std::min(tend * tile_size, nny); j0 += tile_size) {
+                size_t j1 = std::min(j0 + tile_size, nny);
+                for (size_t i0 = 0; i0 < nnx; i0 += tile_size) {
+                    size_t i1 = std::min(i0 + tile_size, nnx);
+                    for (size_t j = j0; j < j1; j++) {
+                        size_t x = flipx ? nx - 1 - j : j;
+                        T *dst = out + (j * nnx + i0) * nc;
+                        for (size_t i = i0; i < i1; i++) {
+                            size_t y = flipy ? ny - 1 - i : i;
+                            copy_pixel<T, NC>(dst, in + (y * nx + x) * nc, nc);
+                            dst += nc;
+                        }
+                    }
+                }
+            }
+        }, 1);
+    }
+    //============================================================================
+
+
+    template<typename T, size_t NC>
+    static void rotate_orthogonal_nc(T *&buf, size_t &nx, size_t &ny, size_t nc, int angle, bool mirror) {
+        switch (angle) {
+            case 0:
+                if (mirror) flip_horizontal<T, NC>(buf, nx, ny, nc);
+                break;
+            case 180:
+                if (mirror) {
+                    flip_vertical(buf, nx, ny, nc);
+                } else {
+                    reverse_pixels<T, NC>(buf, nx, ny, nc);
+                }
+                break;
+            case 90:
+            case 270: {
+                //
+                // abcdef     mga              abcdef     flr
+                // ghijkl ==> nhb (90)   or    ghijkl ==> ekq (270)
+                // mnopqr     oic              mnopqr     djp
+                //            pjd                         cio
+                //            qke                         bhn
+                //            rlf                         agm
+                //
+                T *outbuf = new T[nx * ny * nc];
+                transpose<T, NC>(buf, nx, ny, nc, outbuf, (angle == 270) != mirror, angle == 90);
+                delete[] buf;
+                buf = outbuf;
+                std::swap(nx, ny);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    //============================================================================
+
+    template<typename T>
+    void rotate_orthogonal(T *&buf, size_t &nx, size_t &ny, size_t nc, int angle, bool mirror) {
+        switch (nc) {
+            case 1:
+                rotate_orthogonal_nc<T, 1>(buf, nx, ny, nc, angle, mirror);
+                break;
+            case 3:
+                rotate_orthogonal_nc<T, 3>(buf, nx, ny, nc, angle, mirror);
+                break;
+            case 4:
+                rotate_orthogonal_nc<T, 4>(buf, nx, ny, nc, angle, mirror);
+                break;
+            default:
+                rotate_orthogonal_nc<T, 0>(buf, nx, ny, nc, angle, mirror);
+                break;
+        }
+    }
+    //============================================================================
+
+    //
+    // Source coordinates of the affine warp are 32.32 fixed point numbers. Even for rows of
+    // 100000 pixels the accumulated error of the increments stays far below 1/1000 of a pixel.
+    //
+    static const int frac_bits = 32;
+    static const double fixed_one = 4294967296.0;
+    static const float fixed_frac = 1.0f / 4294967296.0f;
+    static const int64_t frac_mask = 0xffffffffLL;
+
+    /*!
+     * Restricts the output pixels [ibegin, iend) of a row to those for which the source
+     * position pos + i*step (fixed point) lies within [0, lim). The bounds are estimated in
+     * floating point and then corrected with the exact fixed point test.
+     */
+    static void row_span(int64_t pos, int64_t step, int64_t lim, size_t &ibegin, size_t &iend) {
+        const size_t b0 = ibegin;
+        const size_t e0 = iend;
+        auto inside = [pos, step, lim](size_t i) {
+            int64_t p = pos + (int64_t) i * step;
+            return (p >= 0) && (p < lim);
+        };
+
+        if (step == 0) {
+            if (!inside(0)) iend = ibegin;
+            return;
+        }
+
+        double t0 = -(double) pos / (double) step;
+        double t1 = (double) (lim - pos) / (double) step;
+        double lo = std::min(std::max(ceil(std::min(t0, t1)), (double) b0), (double) e0);
+        double hi = std::max(std::min(ceil(std::max(t0, t1)), (double) e0), lo);
+        ibegin = (size_t) lo;
+        iend = (size_t) hi;
+
+        while ((ibegin < iend) && !inside(ibegin)) ibegin++;
+        while ((iend > ibegin) && !inside(iend - 1)) iend--;
+        if ((ibegin == iend) && (iend < e0) && inside(iend)) iend++;
+        if ((ibegin == iend) && (ibegin > b0) && inside(ibegin - 1)) ibegin--;
+        if (ibegin < iend) {
+            while ((ibegin > b0) && inside(ibegin - 1)) ibegin--;
+            while ((iend < e0) && inside(iend)) iend++;
+        }
+    }
+    //============================================================================
+
+    /*!
+     * Interpolates the output pixels [ibegin, iend) of a row from their 2x2 source pixels. The
+     * channel loop has a fixed length NC and is unrolled; the loop over the pixels is not
+     * vectorized (see "Performance of the Image Kernels" in the manual).
+     */
+    template<typename T, size_t NC>
+    static void warp_row_bilinear(const T *in, size_t nx, size_t nc, T *out, size_t ibegin, size_t iend,
+                                  int64_t fx, int64_t fy, int64_t dx, int64_t dy) {
+        if (NC > 0) nc = NC;
+        const size_t rowlen = nx * nc;
+
+        fx += (int64_t) ibegin * dx;
+        fy += (int64_t) ibegin * dy;
+        T *dst = out + ibegin * nc;
+
+        for (size_t i = ibegin; i < iend; i++) {
+            const size_t x0 = (size_t) (fx >> frac_bits);
+            const size_t y0 = (size_t) (fy >> frac_bits);
+            const float wx = (float) (fx & frac_mask) * fixed_frac;
+            const float wy = (float) (fy & frac_mask) * fixed_frac;
+            const float w00 = (1.0f - wx) * (1.0f - wy);
+            const float w01 = wx * (1.0f - wy);
+            const float w10 = (1.0f - wx) * wy;
+            const float w11 = wx * wy;
+
+            const T *p0 = in + y0 * rowlen + x0 * nc;
+            const T *p1 = p0 + rowlen;
+            for (size_t k = 0; k < nc; k++) {
+                dst[k] = (T) (w00 * (float) p0[k] + w01 * (float) p0[nc + k] +
+                              w10 * (float) p1[k] + w11 * (float) p1[nc + k] + 0.5f);
+            }
+
+            dst += nc;
+            fx += dx;
+            fy += dy;
+        }
+    }
+    //============================================================================
+
+    template<typename T, size_t NC>
+    static void rotate_affine_nc(const T *in, size_t nx, size_t ny, size_t nc, T *out, size_t nnx, size_t nny,
+                                 double angle) {
+        //
+        // the output pixel (i, j) is mapped back to the source position
+        //   rx = (i - pptx)*co - (j - ppty)*si + ptx
+        //   ry = (i - pptx)*si + (j - ppty)*co + pty
+        // with the centers (ptx, pty) of the source and (pptx, ppty) of the output image
+        //
+        const double phi = -M_PI * angle / 180.0;
+        const double si = sin(phi);
+        const double co = cos(phi);
+        const double ptx = nx / 2. - .5;
+        const double pty = ny / 2. - .5;
+        const double pptx = nnx / 2. - .5;
+        const double ppty = nny / 2. - .5;
+
+        const int64_t dx = llround(co * fixed_one);
+        const int64_t dy = llround(si * fixed_one);
+        //
+        // bilinear interpolation needs the right and lower neighbour; like before, the last row and
+        // column are only reached at integer positions, i.e. not at all.
+        //
+        const int64_t limx = (int64_t) (nx - 1) << frac_bits;
+        const int64_t limy = (int64_t) (ny - 1) << frac_bits;
+
+        RowBands::run(nny, [&](size_t jbegin, size_t jend) {
+            for (size_t j = jbegin; j < jend; j++) {
+                T *row = out + j * nnx * nc;
+                const int64_t fx = llround((-pptx * co - ((double) j - ppty) * si + ptx) * fixed_one);
+                const int64_t fy = llround((-pptx * si + ((double) j - ppty) * co + pty) * fixed_one);
+
+                size_t ibegin = 0;
+                size_t iend = nnx;
+                row_span(fx, dx, limx, ibegin, iend);
+                row_span(fy, dy, limy, ibegin, iend);
+
+                std::fill(row, row + ibegin * nc, 0);
+                warp_row_bilinear<T, NC>(in, nx, nc, row, ibegin, iend, fx, fy, dx, dy);
+                std::fill(row + iend * nc, row + nnx * nc, 0);
+            }
+        });
+    }
+    //============================================================================
+
+    void rotated_size(size_t nx, size_t ny, double angle, size_t &nnx, size_t &nny) {
+        const double phi = M_PI * angle / 180.0;
+        const double si = fabs(sin(phi));
+        const double co = fabs(cos(phi));
+        nnx = (size_t) floor(nx * co + ny * si + .5);
+        nny = (size_t) floor(nx * si + ny * co + .5);
+        if (nnx == 0) nnx = 1;
+        if (nny == 0) nny = 1;
+    }
+    //============================================================================
+
+    template<typename T>
+    void rotate_affine(const T *in, size_t nx, size_t ny, size_t nc, T *out, size_t nnx, size_t nny,
+                       double angle) {
+        switch (nc) {
+            case 1:
+                rotate_affine_nc<T, 1>(in, nx, ny, nc, out, nnx, nny, angle);
+                break;
+            case 3:
+                rotate_affine_nc<T, 3>(in, nx, ny, nc, out, nnx, nny, angle);
+                break;
+            case 4:
+                rotate_affine_nc<T, 4>(in, nx, ny, nc, out, nnx, nny, angle);
+                break;
+            default:
+                rotate_affine_nc<T, 0>(in, nx, ny, nc, out, nnx, nny, angle);
+                break;
+        }
+    }
+    //============================================================================
+
+    template void rotate_orthogonal<unsigned char>(unsigned char *&buf, size_t &nx, size_t &ny, size_t nc,
+                                                   int angle, bool mirror);
+
+    template void rotate_orthogonal<unsigned short>(unsigned short *&buf, size_t &nx, size_t &ny, size_t nc,
+                                                    int angle, bool mirror);
+
+    template void rotate_affine<unsigned char>(const unsigned char *in, size_t nx, size_t ny, size_t nc,
+                                               unsigned char *out, size_t nnx, size_t nny, double angle);
+
+    template void rotate_affine<unsigned short>(const unsigned short *in, size_t nx, size_t ny, size_t nc,
+                                                unsigned short *out, size_t nnx, size_t nny, double angle);
+
+}
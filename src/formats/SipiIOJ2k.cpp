@@ -31,6 +31,8 @@
 #include <cmath>
 #include <vector>
 #include <cstdio>
+#include <algorithm>
+#include <exception>
 
 #include <string.h>
 
@@ -178,6 +180,44 @@ namespace Sipi {
     static KduSipiWarning kdu_sipi_warn("Kakadu-library: ");
     static KduSipiError kdu_sipi_error("Kakadu-library: ");
 
+    /*!
+    * Local class which owns the Kakadu thread environment used for decoding an image. If the
+    * scope is left by an exception, the worker threads are informed with handle_exception()
+    * before destroy() terminates them, so that they are neither leaked nor left running on a
+    * codestream which is about to be destroyed.
+    */
+    class KduThreadEnvGuard {
+    private:
+        kdu_thread_env env;
+    public:
+        KduThreadEnvGuard(int num_threads) {
+            if (num_threads > 0) {
+                env.create();
+                for (int nt = 1; nt < num_threads; nt++) {
+                    if (!env.add_thread()) break; // Unable to create all the threads requested
+                }
+            }
+        }
+
+        ~KduThreadEnvGuard() {
+            if (env.exists()) {
+                if (std::uncaught_exception()) env.handle_exception(KDU_ERROR_EXCEPTION);
+                env.destroy();
+            }
+        }
+
+        kdu_thread_env *get() { return env.exists() ? &env : nullptr; }
+
+        void handle_exception(kdu_exception exc) { if (env.exists()) env.handle_exception(exc); }
+
+        void destroy() { if (env.exists()) env.destroy(); }
+    };
+    //=============================================================================
+
+    int SipiIOJ2k::max_read_threads = 0;
+    SipiIOJ2k::WriteProfile SipiIOJ2k::write_profile = SipiIOJ2k::PROFILE_DEFAULT;
+    //=============================================================================
+
     static bool is_jpx(const char *fname) {
         int inf;
         int retval = 0;
@@ -202,8 +242,13 @@ namespace Sipi {
                          std::shared_ptr<SipiSize> size, bool force_bps_8) {
         if (!is_jpx(filepath.c_str())) return false; // It's not a JPGE2000....
 
-        int num_threads;
-        if ((num_threads = kdu_get_num_processors()) < 2) num_threads = 0;
+        //
+        // the number of threads used to decode one image is limited by max_read_threads, so that
+        // a single large request cannot occupy all processors of the server
+        //
+        int num_threads = kdu_get_num_processors();
+        if ((max_read_threads > 0) && (num_threads > max_read_threads)) num_threads = max_read_threads;
+        if (num_threads < 2) num_threads = 0;
 
         // Custom messaging services
         kdu_customize_warnings(&kdu_sipi_warn);
@@ -490,44 +535,86 @@ namespace Sipi {
         // the following code directly converts a 16-Bit jpx into an 8-bit image.
         // In order to retrieve a 16-Bit image, use kdu_uin16 *buffer an the apropriate signature of the pull_stripe method
         //
+        KduThreadEnvGuard env(num_threads);
+
         kdu_supp::kdu_stripe_decompressor decompressor;
-        decompressor.start(codestream);
-        int stripe_heights[4] = {dims.size.y, dims.size.y, dims.size.y,
-                                 dims.size.y}; // enough for alpha channel (4 components)
+        decompressor.start(codestream, false, false, env.get());
+
+        //
+        // The image is pulled in stripes of bounded height directly into the pixel buffer. All
+        // components are pulled with the same stripe height, because they are interleaved in the buffer
+        //
+        int stripe_heights[4]; // enough for alpha channel (4 components)
+        int max_heights[4];
+        int stripe_height = dims.size.y;
+        if (img->nc <= 4) {
+            decompressor.get_recommended_stripe_heights(8, 1024, stripe_heights, max_heights);
+            stripe_height = std::max(1, stripe_heights[0]);
+        }
+        size_t line_len = (size_t) dims.size.x * img->nc; // samples per line
 
         if (force_bps_8) img->bps = 8; // forces kakadu to convert to 8 bit!
-        switch (img->bps) {
-            case 8: {
-                kdu_core::kdu_byte *buffer8 = new kdu_core::kdu_byte[(int) dims.area() * img->nc];
-                decompressor.pull_stripe(buffer8, stripe_heights);
-                img->pixels = (byte *) buffer8;
-                break;
-            }
-            case 12: {
-                std::vector<char> get_signed(img->nc, 0); // vector<bool> does not work -> special treatment in C++
-                kdu_core::kdu_int16 *buffer16 = new kdu_core::kdu_int16[(int) dims.area() * img->nc];
-                decompressor.pull_stripe(buffer16, stripe_heights, nullptr, nullptr, nullptr, nullptr, (bool *) get_signed.data());
-                img->pixels = (byte *) buffer16;
-                img->bps = 16;
-                break;
-            }
-            case 16: {
-                std::vector<char> get_signed(img->nc, 0); // vector<bool> does not work -> special treatment in C++
-                kdu_core::kdu_int16 *buffer16 = new kdu_core::kdu_int16[(int) dims.area() * img->nc];
-                decompressor.pull_stripe(buffer16, stripe_heights, nullptr, nullptr, nullptr, nullptr, (bool *) get_signed.data());
-                img->pixels = (byte *) buffer16;
-                break;
-            }
-            default: {
-                decompressor.finish();
-                codestream.destroy();
-                input->close();
-                jpx_in.close(); // Not really necessary here.
-                std::cerr << "BPS=" << img->bps << std::endl;
-                throw SipiImageError(__file__, __LINE__, "Unsupported number of bits/sample!");
+        try {
+            //
+            // the buffers are handed over to img before pulling, so that they are freed with the
+            // image if decoding fails
+            //
+            switch (img->bps) {
+                case 8: {
+                    kdu_core::kdu_byte *buffer8 = new kdu_core::kdu_byte[(size_t) dims.area() * img->nc];
+                    img->pixels = (byte *) buffer8;
+                    for (int y = 0; y < dims.size.y; y += stripe_height) {
+                        int h = std::min(stripe_height, dims.size.y - y);
+                        for (int c = 0; c < 4; c++) stripe_heights[c] = h;
+                        decompressor.pull_stripe(buffer8 + y * line_len, stripe_heights);
+                    }
+                    break;
+                }
+                case 12:
+                case 16: {
+                    std::vector<char> get_signed(img->nc, 0); // vector<bool> does not work -> special treatment in C++
+                    kdu_core::kdu_int16 *buffer16 = new kdu_core::kdu_int16[(size_t) dims.area() * img->nc];
+                    img->pixels = (byte *) buffer16;
+                    img->bps = 16;
+                    for (int y = 0; y < dims.size.y; y += stripe_height) {
+                        int h = std::min(stripe_height, dims.size.y - y);
+                        for (int c = 0; c < 4; c++) stripe_heights[c] = h;
+                        decompressor.pull_stripe(buffer16 + y * line_len, stripe_heights, nullptr, nullptr, nullptr,
+                                                 nullptr, (bool *) get_signed.data());
+                    }
+                    break;
+                }
+                default: {
+                    decompressor.finish();
+                    env.destroy();
+                    codestream.destroy();
+                    input->close();
+                    jpx_in.close(); // Not really necessary here.
+                    delete [] rlut;
+                    delete [] glut;
+                    delete [] blut;
+                    std::cerr << "BPS=" << img->bps << std::endl;
+                    throw SipiImageError(__file__, __LINE__, "Unsupported number of bits/sample!");
+                }
             }
+        } catch (kdu_exception exc) {
+            //
+            // a worker thread or pull_stripe itself failed. The threads have to learn about it
+            // before the decompressor and the environment are shut down.
+            //
+            env.handle_exception(exc);
+            decompressor.finish();
+            env.destroy();
+            codestream.destroy();
+            input->close();
+            jpx_in.close();
+            delete [] rlut;
+            delete [] glut;
+            delete [] blut;
+            throw SipiImageError(__file__, __LINE__, "Error decoding JPEG2000 file: \"" + filepath + "\"");
         }
         decompressor.finish();
+        env.destroy(); // the threads have to be terminated before the codestream is destroyed
         codestream.destroy();
         input->close();
         jpx_in.close(); // Not really necessary here.
@@ -718,10 +805,17 @@ namespace Sipi {
             codestream.access_siz()->parse_string("Corder=RPCL");
             codestream.access_siz()->parse_string("Cprecincts={256,256}");
             codestream.access_siz()->parse_string("Cblk={64,64}");
-            codestream.access_siz()->parse_string("Cuse_sop=yes");
-            //codestream.access_siz()->parse_string("Stiles={1024,1024}");
-            //codestream.access_siz()->parse_string("ORGgen_plt=yes");
-            //codestream.access_siz()->parse_string("ORGtparts=R");
+            if (write_profile == PROFILE_IIIF) {
+                //
+                // tiles and packet length markers allow the decoder to seek directly to the packets of
+                // a region. With one tile-part per resolution the low resolutions are at the beginning of each tile
+                //
+                codestream.access_siz()->parse_string("Stiles={1024,1024}");
+                codestream.access_siz()->parse_string("ORGgen_plt=yes");
+                codestream.access_siz()->parse_string("ORGtparts=R");
+            } else {
+                codestream.access_siz()->parse_string("Cuse_sop=yes");
+            }
             codestream.access_siz()->finalize_all(); // Set up coding defaults
 
             jp2_family_dimensions.init(&siz); // initalize dimension box
@@ -49,7 +49,6 @@ static const char __file__[] = __FILE__;
 
 
 namespace Sipi {
-    static std::mutex inlock;
 
     /*!
      * Special exception within the JPEG routines which can be caught separately
@@ -429,6 +428,7 @@ namespace Sipi {
         // we check the magic number before calling any jpeglib routines
         unsigned char magic[2];
         if (::read(infile, magic, 2) != 2) {
+            close(infile);
             return false;
         }
         if ((magic[0] != 0xff) || (magic[1] != 0xd8)) {
@@ -439,10 +439,11 @@ namespace Sipi {
         ::lseek(infile, 0, SEEK_SET);
 
         //
-        // Since libjpeg is not thread safe, we have unfortunately use a mutex...
+        // libjpeg itself is reentrant as long as every decompressor has its own
+        // jpeg_decompress_struct, error manager and source manager. All of them live
+        // on the stack of this call (the source buffer is owned by cinfo.client_data),
+        // so concurrent reads do not need to be serialized.
         //
-        std::lock_guard<std::mutex> inlock_mutex_guard(inlock);
-
         struct jpeg_decompress_struct cinfo;
         struct jpeg_error_mgr jerr;
 
@@ -451,15 +452,21 @@ namespace Sipi {
         jpeg_saved_marker_ptr marker;
 
         //
-        // let's create the decompressor
+        // let's create the decompressor. The error manager has to be in place before
+        // jpeg_create_decompress() is called, since it may already report errors.
         //
-        jpeg_create_decompress (&cinfo);
-
-        cinfo.dct_method = JDCT_FLOAT;
-
         cinfo.err = jpeg_std_error(&jerr);
         jerr.error_exit = jpegErrorExit;
 
+        try {
+            jpeg_create_decompress(&cinfo);
+        } catch (JpegError &jpgerr) {
+            close(infile);
+            throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
+        }
+
+        cinfo.dct_method = JDCT_FLOAT;
+
 
         try {
             //jpeg_stdio_src(&cinfo, infile);
@@ -524,12 +531,12 @@ namespace Sipi {
                         char end[] = {'<', '?', 'x', 'p', 'a', 'c', 'k', 'e', 't', ' ', 'e', 'n', 'd', '\0'};
 
                         char *s;
-                        unsigned int ll = 0;
+                        unsigned int ll = pos - marker->data; // offset of pos within the marker data
                         do {
                             s = start;
                             // skip to the start marker
                             while ((ll < marker->data_length) && (*pos != *s)) {
-                                pos++; //// ISSUE: code failes here if there are many concurrent access; data overrrun??
+                                pos++;
                                 ll++;
                             }
                             // read the start marker
@@ -549,22 +556,27 @@ namespace Sipi {
                             pos++;
                         }
                         pos++; // finally we have the start of XMP string
+                        ll++;
                         unsigned char *start_xmp = pos;
 
                         unsigned char *end_xmp;
                         do {
                             s = end;
-                            while (*pos != *s) pos++;
+                            while ((ll < marker->data_length) && (*pos != *s)) {
+                                pos++;
+                                ll++;
+                            }
                             end_xmp = pos; // a candidate
-                            while ((*s != '\0') && (*pos == *s)) {
+                            while ((ll < marker->data_length) && (*s != '\0') && (*pos == *s)) {
                                 pos++;
                                 s++;
+                                ll++;
                             }
-                        } while (*s != '\0');
-                        while (*pos != '>') {
-                            pos++;
+                        } while ((ll < marker->data_length) && (*s != '\0'));
+                        if (*s != '\0') {
+                            // no end marker within the APP1 segment
+                            throw SipiError(__file__, __LINE__, "XMP Problem");
                         }
-                        pos++;
 
                         size_t xmp_len = end_xmp - start_xmp;
 
@@ -599,7 +611,41 @@ namespace Sipi {
         }
         if (icc_buffer != nullptr) {
             img->icc = std::make_shared<SipiIcc>(icc_buffer, icc_buffer_len);
+            free(icc_buffer);
+        }
+
+        //
+        // is there a region of interest defined ? If yes, get the cropping parameters
+        // (in the coordinates of the full resolution image)...
+        //
+        int roi_x = 0, roi_y = 0;
+        size_t roi_w = cinfo.image_width, roi_h = cinfo.image_height;
+        if ((region != nullptr) && (region->getType()) != SipiRegion::FULL) {
+            try {
+                region->crop_coords(cinfo.image_width, cinfo.image_height, roi_x, roi_y, roi_w, roi_h);
+            } catch (Sipi::SipiError &err) {
+                jpeg_destroy_decompress(&cinfo);
+                close(infile);
+                throw err;
+            }
+        }
+
+        //
+        // here we prepare the scaling/reduce stuff. libjpeg is able to scale down in the DCT domain
+        // by 1/2, 1/4 and 1/8 which is much cheaper than decoding the full resolution and scaling
+        // it down afterwards. Larger reduce factors are clamped, SipiImage::scale() does the rest.
+        //
+        int reduce = 0;
+        size_t nnx = roi_w, nny = roi_h;
+        bool do_size = (size != nullptr) && (size->getType() != SipiSize::FULL);
+        if (do_size) {
+            bool redonly;
+            size->get_size(roi_w, roi_h, nnx, nny, reduce, redonly);
         }
+        if (reduce < 0) reduce = 0;
+        if (reduce > 3) reduce = 3;
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 1 << reduce;
 
         try {
             jpeg_start_decompress(&cinfo);
@@ -609,9 +655,21 @@ namespace Sipi {
             throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
         }
 
+        //
+        // the region of interest in the coordinates of the reduced image
+        //
+        JDIMENSION sx = (JDIMENSION) roi_x >> reduce;
+        JDIMENSION sy = (JDIMENSION) roi_y >> reduce;
+        JDIMENSION ex = (JDIMENSION) ((roi_x + roi_w + (1 << reduce) - 1) >> reduce);
+        JDIMENSION ey = (JDIMENSION) ((roi_y + roi_h + (1 << reduce) - 1) >> reduce);
+        if (ex > cinfo.output_width) ex = cinfo.output_width;
+        if (ey > cinfo.output_height) ey = cinfo.output_height;
+        if (ex <= sx) ex = sx + 1;
+        if (ey <= sy) ey = sy + 1;
+
         img->bps = 8;
-        img->nx = cinfo.output_width;
-        img->ny = cinfo.output_height;
+        img->nx = ex - sx;
+        img->ny = ey - sy;
         img->nc = cinfo.output_components;
         int colspace = cinfo.out_color_space; // JCS_UNKNOWN, JCS_GRAYSCALE, JCS_RGB, JCS_YCbCr, JCS_CMYK, JCS_YCCK
         switch (colspace) {
@@ -632,24 +690,52 @@ namespace Sipi {
                 break;
             }
             case JCS_YCCK: {
+                jpeg_destroy_decompress(&cinfo);
+                close(infile);
                 throw SipiImageError(__file__, __LINE__, "Unsupported JPEG colorspace (JCS_YCCK)!");
             }
             case JCS_UNKNOWN: {
+                jpeg_destroy_decompress(&cinfo);
+                close(infile);
                 throw SipiImageError(__file__, __LINE__, "Unsupported JPEG colorspace (JCS_UNKNOWN)!");
             }
             default: {
+                jpeg_destroy_decompress(&cinfo);
+                close(infile);
                 throw SipiImageError(__file__, __LINE__, "Unsupported JPEG colorspace!");
             }
         }
-        int sll = cinfo.output_components * cinfo.output_width * sizeof(uint8);
+        int sll = img->nc * img->nx * sizeof(uint8); // length of a scanline of the region
 
         img->pixels = new byte[img->ny * sll];
 
         try {
-            linbuf = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, sll, 1);
-            for (size_t i = 0; i < img->ny; i++) {
+            //
+            // col_offset is the position of the first column of the region within the scanlines
+            // returned by libjpeg. libjpeg-turbo is able to skip the columns left and right of the
+            // region (the offset is aligned to an iMCU boundary) and to skip the lines above the
+            // region without decoding them. Plain libjpeg has to decode all the scanlines up to the
+            // region, but we at least stop after the last line we need.
+            //
+            JDIMENSION col_offset = sx;
+#ifdef LIBJPEG_TURBO_VERSION
+            if ((sx > 0) || (ex < cinfo.output_width)) {
+                JDIMENSION xoffset = sx;
+                JDIMENSION width = ex - sx;
+                jpeg_crop_scanline(&cinfo, &xoffset, &width);
+                col_offset = sx - xoffset;
+            }
+            if (sy > 0) {
+                jpeg_skip_scanlines(&cinfo, sy);
+            }
+#endif
+            int line_len = cinfo.output_components * cinfo.output_width * sizeof(uint8);
+            linbuf = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, line_len, 1);
+            while (cinfo.output_scanline < ey) {
+                JDIMENSION line = cinfo.output_scanline;
                 jpeg_read_scanlines(&cinfo, linbuf, 1);
-                memcpy(&(img->pixels[i * sll]), linbuf[0], (size_t) sll);
+                if (line < sy) continue;
+                memcpy(&(img->pixels[(line - sy) * sll]), linbuf[0] + col_offset * img->nc, (size_t) sll);
             }
         } catch (JpegError &jpgerr) {
             jpeg_destroy_decompress(&cinfo);
@@ -657,39 +743,25 @@ namespace Sipi {
             throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
         }
         try {
-            jpeg_finish_decompress(&cinfo);
+            if (cinfo.output_scanline < cinfo.output_height) {
+                jpeg_abort_decompress(&cinfo); // we don't need the lines below the region
+            } else {
+                jpeg_finish_decompress(&cinfo);
+            }
         } catch (JpegError &jpgerr) {
-            close(infile);
-            throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
-        }
-
-        try {
             jpeg_destroy_decompress(&cinfo);
-        } catch (JpegError &jpgerr) {
             close(infile);
-            inlock.unlock();
             throw SipiImageError(__file__, __LINE__, "Error reading JPEG file: \"" + filepath + "\": " + jpgerr.what());
         }
-        close(infile);
 
-        //
-        // do some croping...
-        //
-        if ((region != nullptr) && (region->getType()) != SipiRegion::FULL) {
-            (void) img->crop(region);
-        }
+        jpeg_destroy_decompress(&cinfo);
+        close(infile);
 
         //
-        // resize/Scale the image if necessary
+        // resize/Scale the image if the reduce alone did not give the requested size
         //
-        if ((size != NULL) && (size->getType() != SipiSize::FULL)) {
-            size_t nnx, nny;
-            int reduce;
-            bool redonly;
-            SipiSize::SizeType rtype = size->get_size(img->nx, img->ny, nnx, nny, reduce, redonly);
-            if (rtype != SipiSize::FULL) {
-                img->scale(nnx, nny);
-            }
+        if (do_size && ((img->nx != nnx) || (img->ny != nny))) {
+            img->scale(nnx, nny);
         }
 
         return TRUE;
@@ -712,7 +784,6 @@ namespace Sipi {
         // open the input file
         //
         if ((infile = fopen(filepath.c_str(), "rb")) == nullptr) {
-            // inlock.unlock();
             return false;
         }
 
@@ -30,6 +30,8 @@
 #include <fstream>
 #include <cstdio>
 #include <cmath>
+#include <vector>
+#include <algorithm>
 
 #include <stdlib.h>
 #include <errno.h>
@@ -43,6 +45,7 @@
 
 
 #include "shttps/Global.h"
+#include "shttps/makeunique.h"
 
 static const char __file__[] = __FILE__;
 
@@ -431,6 +434,62 @@ namespace Sipi {
     }
     //============================================================================
 
+    /*!
+     * Halves the resolution of an image by averaging 2x2 pixel blocks. Odd widths/heights
+     * are rounded up, the last column/row is then averaged with itself.
+     */
+    template<typename T>
+    static T *halveResolution(const T *buf, size_t nx, size_t ny, size_t nc) {
+        size_t nnx = (nx + 1) / 2;
+        size_t nny = (ny + 1) / 2;
+        T *outbuf = new T[nnx * nny * nc];
+
+        for (size_t y = 0; y < nny; y++) {
+            size_t y0 = 2 * y;
+            size_t y1 = std::min(y0 + 1, ny - 1);
+            for (size_t x = 0; x < nnx; x++) {
+                size_t x0 = 2 * x;
+                size_t x1 = std::min(x0 + 1, nx - 1);
+                for (size_t c = 0; c < nc; c++) {
+                    unsigned int sum = buf[(y0 * nx + x0) * nc + c] + buf[(y0 * nx + x1) * nc + c] +
+                                       buf[(y1 * nx + x0) * nc + c] + buf[(y1 * nx + x1) * nc + c];
+                    outbuf[(y * nnx + x) * nc + c] = (T) ((sum + 2) / 4);
+                }
+            }
+        }
+
+        return outbuf;
+    }
+    //============================================================================
+
+    /*!
+     * Writes a contiguous image buffer tile by tile into the current directory. The tiles
+     * at the right and bottom border are padded with zeros.
+     */
+    static void writeTiles(TIFF *tif, const byte *buf, size_t nx, size_t ny, size_t psize, uint32 tile_size) {
+        size_t tile_row_len = tile_size * psize;
+        auto tilebuf = shttps::make_unique<byte[]>((size_t) TIFFTileSize(tif));
+
+        for (size_t ty = 0; ty < ny; ty += tile_size) {
+            size_t rows = std::min((size_t) tile_size, ny - ty);
+            for (size_t tx = 0; tx < nx; tx += tile_size) {
+                size_t cols = std::min((size_t) tile_size, nx - tx);
+                if ((rows < tile_size) || (cols < tile_size)) {
+                    memset(tilebuf.get(), 0, (size_t) TIFFTileSize(tif));
+                }
+                for (size_t r = 0; r < rows; r++) {
+                    memcpy(tilebuf.get() + r * tile_row_len, buf + ((ty + r) * nx + tx) * psize, cols * psize);
+                }
+                if (TIFFWriteTile(tif, tilebuf.get(), (uint32) tx, (uint32) ty, 0, 0) == -1) {
+                    throw Sipi::SipiImageError(__file__, __LINE__,
+                                               "TIFFWriteTile failed on tile (" + std::to_string(tx) + ", " +
+                                               std::to_string(ty) + ")");
+                }
+            }
+        }
+    }
+    //============================================================================
+
     void SipiIOTiff::initLibrary(void) {
         static bool done = false;
         if (!done) {
@@ -469,7 +528,6 @@ namespace Sipi {
                 throw Sipi::SipiImageError(__file__, __LINE__, msg);
             }
 
-            unsigned int sll = (unsigned int) TIFFScanlineSize(tif);
             TIFF_GET_FIELD (tif, TIFFTAG_SAMPLESPERPIXEL, &stmp, 1);
             img->nc = (int) stmp;
 
@@ -692,116 +750,80 @@ namespace Sipi {
                 img->essential_metadata(se);
             }
 
-            if ((region == nullptr) || (region->getType() == SipiRegion::FULL)) {
-                if (planar == PLANARCONFIG_CONTIG) {
-                    uint32 i;
-                    uint8 *dataptr = new uint8[img->ny * sll];
-
-                    for (i = 0; i < img->ny; i++) {
-                        if (TIFFReadScanline(tif, dataptr + i * sll, i, 0) == -1) {
-                            delete[] dataptr;
-                            TIFFClose(tif);
-                            std::string msg =
-                                    "TIFFReadScanline failed on scanline " + std::to_string(i) + " in file " + filepath;
-                            throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                        }
-                    }
-
-                    img->pixels = dataptr;
-                } else if (planar == PLANARCONFIG_SEPARATE) { // RRRRR…RRR GGGGG…GGGG BBBBB…BBB
-                    uint8 *dataptr = new uint8[img->nc * img->ny * sll];
-
-                    for (uint32 j = 0; j < img->nc; j++) {
-                        for (uint32 i = 0; i < img->ny; i++) {
-                            if (TIFFReadScanline(tif, dataptr + j * img->ny * sll + i * sll, i, j) == -1) {
-                                delete[] dataptr;
-                                TIFFClose(tif);
-                                std::string msg =
-                                        "TIFFReadScanline failed on scanline " + std::to_string(i) + " in file " +
-                                        filepath;
-                                throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                            }
-                        }
-                    }
-
-                    img->pixels = dataptr;
-
-                    //
-                    // rearrange the data to RGBRGBRGB…RGB
-                    //
-                    separateToContig(img, sll); // convert to RGBRGBRGB...
+            //
+            // get the region of interest. Only the tiles or strips intersecting it are decoded
+            //
+            int roi_x = 0, roi_y = 0;
+            size_t roi_w = img->nx, roi_h = img->ny;
+            if ((region != nullptr) && (region->getType() != SipiRegion::FULL)) {
+                if (img->bps == 1) {
+                    TIFFClose(tif);
+                    std::string msg = "Images with 1 bit/sample not supported in file " + filepath;
+                    throw Sipi::SipiImageError(__file__, __LINE__, msg);
                 }
-            } else {
-                int roi_x, roi_y;
-                size_t roi_w, roi_h;
-                region->crop_coords(img->nx, img->ny, roi_x, roi_y, roi_w, roi_h);
-                int ps; // pixel size in bytes
-
-                switch (img->bps) {
-                    case 1: {
-                        std::string msg = "Images with 1 bit/sample not supported in file " + filepath;
-                        throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                    }
-
-                    case 8: {
-                        ps = 1;
-                        break;
-                    }
-
-                    case 16: {
-                        ps = 2;
-                        break;
-                    }
+                try {
+                    region->crop_coords(img->nx, img->ny, roi_x, roi_y, roi_w, roi_h);
+                } catch (Sipi::SipiError &err) {
+                    TIFFClose(tif);
+                    throw err;
                 }
+            }
 
-                uint8 *dataptr = new uint8[sll];
-                uint8 *inbuf = new uint8[ps * roi_w * roi_h * img->nc];
-
-                if (planar == PLANARCONFIG_CONTIG) { // RGBRGBRGBRGBRGBRGBRGBRGB
-                    for (uint32 i = 0; i < roi_h; i++) {
-                        if (TIFFReadScanline(tif, dataptr, roi_y + i, 0) == -1) {
-                            delete[] dataptr;
-                            delete[] inbuf;
-                            TIFFClose(tif);
-                            std::string msg =
-                                    "TIFFReadScanline failed on scanline " + std::to_string(i) + " in file " + filepath;
-                            throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                        }
+            //
+            // if the file is a pyramidal TIFF, the region is read from the smallest reduced
+            // resolution level which is still at least as large as the requested size
+            //
+            size_t nnx, nny;
+            int reduce = 0;
+            bool redonly;
+            bool do_size = false;
 
-                        memcpy(inbuf + ps * i * roi_w * img->nc, dataptr + ps * roi_x * img->nc, ps * roi_w * img->nc);
-                    }
+            if (size != nullptr) {
+                do_size = (size->get_size(roi_w, roi_h, nnx, nny, reduce, redonly) != SipiSize::FULL);
+            }
 
-                    img->nx = roi_w;
-                    img->ny = roi_h;
-                    img->pixels = inbuf;
-                } else if (planar == PLANARCONFIG_SEPARATE) { // RRRRR…RRR GGGGG…GGGG BBBBB…BBB
-                    for (uint32 j = 0; j < img->nc; j++) {
-                        for (uint32 i = 0; i < roi_h; i++) {
-                            if (TIFFReadScanline(tif, dataptr, roi_y + i, j) == -1) {
-                                delete[] dataptr;
-                                delete[] inbuf;
-                                TIFFClose(tif);
-                                std::string msg =
-                                        "TIFFReadScanline failed on scanline " + std::to_string(i) + " in file " +
-                                        filepath;
-                                throw Sipi::SipiImageError(__file__, __LINE__, msg);
-                            }
+            int level = 0;
+            if (do_size && (reduce > 0) && ((img->bps % 8) == 0)) {
+                try {
+                    level = selectPyramidLevel(tif, img, reduce);
+                } catch (Sipi::SipiImageError &err) {
+                    TIFFClose(tif);
+                    throw Sipi::SipiImageError(__file__, __LINE__, err.to_string() + " in file " + filepath);
+                }
+            }
 
-                            memcpy(inbuf + ps * roi_w * (j * roi_h + i), dataptr + ps * roi_x, ps * roi_w);
-                        }
-                    }
+            if (level > 0) {
+                uint32 lnx, lny;
+                TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &lnx);
+                TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &lny);
+                TIFF_GET_FIELD (tif, TIFFTAG_PLANARCONFIG, &planar, PLANARCONFIG_CONTIG);
+                img->nx = lnx;
+                img->ny = lny;
 
-                    img->nx = roi_w;
-                    img->ny = roi_h;
-                    img->pixels = inbuf;
+                size_t sf = (size_t) 1 << level;
+                size_t ex = std::min((roi_x + roi_w + sf - 1) / sf, (size_t) lnx);
+                size_t ey = std::min((roi_y + roi_h + sf - 1) / sf, (size_t) lny);
+                roi_x = std::min(roi_x / sf, (size_t) lnx - 1);
+                roi_y = std::min(roi_y / sf, (size_t) lny - 1);
+                roi_w = ex > (size_t) roi_x ? ex - roi_x : 1;
+                roi_h = ey > (size_t) roi_y ? ey - roi_y : 1;
+            }
 
-                    //
-                    // rearrange the data to RGBRGBRGB…RGB
-                    //
-                    separateToContig(img, roi_w * ps); // convert to RGBRGBRGB...
-                }
+            unsigned int rsll; // length of a scanline of the region in bytes (of one plane, if planar separate)
+            try {
+                img->pixels = readRegion(img, tif, planar, roi_x, roi_y, roi_w, roi_h, rsll);
+            } catch (Sipi::SipiImageError &err) {
+                TIFFClose(tif);
+                throw Sipi::SipiImageError(__file__, __LINE__, err.to_string() + " in file " + filepath);
+            }
+            img->nx = roi_w;
+            img->ny = roi_h;
 
-                delete[] dataptr;
+            if (planar == PLANARCONFIG_SEPARATE) { // RRRRR…RRR GGGGG…GGGG BBBBB…BBB
+                //
+                // rearrange the data to RGBRGBRGB…RGB
+                //
+                separateToContig(img, rsll); // convert to RGBRGBRGB...
             }
 
             TIFFClose(tif);
@@ -810,7 +832,7 @@ namespace Sipi {
                 switch (img->photo) {
                     case MINISBLACK: {
                         if (img->bps == 1) {
-                            cvrt1BitTo8Bit(img, sll, 0, 255);
+                            cvrt1BitTo8Bit(img, rsll, 0, 255);
                         }
                         img->icc = std::make_shared<SipiIcc>(icc_GRAY_D50);
                         break;
@@ -818,7 +840,7 @@ namespace Sipi {
 
                     case MINISWHITE: {
                         if (img->bps == 1) {
-                            cvrt1BitTo8Bit(img, sll, 255, 0);
+                            cvrt1BitTo8Bit(img, rsll, 255, 0);
                         }
                         img->icc = std::make_shared<SipiIcc>(icc_GRAY_D50);
                         break;
@@ -880,14 +902,8 @@ namespace Sipi {
             //
             // resize/Scale the image if necessary
             //
-            if (size != NULL) {
-                size_t nnx, nny;
-                int reduce;
-                bool redonly;
-                SipiSize::SizeType rtype = size->get_size(img->nx, img->ny, nnx, nny, reduce, redonly);
-                if (rtype != SipiSize::FULL) {
-                    img->scale(nnx, nny);
-                }
+            if (do_size && ((img->nx != nnx) || (img->ny != nny))) {
+                img->scale(nnx, nny);
             }
 
             if (force_bps_8) {
@@ -960,13 +976,21 @@ namespace Sipi {
         TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (int) img->nx);
         TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (int) img->ny);
         TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, rowsperstrip));
+        if (pyramid) {
+            TIFFSetField(tif, TIFFTAG_TILEWIDTH, tile_size);
+            TIFFSetField(tif, TIFFTAG_TILELENGTH, tile_size);
+        } else {
+            TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, rowsperstrip));
+        }
         TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
         TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
         bool its_1_bit = false;
 
-        if ((img->photo == PhotometricInterpretation::MINISWHITE) ||
-            (img->photo == PhotometricInterpretation::MINISBLACK)) {
+        //
+        // pyramidal TIFFs are never written as 1 bit images, all levels have to have the same bits/sample
+        //
+        if (!pyramid && ((img->photo == PhotometricInterpretation::MINISWHITE) ||
+                         (img->photo == PhotometricInterpretation::MINISBLACK))) {
             its_1_bit = true;
 
             if (img->bps == 8) {
@@ -1127,8 +1151,69 @@ namespace Sipi {
             TIFFSetField(tif, TIFFTAG_SIPIMETA, emdata.c_str());
         }
 
+        //
+        // the reduced resolution levels of a pyramidal TIFF are written as SubIFDs, each one
+        // half the size of the previous one, down to the tile size
+        //
+        int n_levels = 0;
+
+        if (pyramid) {
+            size_t w = img->nx, h = img->ny;
+            while ((w > tile_size) || (h > tile_size)) {
+                w = (w + 1) / 2;
+                h = (h + 1) / 2;
+                n_levels++;
+            }
+            if (n_levels > 0) {
+                std::vector<toff_t> subifd_offsets(n_levels, 0); // filled in by libtiff
+                TIFFSetField(tif, TIFFTAG_SUBIFD, (uint16) n_levels, subifd_offsets.data());
+            }
+        }
+
         //TIFFCheckpointDirectory(tif);
-        if (its_1_bit) {
+        if (pyramid) {
+            size_t psize = img->nc * img->bps / 8;
+            try {
+                writeTiles(tif, img->pixels, img->nx, img->ny, psize, tile_size);
+                TIFFWriteDirectory(tif);
+
+                std::unique_ptr<byte[]> level_buf;
+                const byte *prev = img->pixels;
+                size_t w = img->nx, h = img->ny;
+
+                for (int l = 0; l < n_levels; l++) {
+                    if (img->bps == 16) {
+                        level_buf.reset((byte *) halveResolution<word>((const word *) prev, w, h, img->nc));
+                    } else {
+                        level_buf.reset(halveResolution<byte>(prev, w, h, img->nc));
+                    }
+                    prev = level_buf.get();
+                    w = (w + 1) / 2;
+                    h = (h + 1) / 2;
+
+                    TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+                    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (int) w);
+                    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (int) h);
+                    TIFFSetField(tif, TIFFTAG_TILEWIDTH, tile_size);
+                    TIFFSetField(tif, TIFFTAG_TILELENGTH, tile_size);
+                    TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+                    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+                    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16) img->bps);
+                    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, img->nc);
+                    if (img->es.size() > 0) {
+                        TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, img->es.size(), img->es.data());
+                    }
+                    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, img->photo);
+
+                    writeTiles(tif, prev, w, h, psize, tile_size);
+                    TIFFWriteDirectory(tif);
+                }
+            } catch (Sipi::SipiImageError &err) {
+                TIFFClose(tif);
+                if (memtif != nullptr) memTiffFree(memtif);
+                throw err;
+            }
+        } else if (its_1_bit) {
             unsigned int sll;
             unsigned char *buf = cvrt8BitTo1bit(*img, sll);
 
@@ -1147,7 +1232,7 @@ namespace Sipi {
         // write exif data
         //
         if (img->exif != nullptr) {
-            TIFFWriteDirectory(tif);
+            if (!pyramid) TIFFWriteDirectory(tif); // the directories of a pyramidal TIFF are already written
             writeExif(img, tif);
         }
 
@@ -1484,6 +1569,9 @@ namespace Sipi {
         if (count > 0) {
             uint64 exif_dir_offset = 0;
             TIFFWriteCustomDirectory(tif, &exif_dir_offset);
+            // Reads the main directory back, which is rewritten on TIFFClose with the offset of the EXIF
+            // directory. In a pyramidal TIFF, the levels are SubIFDs of directory 0, so it is still the full
+            // resolution image, and its SUBIFD tag keeps the offsets of the levels already written.
             TIFFSetDirectory(tif, 0);
             TIFFSetField(tif, TIFFTAG_EXIFIFD, exif_dir_offset);
         }
@@ -1492,6 +1580,171 @@ namespace Sipi {
     //============================================================================
 
 
+    int SipiIOTiff::selectPyramidLevel(TIFF *tif, SipiImage *img, int reduce) {
+        //
+        // returns the reduce factor of the current directory if it is a reduced resolution
+        // version of the full resolution image, 0 otherwise
+        //
+        auto level_of = [tif, img, reduce]() -> int {
+            uint32 lnx, lny;
+            uint16 lnc, lbps, lphoto;
+
+            if ((TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &lnx) == 0) ||
+                (TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &lny) == 0)) {
+                return 0;
+            }
+
+            TIFF_GET_FIELD (tif, TIFFTAG_SAMPLESPERPIXEL, &lnc, 1);
+            TIFF_GET_FIELD (tif, TIFFTAG_BITSPERSAMPLE, &lbps, 1);
+            TIFF_GET_FIELD (tif, TIFFTAG_PHOTOMETRIC, &lphoto, MINISBLACK);
+
+            if ((lnc != img->nc) || (lbps != img->bps) || (lphoto != img->photo)) return 0;
+
+            for (int k = reduce; k > 0; k--) {
+                size_t sf = (size_t) 1 << k;
+                bool w_ok = (lnx == (img->nx + sf - 1) / sf) || (lnx == img->nx / sf);
+                bool h_ok = (lny == (img->ny + sf - 1) / sf) || (lny == img->ny / sf);
+                if (w_ok && h_ok && (lnx > 0) && (lny > 0)) return k;
+            }
+
+            return 0;
+        };
+
+        int best_level = 0;
+        toff_t best_offset = 0;
+        tdir_t best_dir = 0;
+
+        //
+        // the offsets have to be copied, the array is invalidated if we change the directory
+        //
+        uint16 n_subifds;
+        toff_t *subifd_offsets;
+        std::vector<toff_t> subifds;
+
+        if (TIFFGetField(tif, TIFFTAG_SUBIFD, &n_subifds, &subifd_offsets) == 1) {
+            subifds.assign(subifd_offsets, subifd_offsets + n_subifds);
+        }
+
+        if (!subifds.empty()) {
+            for (auto offset : subifds) {
+                if (TIFFSetSubDirectory(tif, offset) == 0) continue;
+                int level = level_of();
+                if (level > best_level) {
+                    best_level = level;
+                    best_offset = offset;
+                }
+            }
+        } else {
+            while (TIFFReadDirectory(tif) == 1) {
+                uint32 subfiletype;
+                if ((TIFFGetField(tif, TIFFTAG_SUBFILETYPE, &subfiletype) == 1) &&
+                    ((subfiletype & FILETYPE_REDUCEDIMAGE) == 0)) {
+                    continue; // another page, but not a reduced resolution version of the first one
+                }
+                int level = level_of();
+                if (level > best_level) {
+                    best_level = level;
+                    best_dir = TIFFCurrentDirectory(tif);
+                }
+                if (best_level == reduce) break;
+            }
+        }
+
+        int ok;
+        if (best_level == 0) {
+            ok = TIFFSetDirectory(tif, 0);
+        } else if (best_offset != 0) {
+            ok = TIFFSetSubDirectory(tif, best_offset);
+        } else {
+            ok = TIFFSetDirectory(tif, best_dir);
+        }
+
+        if (ok == 0) {
+            throw Sipi::SipiImageError(__file__, __LINE__, "Could not set the directory of the pyramid level");
+        }
+
+        return best_level;
+    }
+    //============================================================================
+
+    unsigned char *SipiIOTiff::readRegion(SipiImage *img, TIFF *tif, unsigned short planar, int roi_x, int roi_y,
+                                          size_t roi_w, size_t roi_h, unsigned int &rsll) {
+        uint32 nplanes = (planar == PLANARCONFIG_SEPARATE) ? img->nc : 1;
+        uint32 spp = (planar == PLANARCONFIG_SEPARATE) ? 1 : img->nc; // samples per pixel within a plane
+        bool full_width = (roi_x == 0) && (roi_w == img->nx);
+
+        if (((img->bps % 8) != 0) && (!full_width || TIFFIsTiled(tif))) {
+            throw Sipi::SipiImageError(__file__, __LINE__,
+                                       "Regions of images with " + std::to_string(img->bps) + " bits/sample not supported");
+        }
+
+        //
+        // offset and length (in bytes) of the region within a scanline of a plane
+        //
+        size_t psize = spp * img->bps / 8; // pixel size in bytes (0 for bitonal images which are read full width)
+        size_t row_offs = full_width ? 0 : roi_x * psize;
+        size_t row_len = full_width ? (spp * img->bps * img->nx + 7) / 8 : roi_w * psize;
+        rsll = (unsigned int) row_len;
+
+        uint8 *outbuf = new uint8[nplanes * roi_h * row_len];
+
+        if (TIFFIsTiled(tif)) {
+            uint32 tw, th;
+            TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+            TIFFGetField(tif, TIFFTAG_TILELENGTH, &th);
+            size_t tile_row_len = (size_t) TIFFTileRowSize(tif);
+            auto tilebuf = shttps::make_unique<uint8[]>((size_t) TIFFTileSize(tif));
+
+            for (uint32 p = 0; p < nplanes; p++) {
+                for (uint32 ty = (roi_y / th) * th; ty < roi_y + roi_h; ty += th) {
+                    uint32 y0 = ty > (uint32) roi_y ? ty : roi_y;
+                    uint32 y1 = (ty + th) < (roi_y + roi_h) ? (ty + th) : (roi_y + roi_h);
+                    for (uint32 tx = (roi_x / tw) * tw; tx < roi_x + roi_w; tx += tw) {
+                        if (TIFFReadTile(tif, tilebuf.get(), tx, ty, 0, p) == -1) {
+                            delete[] outbuf;
+                            throw Sipi::SipiImageError(__file__, __LINE__,
+                                                       "TIFFReadTile failed on tile (" + std::to_string(tx) + ", " +
+                                                       std::to_string(ty) + ")");
+                        }
+                        uint32 x0 = tx > (uint32) roi_x ? tx : roi_x;
+                        uint32 x1 = (tx + tw) < (roi_x + roi_w) ? (tx + tw) : (roi_x + roi_w);
+                        for (uint32 y = y0; y < y1; y++) {
+                            memcpy(outbuf + (p * roi_h + (y - roi_y)) * row_len + (x0 - roi_x) * psize,
+                                   tilebuf.get() + (y - ty) * tile_row_len + (x0 - tx) * psize, (x1 - x0) * psize);
+                        }
+                    }
+                }
+            }
+        } else {
+            uint32 rps;
+            TIFF_GET_FIELD (tif, TIFFTAG_ROWSPERSTRIP, &rps, img->ny);
+            if (rps > img->ny) rps = img->ny;
+            size_t scanline_len = (size_t) TIFFScanlineSize(tif);
+            auto stripbuf = shttps::make_unique<uint8[]>((size_t) TIFFStripSize(tif));
+
+            for (uint32 p = 0; p < nplanes; p++) {
+                for (uint32 sy = (roi_y / rps) * rps; sy < roi_y + roi_h; sy += rps) {
+                    if (TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, sy, p), stripbuf.get(), (tmsize_t) -1) == -1) {
+                        delete[] outbuf;
+                        throw Sipi::SipiImageError(__file__, __LINE__,
+                                                   "TIFFReadEncodedStrip failed on strip at scanline " +
+                                                   std::to_string(sy));
+                    }
+                    uint32 y0 = sy > (uint32) roi_y ? sy : roi_y;
+                    uint32 y1 = (sy + rps) < (roi_y + roi_h) ? (sy + rps) : (roi_y + roi_h);
+                    for (uint32 y = y0; y < y1; y++) {
+                        memcpy(outbuf + (p * roi_h + (y - roi_y)) * row_len,
+                               stripbuf.get() + (y - sy) * scanline_len + row_offs, row_len);
+                    }
+                }
+            }
+        }
+
+        return outbuf;
+    }
+    //============================================================================
+
+
     void SipiIOTiff::separateToContig(SipiImage *img, unsigned int sll) {
         //
         // rearrange RRRRRR...GGGGG...BBBBB data  to RGBRGBRGB…RGB
@@ -1517,7 +1770,7 @@ namespace Sipi {
             for (unsigned int k = 0; k < img->nc; k++) {
                 for (unsigned int j = 0; j < img->ny; j++) {
                     for (unsigned int i = 0; i < img->nx; i++) {
-                        tmpptr[img->nc * (j * img->nx + i) + k] = dataptr[k * img->ny * sll + j * img->nx + i];
+                        tmpptr[img->nc * (j * img->nx + i) + k] = dataptr[k * img->ny * (sll / 2) + j * img->nx + i];
                     }
                 }
             }
@@ -23,6 +23,8 @@
 #include "SipiIcc.h"
 
 #include <time.h>
+#include <mutex>
+#include <unordered_map>
 
 static const char __file__[] = __FILE__;
 
@@ -33,9 +35,38 @@ static const char __file__[] = __FILE__;
 
 #include "SipiImage.h"
 #include "shttps/makeunique.h"
+#include "shttps/Hash.h"
 
 namespace Sipi {
 
+    //
+    // Creating a color transform (littleCMS optimizes it into lookup tables) costs much more than
+    // applying it to an image, while a server does the same few conversions over and over again.
+    // Transforms are therefore cached; the least recently used one is dropped if the cache is full.
+    // The caches are never destroyed, as worker threads may still use them while the process exits.
+    //
+    static const size_t max_cached_transforms = 64;
+
+    typedef struct {
+        std::shared_ptr<void> transform;
+        unsigned long last_used;
+    } CachedTransform;
+
+    typedef struct {
+        std::mutex lock;
+        std::unordered_map<std::string, CachedTransform> transforms;
+        unsigned long clock;
+    } TransformCache;
+
+    static TransformCache *transform_cache = new TransformCache();
+
+    typedef struct {
+        std::mutex lock;
+        std::unordered_map<int, SipiIcc *> profiles;
+    } PredefinedCache;
+
+    static PredefinedCache *predefined_cache = new PredefinedCache();
+
     void icc_error_logger(cmsContext ContextID, cmsUInt32Number ErrorCode, const char *Text) {
         std::cerr << "ICC-CMS-ERROR: " << Text << std::endl;
     }
@@ -74,6 +105,7 @@ namespace Sipi {
             }
 
             profile_type = icc_p.profile_type;
+            profile_id = icc_p.profile_id;
         }
         else {
             icc_profile = nullptr;
@@ -203,6 +235,7 @@ namespace Sipi {
                 }
             }
             profile_type = rhs.profile_type;
+            profile_id = rhs.profile_id;
         }
         return *this;
     }
@@ -218,6 +251,20 @@ namespace Sipi {
         return buf;
     }
 
+    const std::string &SipiIcc::profileId() const {
+        if (profile_id.empty() && (icc_profile != nullptr)) {
+            cmsUInt32Number len = 0;
+            if (!cmsSaveProfileToMem(icc_profile, nullptr, &len)) throw SipiError(__file__, __LINE__, "cmsSaveProfileToMem failed");
+            auto buf = shttps::make_unique<char[]>(len);
+            if (!cmsSaveProfileToMem(icc_profile, buf.get(), &len)) throw SipiError(__file__, __LINE__, "cmsSaveProfileToMem failed");
+
+            shttps::Hash checksum(shttps::HashType::md5);
+            if (!checksum.add_data(buf.get(), len)) throw SipiError(__file__, __LINE__, "Couldn't compute the MD5 of the ICC profile");
+            profile_id = checksum.hash();
+        }
+        return profile_id;
+    }
+
     cmsHPROFILE SipiIcc::getIccProfile()  const {
         return icc_profile;
     }
@@ -336,6 +383,54 @@ namespace Sipi {
         return format;
     }
 
+    const SipiIcc &SipiIcc::predefined(PredefinedProfiles predef) {
+        std::lock_guard<std::mutex> cache_guard(predefined_cache->lock);
+        SipiIcc *&profile = predefined_cache->profiles[(int) predef];
+        if (profile == nullptr) {
+            profile = new SipiIcc(predef);
+            profile->profileId(); // computed before the profile is shared
+        }
+        return *profile;
+    }
+
+    std::shared_ptr<void> SipiIcc::transform(const SipiIcc &from, unsigned int in_formatter, const SipiIcc &to,
+                                             unsigned int out_formatter, unsigned int intent) {
+        std::string key = from.profileId() + ":" + std::to_string(in_formatter) + ":" + to.profileId() + ":" +
+                          std::to_string(out_formatter) + ":" + std::to_string(intent);
+
+        std::lock_guard<std::mutex> cache_guard(transform_cache->lock);
+        auto cached = transform_cache->transforms.find(key);
+        if (cached != transform_cache->transforms.end()) {
+            cached->second.last_used = ++transform_cache->clock;
+            return cached->second.transform;
+        }
+
+        //
+        // the 1-pixel cache of littleCMS lives in the transform; without it, the transform
+        // can be shared by all threads
+        //
+        cmsSetLogErrorHandler(icc_error_logger);
+        cmsHTRANSFORM hTransform = cmsCreateTransform(from.getIccProfile(), in_formatter, to.getIccProfile(),
+                                                      out_formatter, intent, cmsFLAGS_NOCACHE);
+        if (hTransform == nullptr) {
+            return std::shared_ptr<void>();
+        }
+        std::shared_ptr<void> shared_transform(hTransform, cmsDeleteTransform);
+
+        if (transform_cache->transforms.size() >= max_cached_transforms) {
+            auto oldest = transform_cache->transforms.begin();
+            for (auto it = transform_cache->transforms.begin(); it != transform_cache->transforms.end(); ++it) {
+                if (it->second.last_used < oldest->second.last_used) oldest = it;
+            }
+            transform_cache->transforms.erase(oldest); // still alive while in use
+        }
+
+        CachedTransform &entry = transform_cache->transforms[key];
+        entry.transform = shared_transform;
+        entry.last_used = ++transform_cache->clock;
+        return shared_transform;
+    }
+
     std::ostream &operator<< (std::ostream &outstr, SipiIcc &rhs) {
         unsigned int len = cmsGetProfileInfoASCII(rhs.icc_profile, cmsInfoDescription, cmsNoLanguage, cmsNoCountry, nullptr, 0);
         auto buf = shttps::make_unique<char[]>(len);
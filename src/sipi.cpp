@@ -45,6 +45,8 @@
 #include "shttps/LuaSqlite.h"
 #include "SipiLua.h"
 #include "SipiImage.h"
+#include "formats/SipiIOJ2k.h"
+#include "SipiParallel.h"
 #include "SipiHttpServer.h"
 #include "SipiFilenameHash.h"
 #include "optionparser.h"
@@ -144,10 +146,30 @@ static void sipiConfGlobals(lua_State *L, shttps::Connection &conn, void *user_d
     lua_pushinteger(L, conf->getCacheNFiles());
     lua_rawset(L, -3); // table1
 
+    lua_pushstring(L, "preflight_ttl"); // table1 - "index_L1"
+    lua_pushinteger(L, conf->getPreflightTtl());
+    lua_rawset(L, -3); // table1
+
+    lua_pushstring(L, "preflight_negative_ttl"); // table1 - "index_L1"
+    lua_pushinteger(L, conf->getPreflightNegativeTtl());
+    lua_rawset(L, -3); // table1
+
     lua_pushstring(L, "n_threads"); // table1 - "index_L1"
     lua_pushinteger(L, conf->getNThreads());
     lua_rawset(L, -3); // table1
 
+    lua_pushstring(L, "jpx_threads"); // table1 - "index_L1"
+    lua_pushinteger(L, conf->getJpxThreads());
+    lua_rawset(L, -3); // table1
+
+    lua_pushstring(L, "image_threads"); // table1 - "index_L1"
+    lua_pushinteger(L, conf->getImageThreads());
+    lua_rawset(L, -3); // table1
+
+    lua_pushstring(L, "jpx_profile"); // table1 - "index_L1"
+    lua_pushstring(L, conf->getJpxProfile().c_str());
+    lua_rawset(L, -3); // table1
+
     lua_pushstring(L, "max_post_size"); // table1 - "index_L1"
     lua_pushinteger(L, conf->getMaxPostSize());
     lua_rawset(L, -3); // table1
@@ -189,6 +211,7 @@ enum optionIndex {
     CONFIGFILE,
     FILEIN,
     FORMAT,
+    JPXPROFILE,
     ICC,
     QUALITY,
     REGION,
@@ -215,7 +238,11 @@ option::ArgStatus SipiMultiChoice(const option::Option &option, bool msg) {
             std::string str(option.arg);
             switch (option.index()) {
                 case FORMAT:
-                    if (str == "jpx" || str == "jpg" || str == "tif" || str == "png") return option::ARG_OK;
+                    if (str == "jpx" || str == "jpg" || str == "tif" || str == "ptif" || str == "png") return option::ARG_OK;
+                    break;
+
+                case JPXPROFILE:
+                    if (str == "default" || str == "iiif") return option::ARG_OK;
                     break;
 
                 case ICC:
@@ -257,7 +284,8 @@ const option::Descriptor usage[] = {{UNKNOWN,    0, "",      "",           optio
                                                                                                           "Options:"},
                                     {CONFIGFILE, 0, "c",     "config",     option::Arg::NonEmpty, "  --config filename, -c filename  \tConfiguration file for web server.\n"},
                                     {FILEIN,     0, "f",     "file",       option::Arg::NonEmpty, "  --file fileIn, -f fileIn  \tinput file to be converted. Usage: sipi [options] -f fileIn fileout\n"},
-                                    {FORMAT,     0, "F",     "format",     SipiMultiChoice,       "  --format Value, -F Value  \tOutput format Value can be: jpx,jpg,tif,png.\n"},
+                                    {FORMAT,     0, "F",     "format",     SipiMultiChoice,       "  --format Value, -F Value  \tOutput format Value can be: jpx,jpg,tif,ptif (tiled pyramidal TIFF),png.\n"},
+                                    {JPXPROFILE, 0, "j",     "jpxprofile", SipiMultiChoice,       "  --jpxprofile Value, -j Value  \tCoding parameters for JPEG2000 output. Value can be: default,iiif (tiled, for fast region access).\n"},
                                     {ICC,        0, "I",     "ICC",        SipiMultiChoice,       "  --ICC Value, -I Value  \tConvert to ICC profile. Value can be: none,sRGB,AdobeRGB,GRAY.\n"},
                                     {QUALITY,    0, "q",     "quality",    option::Arg::NumericI, "  --quality Value, -q Value  \tQuality (compression). Value can any integer between 1 and 100\n"},
                                     {REGION,     0, "r",     "region",     option::Arg::NonEmpty, "  --region x,y,w,h, -r x,y,w,h  \tSelect region of interest, where x,y,w,h are integer values\n"},
@@ -525,9 +553,17 @@ int main(int argc, char *argv[]) {
                 server.cache(cachedir, cachesize, nfiles, hysteresis);
             }
 
+            if ((sipiConf.getPreflightTtl() > 0) || (sipiConf.getPreflightNegativeTtl() > 0)) {
+                server.preflight_cache(sipiConf.getPreflightTtl(), sipiConf.getPreflightNegativeTtl());
+            }
+
             server.imgroot(sipiConf.getImgRoot());
             server.initscript(sipiConf.getInitScript());
             server.keep_alive_timeout(sipiConf.getKeepAlive());
+            Sipi::SipiIOJ2k::setMaxReadThreads(sipiConf.getJpxThreads());
+            Sipi::RowBands::setMaxThreads(sipiConf.getImageThreads());
+            Sipi::SipiIOJ2k::setWriteProfile(sipiConf.getJpxProfile() == "iiif" ? Sipi::SipiIOJ2k::PROFILE_IIIF
+                                                                                : Sipi::SipiIOJ2k::PROFILE_DEFAULT);
 
             //
             // now we set the routes for the normal HTTP server file handling
@@ -737,7 +773,7 @@ int main(int argc, char *argv[]) {
             if (format == "jpg") {
                 img.to8bps();
                 //http://www.equasys.de/colorconversion.html
-                img.convertToIcc(Sipi::icc_sRGB, 8);
+                img.convertToIcc(Sipi::SipiIcc::predefined(Sipi::icc_sRGB), 8);
 
                 if (img.getNalpha() > 0) {
                     img.removeChan(static_cast<unsigned int>(img.getNc() - 1));
@@ -867,6 +903,12 @@ int main(int argc, char *argv[]) {
             }
         }
 
+        if (options[JPXPROFILE]) {
+            std::string jpxprofile(options[JPXPROFILE].arg);
+            Sipi::SipiIOJ2k::setWriteProfile(jpxprofile == "iiif" ? Sipi::SipiIOJ2k::PROFILE_IIIF
+                                                                  : Sipi::SipiIOJ2k::PROFILE_DEFAULT);
+        }
+
         try {
             img.write(format, outfname, quality);
         } catch (Sipi::SipiImageError &err) {
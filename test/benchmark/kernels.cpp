@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2016 Lukas Rosenthaler, Andrea Bianco, Benjamin Geer,
+ * Ivan Subotic, Tobias Schweizer, André Kilchenmann, and André Fatton.
+ * This file is part of Sipi.
+ * Sipi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * Sipi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * Additional permission under GNU AGPL version 3 section 7:
+ * If you modify this Program, or any covered work, by linking or combining
+ * it with Kakadu (or a modified version of that library) or Adobe ICC Color
+ * Profiles (or a modified version of that library) or both, containing parts
+ * covered by the terms of the Kakadu Software Licence or Adobe Software Licence,
+ * or both, the licensors of this Program grant you additional permission
+ * to convey the resulting work.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public
+ * License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// Measures the throughput of the resampling and rotation kernels on one thread, and of memcpy for
+// comparison. Build with -DMAKE_BENCHMARKS=ON and run "sipi_kernels [width height]". See
+// "Performance of the Image Kernels" in manual/developing.rst.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "SipiResample.h"
+#include "SipiRotate.h"
+#include "SipiParallel.h"
+
+using namespace Sipi;
+
+/*!
+ * Returns the shortest time of several runs of a function in seconds
+ */
+static double best_time(const std::function<void()> &func) {
+    double best = 1e9;
+
+    for (int i = 0; i < 7; i++) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (t < best) best = t;
+    }
+
+    return best;
+}
+//============================================================================
+
+static void report(const char *name, double mpixels, double t) {
+    printf("%-28s %8.1f Mpixel/s\n", name, mpixels / t);
+}
+//============================================================================
+
+int main(int argc, char *argv[]) {
+    size_t nx = 4000, ny = 3000;
+    const size_t nc = 3;
+
+    if (argc == 3) {
+        nx = (size_t) atol(argv[1]);
+        ny = (size_t) atol(argv[2]);
+    }
+
+    RowBands::setMaxThreads(1);
+
+    std::vector<unsigned char> in(nx * ny * nc);
+    std::vector<unsigned char> out(nx * ny * nc);
+    std::mt19937 rng(1);
+    for (auto &v : in) v = (unsigned char) rng();
+
+    const double mpixels = (double) (nx * ny) / 1e6;
+    printf("%zux%zu RGB, 8 bit, 1 thread\n", nx, ny);
+
+    report("memcpy", mpixels, best_time([&]() {
+        memcpy(out.data(), in.data(), in.size());
+    }));
+
+    // the throughput of resampling is given for the larger of the input and output image
+    report("resample 1/4, bilinear", mpixels, best_time([&]() {
+        resample(in.data(), nx, ny, nc, out.data(), nx / 4, ny / 4, RESAMPLE_BILINEAR);
+    }));
+    report("resample 1/4, lanczos3", mpixels, best_time([&]() {
+        resample(in.data(), nx, ny, nc, out.data(), nx / 4, ny / 4, RESAMPLE_LANCZOS3);
+    }));
+    report("resample 2x, bilinear", mpixels, best_time([&]() {
+        resample(in.data(), nx / 2, ny / 2, nc, out.data(), nx, ny, RESAMPLE_BILINEAR);
+    }));
+
+    unsigned char *buf = new unsigned char[nx * ny * nc];
+    memcpy(buf, in.data(), in.size());
+    size_t bx = nx, by = ny;
+
+    report("rotate 90", mpixels, best_time([&]() {
+        rotate_orthogonal(buf, bx, by, nc, 90, false);
+    }));
+    report("rotate 180", mpixels, best_time([&]() {
+        rotate_orthogonal(buf, bx, by, nc, 180, false);
+    }));
+    delete[] buf;
+
+    size_t nnx, nny;
+    rotated_size(nx, ny, 30., nnx, nny);
+    std::vector<unsigned char> rotated(nnx * nny * nc);
+    report("rotate 30 (output pixels)", (double) (nnx * nny) / 1e6, best_time([&]() {
+        rotate_affine(in.data(), nx, ny, nc, rotated.data(), nnx, nny, 30.);
+    }));
+
+    return 0;
+}
@@ -33,6 +33,30 @@ import filecmp
 import shutil
 import psutil
 import re
+import socket
+import struct
+import zlib
+
+
+def pytest_addoption(parser):
+    parser.addoption("--benchmark", action="store_true", help="also run the benchmarks, which take long and write large files")
+
+
+def pytest_configure(config):
+    config.addinivalue_line("markers", "benchmark: a benchmark, only run with --benchmark")
+
+
+def pytest_collection_modifyitems(config, items):
+    """Skips the benchmarks unless --benchmark is given."""
+
+    if config.getoption("--benchmark"):
+        return
+
+    skip_benchmark = pytest.mark.skip(reason="benchmarks are only run with --benchmark")
+
+    for item in items:
+        if "benchmark" in item.keywords:
+            item.add_marker(skip_benchmark)
 
 
 @pytest.fixture(scope="session")
@@ -58,20 +82,19 @@ class SipiTestManager:
 
         self.sipi_working_dir = os.path.abspath("..")
 
-        # Ensure Sipi doesn't use caching in tests.
-        sipi_cache_dir = os.path.join(self.sipi_working_dir, "cache")
-        try:
-            shutil.rmtree(sipi_cache_dir)
-        except OSError:
-            pass
+        # Start with an empty cache.
+        self.sipi_cache_dir = os.path.join(self.sipi_working_dir, "cache")
+        self.clear_cache_dir()
 
         sipi_config = self.config["Sipi"]
         self.sipi_config_file = sipi_config["config-file"]
-        self.sipi_command = "build/sipi --config config/{}".format(self.sipi_config_file)
+        self.sipi_command = "build/sipi --config config/{}"
         self.data_dir = os.path.abspath(self.config["Test"]["data-dir"])
         self.sipi_port = sipi_config["port"]
         self.iiif_validator_prefix = sipi_config["iiif-validator-prefix"]
         self.sipi_base_url = "http://localhost:{}".format(self.sipi_port)
+        self.sipi_ssl_port = sipi_config["ssl-port"]
+        self.sipi_ssl_base_url = "https://localhost:{}".format(self.sipi_ssl_port)
         self.sipi_ready_output = sipi_config["ready-output"]
         self.sipi_start_wait = int(sipi_config["start-wait"])
         self.sipi_stop_wait = int(sipi_config["stop-wait"])
@@ -89,11 +112,28 @@ class SipiTestManager:
         self.iiif_validator_command = "iiif-validate.py -s localhost:{} -p {} -i 67352ccc-d1b0-11e1-89ae-279075081939.jp2 --version=2.0 -v".format(self.sipi_port, self.iiif_validator_prefix)
 
         self.compare_command = "compare -metric {} {} {} null:"
+        self.write_raw_command = "convert -size {}x{} -depth 8 rgb:{} -strip {} {}"
+        self.read_raw_command = "convert {} -depth 8 rgb:-"
+        self.size_command = "identify -format \"%w %h\" {}"
         self.compare_out_re = re.compile(r"^(\d+) \(([0-9.]+)\).*$")
         self.info_command = "identify -verbose {}"
 
-    def start_sipi(self):
-        """Starts Sipi and waits until it is ready to receive requests."""
+    def clear_cache_dir(self):
+        """Removes all files from Sipi's cache directory (while Sipi is not running)."""
+
+        try:
+            shutil.rmtree(self.sipi_cache_dir)
+        except OSError:
+            pass
+
+        os.makedirs(self.sipi_cache_dir)
+
+    def start_sipi(self, config_file=None):
+        """
+            Starts Sipi and waits until it is ready to receive requests.
+
+            config_file: the name of a file in the config directory to use instead of the configured one.
+        """
 
         def check_for_ready_output(line):
             if self.sipi_ready_output in line:
@@ -119,7 +159,7 @@ class SipiTestManager:
             pass
 
         # Start a Sipi process and capture its output.
-        sipi_args = shlex.split(self.sipi_command)
+        sipi_args = shlex.split(self.sipi_command.format(config_file or self.sipi_config_file))
         sipi_start_time = time.time()
         self.sipi_process = subprocess.Popen(sipi_args,
             cwd=self.sipi_working_dir,
@@ -194,6 +234,20 @@ class SipiTestManager:
 
         return "{}{}".format(self.sipi_base_url, url_path)
 
+    def make_sipi_ssl_url(self, url_path):
+        """
+        Makes a URL for a request to Sipi over a secure connection. Returns None if Sipi does not accept secure
+        connections (it is not compiled with SSL support).
+
+        url_path: a path that will be appended to the Sipi base URL for secure connections to make the request.
+        """
+
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as ssl_socket:
+            if ssl_socket.connect_ex(("localhost", int(self.sipi_ssl_port))) != 0:
+                return None
+
+        return "{}{}".format(self.sipi_ssl_base_url, url_path)
+
     def download_file(self, url_path, suffix=None, headers=None):
         """
             Makes an HTTP request to Sipi and downloads the response content to a temporary file.
@@ -259,22 +313,34 @@ class SipiTestManager:
         """
 
         downloaded_file_path = self.download_file(url_path, headers=headers)
-        info_process_args = shlex.split(self.info_command.format(downloaded_file_path))
+        return self.get_file_info(downloaded_file_path)
+
+    def get_file_info(self, file_path):
+        """
+            Gets information about an image file using ImageMagick's 'identify' program with the '-verbose' option,
+            and returns the resulting output.
+
+            file_path: the absolute path of the image file.
+        """
+
+        info_process_args = shlex.split(self.info_command.format(file_path))
         info_process = subprocess.run(info_process_args,
             stdout=subprocess.PIPE,
             stderr=subprocess.STDOUT,
             universal_newlines = True)
         return info_process.stdout
 
-    def sipi_convert(self, source_file_path, target_file_path, target_file_format):
+    def sipi_convert(self, source_file_path, target_file_path, target_file_format, options=""):
         """
             Runs Sipi on the command line to convert an image from one format to another.
 
             source_file_path: the absolute path of the source file.
             target_file_path: the absolute path of the target file.
-            target_file_format: jpx, jpg, tif, or png.
+            target_file_format: jpx, jpg, tif, ptif, or png.
+            options: additional command-line options, e.g. "--region 0,0,100,100".
         """
         convert_process_args = shlex.split(self.sipi_convert_command.format(source_file_path, target_file_format, target_file_path))
+        convert_process_args[-1:-1] = shlex.split(options)
         convert_process = subprocess.run(convert_process_args,
             cwd=self.sipi_working_dir,
             stdout=subprocess.PIPE,
@@ -305,6 +371,92 @@ class SipiTestManager:
         assert compare_out_regex_match != None, "Couldn't parse comparison result: {}".format(compare_out_str)
         return int(compare_out_regex_match.group(1))
 
+    def write_rgb_image(self, file_path, width, height, pixels, options=""):
+        """
+            Writes an 8 bit RGB image using ImageMagick's 'convert' program. The format is given by the file extension.
+
+            file_path: the absolute path of the image file.
+            width: the width of the image.
+            height: the height of the image.
+            pixels: a bytes object with the samples of the pixels, row by row.
+            options: additional options for 'convert', e.g. "-depth 16" or "-define tiff:tile-geometry=64x64".
+        """
+
+        assert len(pixels) == width * height * 3
+        temp_fd, raw_file_path = tempfile.mkstemp(suffix=".rgb")
+
+        with os.fdopen(temp_fd, mode="wb") as raw_file:
+            raw_file.write(pixels)
+
+        convert_process = subprocess.run(shlex.split(self.write_raw_command.format(width, height, raw_file_path, options, file_path)),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+            universal_newlines = True)
+        os.remove(raw_file_path)
+
+        if convert_process.returncode != 0:
+            raise SipiTestError("Couldn't write {}:\n{}".format(file_path, convert_process.stdout))
+
+    def read_rgb_image(self, file_path):
+        """
+            Reads an image using ImageMagick's 'convert' program. Returns a tuple (width, height, pixels), where pixels
+            is a bytes object with the 8 bit RGB samples of the pixels, row by row.
+
+            file_path: the absolute path of the image file.
+        """
+
+        size_process = subprocess.run(shlex.split(self.size_command.format(file_path)),
+            stdout=subprocess.PIPE,
+            universal_newlines = True)
+        width, height = [int(value) for value in size_process.stdout.split()]
+
+        convert_process = subprocess.run(shlex.split(self.read_raw_command.format(file_path)),
+            stdout=subprocess.PIPE)
+
+        if convert_process.returncode != 0 or len(convert_process.stdout) != width * height * 3:
+            raise SipiTestError("Couldn't read {}".format(file_path))
+
+        return width, height, convert_process.stdout
+
+    def read_cache_journal(self):
+        """
+            Reads the journal of Sipi's cache like the server does on startup. Returns a list of tuples (type, canonical)
+            of the valid records, where type is "A" (added) or "R" (removed). A torn record ends the journal.
+        """
+
+        records = []
+
+        with open(os.path.join(self.sipi_cache_dir, ".sipicache.journal"), mode="rb") as journal_file:
+            journal = journal_file.read()
+
+        if journal[0:8] != b"SIPIJRN1":
+            raise SipiTestError("Unknown format of the cache journal")
+
+        pos = 8
+
+        while pos + 8 <= len(journal):
+            length, crc = struct.unpack_from("=II", journal, pos)
+            record = journal[pos + 8:pos + 8 + length]
+
+            if len(record) != length or length < 5 or zlib.crc32(record) != crc:
+                break
+
+            canonical_length = struct.unpack_from("=I", record, 1)[0]
+            records.append((record[0:1].decode(), record[5:5 + canonical_length].decode()))
+            pos += 8 + length
+
+        return records
+
+    def count_knora_requests(self, identifier):
+        """
+            Returns the number of requests for the permissions of an image which the fake Knora (nginx) has received.
+
+            identifier: the IIIF identifier of the image.
+        """
+
+        with open(os.path.join(self.nginx_working_dir, "logs", "access.log")) as log_file:
+            return sum(1 for line in log_file if "\"GET /v1/files/{} ".format(identifier) in line)
+
     def data_dir_path(self, relative_path):
         """
             Converts a path relative to data-dir into an absolute path.
@@ -22,6 +22,9 @@
 import pytest
 import tempfile
 import os
+import time
+import random
+import math
 
 # Tests file conversions.
 
@@ -85,3 +88,318 @@ class TestConversions:
                 bad_result = True
 
         assert not bad_result, results
+
+    def test_tiff_regions(self, manager):
+        """read regions crossing tile and strip boundaries from TIFF images and compare them with a crop of the full image"""
+
+        tempdir = tempfile.mkdtemp()
+        rng = random.Random(3)
+        width = 200
+        height = 150
+        pixels = bytes(rng.randrange(256) for _ in range(width * height * 3))
+
+        def crop(image_pixels, x, y, w, h):
+            return b"".join(image_pixels[((y + row) * width + x) * 3:((y + row) * width + x + w) * 3] for row in range(h))
+
+        layouts = {
+            "tiled": "-define tiff:tile-geometry=64x64",
+            "striped": "-define tiff:rows-per-strip=16",
+            "tiled_16bit": "-depth 16 -define tiff:tile-geometry=64x64",
+            "striped_16bit": "-depth 16 -define tiff:rows-per-strip=16",
+            "separate_16bit": "-depth 16 -interlace plane -define tiff:rows-per-strip=16"
+        }
+
+        # A region within one tile, regions crossing several tile and strip boundaries, and one ending in the
+        # partial tiles and strips at the right and bottom border.
+        regions = [(5, 5, 20, 10), (50, 40, 100, 90), (60, 10, 10, 120), (130, 100, 70, 50)]
+
+        for layout, options in layouts.items():
+            source_tif = os.path.join(tempdir, "{}.tif".format(layout))
+            manager.write_rgb_image(source_tif, width, height, pixels, options)
+
+            full_tif = os.path.join(tempdir, "{}_full.tif".format(layout))
+            manager.sipi_convert(source_tif, full_tif, "tif")
+            full_pixels = manager.read_rgb_image(full_tif)
+            assert full_pixels == (width, height, pixels), "full {} image differs from the original".format(layout)
+
+            for x, y, w, h in regions:
+                region_tif = os.path.join(tempdir, "{}_{}_{}_{}_{}.tif".format(layout, x, y, w, h))
+                manager.sipi_convert(source_tif, region_tif, "tif", "--region {},{},{},{}".format(x, y, w, h))
+                assert manager.read_rgb_image(region_tif) == (w, h, crop(full_pixels[2], x, y, w, h)), "region {},{},{},{} of {} image differs from the crop of the full image".format(x, y, w, h, layout)
+
+    def test_pyramidal_tiff_round_trip(self, manager):
+        """convert ISO/IEC 15444-4 reference TIFF images to pyramidal TIFF and back"""
+
+        results = "\n"
+        bad_result = False
+        tempdir = tempfile.mkdtemp()
+
+        for i in [1, 4]:
+            reference_tif = manager.data_dir_path(self.reference_tif_tmpl.format(i))
+            sipi_ptif = os.path.join(tempdir, "sipi_ptif_{}.tif".format(i))
+            sipi_tif = os.path.join(tempdir, self.sipi_tif_tmpl.format(i))
+
+            manager.sipi_convert(reference_tif, sipi_ptif, "ptif")
+            manager.sipi_convert(sipi_ptif, sipi_tif, "tif")
+            pae = manager.compare_images(sipi_tif, reference_tif, "PAE")
+
+            results += "Image {}: Converted TIFF -> pyramidal TIFF -> TIFF\n    Reference TIFF: {}\n    Sipi pyramidal TIFF: {}\n    Sipi TIFF: {}\n    PAE (Sipi TIFF compared to reference TIFF): {}\n\n".format(i, reference_tif, sipi_ptif, sipi_tif, pae)
+
+            if pae > 0:
+                bad_result = True
+
+        assert not bad_result, results
+
+    def test_pyramidal_tiff_reduced_region(self, manager):
+        """read reduced regions from the levels of pyramidal TIFF images, with and without EXIF data"""
+
+        tempdir = tempfile.mkdtemp()
+
+        # Crops the region (x, y, w, h) from an image and halves its resolution level times, like the levels of a
+        # pyramidal TIFF are computed: each pixel is the rounded mean of a 2x2 block, repeating the last row and
+        # column of an odd sized image. The region must start at a multiple of 2 ** level and end at such a
+        # multiple or at the border of the image.
+        def reduce_region(image_pixels, image_width, x, y, w, h, level):
+            region = [image_pixels[((y + row) * image_width + x) * 3:((y + row) * image_width + x + w) * 3] for row in range(h)]
+
+            for _ in range(level):
+                new_w = (w + 1) // 2
+                new_h = (h + 1) // 2
+                halved = []
+
+                for row in range(new_h):
+                    row0 = region[2 * row]
+                    row1 = region[min(2 * row + 1, h - 1)]
+                    halved_row = bytearray(new_w * 3)
+
+                    for col in range(new_w):
+                        col0 = 2 * col * 3
+                        col1 = min(2 * col + 1, w - 1) * 3
+
+                        for c in range(3):
+                            halved_row[col * 3 + c] = (row0[col0 + c] + row0[col1 + c] + row1[col0 + c] + row1[col1 + c] + 2) // 4
+
+                    halved.append(bytes(halved_row))
+
+                region, w, h = halved, new_w, new_h
+
+            return w, h, b"".join(region)
+
+        # A random image with odd dimensions, and regions in the interior and at the right and bottom border,
+        # read from the levels 2 and 1.
+        rng = random.Random(4)
+        width = 1001
+        height = 701
+        pixels = bytes(rng.randrange(256) for _ in range(width * height * 3))
+        source_png = os.path.join(tempdir, "source.png")
+        manager.write_rgb_image(source_png, width, height, pixels)
+        source_ptif = os.path.join(tempdir, "source_ptif.tif")
+        manager.sipi_convert(source_png, source_ptif, "ptif")
+
+        for x, y, w, h, size, level in [(200, 100, 400, 320, "100,", 2), (600, 400, 401, 301, "201,", 1)]:
+            region_tif = os.path.join(tempdir, "region_{}_{}.tif".format(x, y))
+            manager.sipi_convert(source_ptif, region_tif, "tif", "--region {},{},{},{} --size {}".format(x, y, w, h, size))
+            assert manager.read_rgb_image(region_tif) == reduce_region(pixels, width, x, y, w, h, level), "reduced region {},{},{},{} differs from level {} of the pyramid".format(x, y, w, h, level)
+
+        # An image with EXIF data: the EXIF directory is written after the pyramid, and the first directory is
+        # rewritten to point to it. The full image and the levels must still be found.
+        leaves_jpg = manager.data_dir_path("knora/Leaves.jpg")
+        leaves_tif = os.path.join(tempdir, "leaves.tif")
+        leaves_ptif = os.path.join(tempdir, "leaves_ptif.tif")
+        leaves_full_tif = os.path.join(tempdir, "leaves_full.tif")
+        manager.sipi_convert(leaves_jpg, leaves_tif, "tif")
+        manager.sipi_convert(leaves_jpg, leaves_ptif, "ptif")
+        manager.sipi_convert(leaves_ptif, leaves_full_tif, "tif")
+
+        assert "exif:" in manager.get_file_info(leaves_ptif), "pyramidal TIFF has no EXIF data"
+        leaves_width, leaves_height, leaves_pixels = manager.read_rgb_image(leaves_tif)
+        assert manager.read_rgb_image(leaves_full_tif) == (leaves_width, leaves_height, leaves_pixels), "full image of pyramidal TIFF with EXIF data differs from the original"
+
+        leaves_region_tif = os.path.join(tempdir, "leaves_region.tif")
+        manager.sipi_convert(leaves_ptif, leaves_region_tif, "tif", "--region 1000,800,512,512 --size 128,")
+        assert manager.read_rgb_image(leaves_region_tif) == reduce_region(leaves_pixels, leaves_width, 1000, 800, 512, 512, 2), "reduced region of pyramidal TIFF with EXIF data differs from level 2 of the pyramid"
+
+    def test_jpx_iiif_profile(self, manager):
+        """write JPEG2000 images with the default and the IIIF profile and compare region decoding"""
+
+        results = "\n"
+        bad_result = False
+        tempdir = tempfile.mkdtemp()
+        region_options = "--region 100,100,256,256"
+
+        for i in [1, 4]:
+            reference_tif = manager.data_dir_path(self.reference_tif_tmpl.format(i))
+            decode_times = {}
+            region_tifs = {}
+
+            for profile in ["default", "iiif"]:
+                sipi_jp2 = os.path.join(tempdir, "sipi_{}_{}.jp2".format(profile, i))
+                region_tifs[profile] = os.path.join(tempdir, "sipi_{}_region_{}.tif".format(profile, i))
+                manager.sipi_convert(reference_tif, sipi_jp2, "jpx", "--jpxprofile " + profile)
+
+                start = time.perf_counter()
+                manager.sipi_convert(sipi_jp2, region_tifs[profile], "tif", region_options)
+                decode_times[profile] = time.perf_counter() - start
+
+            pae = manager.compare_images(region_tifs["default"], region_tifs["iiif"], "PAE")
+
+            results += "Image {}: Region of JP2 written with default and IIIF profile\n    Decode time (default): {:.3f}s\n    Decode time (iiif): {:.3f}s\n    PAE (default region compared to iiif region): {}\n\n".format(i, decode_times["default"], decode_times["iiif"], pae)
+
+            if pae > 0:
+                bad_result = True
+
+        print(results)
+        assert not bad_result, results
+
+    def test_scale_gradient(self, manager):
+        """scale a horizontal gray gradient and check the interpolated values"""
+
+        tempdir = tempfile.mkdtemp()
+        width = 256
+        height = 4
+        gradient_png = os.path.join(tempdir, "gradient.png")
+        manager.write_rgb_image(gradient_png, width, height, bytes(x for _ in range(height) for x in range(width) for _ in range(3)))
+
+        # Pixel centers are mapped onto each other, so output pixel i covers the source positions around
+        # (i + 0.5) * width / new_width - 0.5. The two pixels at each border are influenced by the edge
+        # handling and are not checked.
+        for new_width, expected_value in [(128, lambda i: 2 * i + 0.5), (512, lambda i: i / 2 - 0.25)]:
+            scaled_png = os.path.join(tempdir, "gradient_{}.png".format(new_width))
+            manager.sipi_convert(gradient_png, scaled_png, "png", "--size {},{}".format(new_width, height))
+            scaled_width, scaled_height, pixels = manager.read_rgb_image(scaled_png)
+            assert (scaled_width, scaled_height) == (new_width, height)
+
+            for y in range(height):
+                for x in range(2, new_width - 2):
+                    value = pixels[(y * new_width + x) * 3]
+                    assert abs(value - expected_value(x)) <= 1, "pixel ({}, {}) of {} px wide image is {}, expected {}".format(x, y, new_width, value, expected_value(x))
+
+    def test_orthogonal_identities(self, manager):
+        """rotate and mirror an image back to its original orientation"""
+
+        tempdir = tempfile.mkdtemp()
+        rng = random.Random(11)
+        width = 48
+        height = 31
+        original_pixels = bytes(rng.randrange(256) for _ in range(width * height * 3))
+        original_png = os.path.join(tempdir, "original.png")
+        manager.write_rgb_image(original_png, width, height, original_pixels)
+
+        identities = [
+            ["--rotate 90"] * 4,
+            ["--rotate 180"] * 2,
+            ["--rotate 90", "--rotate 270"],
+            ["--mirror horizontal"] * 2,
+            ["--mirror vertical"] * 2,
+            ["--mirror horizontal --rotate 90"] * 2,
+            ["--mirror horizontal", "--mirror vertical", "--rotate 180"]
+        ]
+
+        for identity in identities:
+            source_png = original_png
+
+            for step, options in enumerate(identity):
+                target_png = os.path.join(tempdir, "step_{}.png".format(step))
+                manager.sipi_convert(source_png, target_png, "png", options)
+                source_png = target_png
+
+            assert manager.read_rgb_image(source_png) == (width, height, original_pixels), "{} did not restore the original image".format(" then ".join(identity))
+
+    def test_orthogonal_rotation(self, manager):
+        """rotate and mirror images whose sizes are not a multiple of the tile size by multiples of 90 degrees"""
+
+        tempdir = tempfile.mkdtemp()
+        rng = random.Random(13)
+
+        # Returns the source coordinates of the output pixel (x, y), for a source image of the given size that is
+        # mirrored horizontally (if requested) and then rotated clockwise.
+        def source_pixel(x, y, width, height, angle, mirror):
+            if angle == 90:
+                sx, sy = y, height - 1 - x
+            elif angle == 180:
+                sx, sy = width - 1 - x, height - 1 - y
+            elif angle == 270:
+                sx, sy = width - 1 - y, x
+            else:
+                sx, sy = x, y
+
+            return (width - 1 - sx if mirror else sx), sy
+
+        for width, height in [(130, 67), (65, 129), (1, 5)]:
+            pixels = bytes(rng.randrange(256) for _ in range(width * height * 3))
+            source_png = os.path.join(tempdir, "source_{}x{}.png".format(width, height))
+            manager.write_rgb_image(source_png, width, height, pixels)
+
+            for angle in [0, 90, 180, 270]:
+                for mirror in [False, True]:
+                    rotated_png = os.path.join(tempdir, "rotated_{}x{}_{}_{}.png".format(width, height, angle, mirror))
+                    options = "--rotate {}".format(angle) + (" --mirror horizontal" if mirror else "")
+                    manager.sipi_convert(source_png, rotated_png, "png", options)
+
+                    new_width, new_height = (height, width) if angle in [90, 270] else (width, height)
+                    expected = bytearray()
+
+                    for y in range(new_height):
+                        for x in range(new_width):
+                            sx, sy = source_pixel(x, y, width, height, angle, mirror)
+                            expected += pixels[(sy * width + sx) * 3:(sy * width + sx + 1) * 3]
+
+                    assert manager.read_rgb_image(rotated_png) == (new_width, new_height, bytes(expected)), "{}x{} image with {} differs from reference".format(width, height, options)
+
+    def test_affine_rotation(self, manager):
+        """rotate images by arbitrary angles and compare them with a bilinear reference"""
+
+        tempdir = tempfile.mkdtemp()
+        rng = random.Random(14)
+        width = 61
+        height = 40
+        pixels = bytes(rng.randrange(256) for _ in range(width * height * 3))
+        source_png = os.path.join(tempdir, "source.png")
+        manager.write_rgb_image(source_png, width, height, pixels)
+
+        for angle in [30, 135, 200.5, 333]:
+            rotated_png = os.path.join(tempdir, "rotated_{}.png".format(angle))
+            manager.sipi_convert(source_png, rotated_png, "png", "--rotate {}".format(angle))
+            new_width, new_height, rotated_pixels = manager.read_rgb_image(rotated_png)
+
+            phi = math.radians(angle)
+            assert new_width == math.floor(width * abs(math.cos(phi)) + height * abs(math.sin(phi)) + 0.5)
+            assert new_height == math.floor(width * abs(math.sin(phi)) + height * abs(math.cos(phi)) + 0.5)
+
+            # Every output pixel is mapped back to the source around the centers of both images. Pixels whose
+            # source position is outside the image (the bilinear interpolation needs a right and lower neighbour)
+            # are black. Positions too close to that border to decide in floating point are skipped.
+            si = math.sin(-phi)
+            co = math.cos(-phi)
+            center_x = width / 2 - 0.5
+            center_y = height / 2 - 0.5
+            new_center_x = new_width / 2 - 0.5
+            new_center_y = new_height / 2 - 0.5
+            max_error = 0
+            checked = 0
+
+            for y in range(new_height):
+                for x in range(new_width):
+                    rx = (x - new_center_x) * co - (y - new_center_y) * si + center_x
+                    ry = (x - new_center_x) * si + (y - new_center_y) * co + center_y
+
+                    if min(abs(rx), abs(rx - (width - 1)), abs(ry), abs(ry - (height - 1))) < 1e-6:
+                        continue
+
+                    for c in range(3):
+                        if 0 <= rx < width - 1 and 0 <= ry < height - 1:
+                            x0 = int(rx)
+                            y0 = int(ry)
+                            wx = rx - x0
+                            wy = ry - y0
+                            value = lambda sx, sy: pixels[(sy * width + sx) * 3 + c]
+                            expected = ((1 - wx) * (1 - wy) * value(x0, y0) + wx * (1 - wy) * value(x0 + 1, y0) +
+                                        (1 - wx) * wy * value(x0, y0 + 1) + wx * wy * value(x0 + 1, y0 + 1))
+                        else:
+                            expected = 0
+
+                        max_error = max(max_error, abs(rotated_pixels[(y * new_width + x) * 3 + c] - expected))
+                        checked += 1
+
+            assert checked > new_width * new_height * 3 // 2
+            assert max_error <= 1, "image rotated by {} degrees differs from reference by {}".format(angle, max_error)
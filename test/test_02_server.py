@@ -19,7 +19,15 @@
 # You should have received a copy of the GNU Affero General Public
 # License along with Sipi.  If not, see <http://www.gnu.org/licenses/>.
 
+import hashlib
+import multiprocessing
+import os
+import time
 import pytest
+import requests
+import socket
+import struct
+from concurrent.futures import ThreadPoolExecutor
 
 # Tests basic functionality of the Sipi server.
 
@@ -38,6 +46,28 @@ class TestServer:
         """call C++ functions from Lua scripts"""
         manager.expect_status_code("/test_functions", 200)
 
+    def test_lua_globals_reset(self, manager):
+        """undo the changes a request made to the global state of the reused Lua interpreters"""
+        # the script reports the state it finds, then changes it; the interpreter is reused for the next request
+        url = manager.make_sipi_url("/test_lua_globals")
+        first = requests.get(url).json()
+        assert first["pre_flight"] == "function"
+        assert first["string_marker"] == "nil"
+        assert first["new_global"] == "nil"
+        assert first["config_metatable"] == "false"
+
+        for i in range(8):
+            assert requests.get(url).json() == first
+
+    def test_lua_http_client(self, manager):
+        """send POST, PUT and concurrent requests from Lua scripts, with a timeout for a server that never answers"""
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as silent_socket:
+            silent_socket.bind(("localhost", 0))
+            silent_socket.listen(4)
+            start = time.time()
+            manager.expect_status_code("/test_http_client?silent_port={}".format(silent_socket.getsockname()[1]), 200)
+            assert time.time() - start < 5
+
     def test_knora_session_parsing(self, manager):
         """call Lua function that gets the Knora session id from the cookie header sent to Sipi"""
         manager.expect_status_code("/test_knora_session_cookie", 200)
@@ -61,3 +91,479 @@ class TestServer:
         response_json = manager.post_file("/make_thumbnail", manager.data_dir_path("knora/Leaves.jpg"), "image/jpeg")
         filename = response_json["filename"]
         manager.expect_status_code("/thumbs/{}.jpg/full/full/0/default.jpg".format(filename), 200)
+
+    def test_concurrent_jpeg_decoding(self, manager):
+        """decode the same JPEG file in several concurrent requests"""
+        sizes = ["{},".format(width) for width in range(100, 420, 20)]
+
+        def get_scaled(size):
+            manager.expect_status_code("/knora/Leaves.jpg/full/{}/0/default.jpg".format(size), 200)
+
+        with ThreadPoolExecutor(max_workers=8) as executor:
+            list(executor.map(get_scaled, sizes))
+
+    def test_jpeg_region_decoding(self, manager):
+        """decode regions of a JPEG file at full and reduced size like a full decode followed by cropping"""
+        full_width, full_height, full_pixels = manager.read_rgb_image(manager.download_file("/knora/Leaves.jpg/full/full/0/default.png", suffix=".png"))
+
+        # Averages the full image over the footprints [x0 + i * step_x, x0 + (i + 1) * step_x) of the output
+        # pixels (the same vertically); parts of a footprint outside the image are ignored.
+        def area_average(x0, y0, step_x, step_y, width, height):
+            def footprints(start, step, count, limit):
+                result = []
+                for i in range(count):
+                    begin = start + i * step
+                    end = begin + step
+                    result.append([(p, min(end, p + 1) - max(begin, p)) for p in range(int(begin), min(int(end) + 1, limit)) if min(end, p + 1) > max(begin, p)])
+                return result
+
+            x_footprints = footprints(x0, step_x, width, full_width)
+            y_footprints = footprints(y0, step_y, height, full_height)
+            result = []
+
+            for y_footprint in y_footprints:
+                for x_footprint in x_footprints:
+                    for c in range(3):
+                        total = sum(wy * wx * full_pixels[(py * full_width + px) * 3 + c] for py, wy in y_footprint for px, wx in x_footprint)
+                        result.append(total / sum(wy * wx for _, wy in y_footprint for _, wx in x_footprint))
+
+            return result
+
+        # Regions with odd offsets and sizes, with reduce factors 0 to 3 (1/8 is the smallest DCT scale). With a
+        # reduce factor r, libjpeg decodes to a grid of 2^r x 2^r pixel blocks of the full image; the region
+        # covers the blocks sx = x >> r to ex = (x + w + 2^r - 1) >> r, which are scaled to the requested size
+        # if that differs (e.g. 301 pixels at reduce 2 cover 77 blocks, but 76 pixels are requested).
+        regions = [
+            (1203, 1101, 301, 203, 0, 301, 203),
+            (1203, 1101, 301, 203, 1, 151, 102),
+            (1203, 1101, 301, 203, 2, 76, 51),
+            (1003, 777, 517, 389, 3, 65, 49),
+            (2000, 1999, 591, 573, 1, 296, 287)
+        ]
+
+        for x, y, w, h, reduce, width, height in regions:
+            url_path = "/knora/Leaves.jpg/{},{},{},{}/{},/0/default.png".format(x, y, w, h, width)
+            region_width, region_height, region_pixels = manager.read_rgb_image(manager.download_file(url_path, suffix=".png"))
+            assert (region_width, region_height) == (width, height), url_path
+
+            if reduce == 0:
+                expected = b"".join(full_pixels[((y + j) * full_width + x) * 3:((y + j) * full_width + x + w) * 3] for j in range(h))
+                assert region_pixels == expected, url_path
+                continue
+
+            block = 1 << reduce
+            sx = x >> reduce
+            sy = y >> reduce
+            ex = min((x + w + block - 1) >> reduce, (full_width + block - 1) >> reduce)
+            ey = min((y + h + block - 1) >> reduce, (full_height + block - 1) >> reduce)
+            expected = area_average(sx * block, sy * block, (ex - sx) * block / width, (ey - sy) * block / height, width, height)
+
+            # The DCT scaling is close to a block average; a region shifted by one block differs by far more.
+            errors = [abs(a - b) for a, b in zip(region_pixels, expected)]
+            assert max(errors) <= 4, "{}: maximal error {}".format(url_path, max(errors))
+            assert sum(errors) / len(errors) <= 1, "{}: mean error {}".format(url_path, sum(errors) / len(errors))
+
+    def test_repeated_color_conversions(self, manager):
+        """convert to the sRGB and gray profiles with a cached transform as with a new one"""
+        # the PNG and TIFF files are different renderings (and cache entries) of the same conversion; the
+        # conversions alternate, so that each PNG creates a transform which the TIFF finds in the cache
+        pixels = {}
+
+        for image_format in ["png", "tif"]:
+            for quality in ["color", "gray"]:
+                image_path = manager.download_file("/knora/Leaves.jpg/full/211,/0/{}.{}".format(quality, image_format), suffix="." + image_format)
+                pixels[(quality, image_format)] = manager.read_rgb_image(image_path)
+                os.remove(image_path)
+
+        for quality in ["color", "gray"]:
+            assert pixels[(quality, "png")] == pixels[(quality, "tif")], "{} conversions differ".format(quality)
+
+        assert pixels[("color", "png")] != pixels[("gray", "png")]
+
+    def test_concurrent_identical_requests(self, manager):
+        """render concurrent identical requests for an uncached image only once"""
+        url = manager.make_sipi_url("/knora/Leaves.jpg/full/,137/90/default.jpg")
+
+        def get_rotated(i):
+            response = requests.get(url)
+            assert response.status_code == 200
+            return response.content, response.headers["Link"]
+
+        with ThreadPoolExecutor(max_workers=8) as executor:
+            responses = list(executor.map(get_rotated, range(16)))
+
+        assert all(response == responses[0] for response in responses)
+
+        # Every rendering adds its file to the cache, which is recorded in the cache journal. The files written at
+        # the same time are synced and added together, and their records are written to the journal together.
+        canonical = responses[0][1].split(">")[0].replace("<http://", "")
+        deadline = time.time() + 10
+
+        while ("A", canonical) not in manager.read_cache_journal():
+            assert time.time() < deadline, "the rendering was not added to the cache journal"
+            time.sleep(0.2)
+
+        assert manager.read_cache_journal().count(("A", canonical)) == 1
+
+    def test_preflight_cache(self, manager):
+        """reuse the decisions of pre_flight until they expire or are invalidated"""
+        # pre_flight asks the fake Knora once per call; the cookie keeps the decisions of other tests apart
+        headers = {"Cookie": "preflight_test={}".format(time.time())}
+
+        # an allowed image, with preflight_ttl = 5
+        calls = manager.count_knora_requests("Leaves.jpg")
+
+        for i in range(3):
+            manager.expect_status_code("/knora/Leaves.jpg/info.json", 200, headers=headers)
+
+        assert manager.count_knora_requests("Leaves.jpg") == calls + 1
+        time.sleep(6)
+        manager.expect_status_code("/knora/Leaves.jpg/info.json", 200, headers=headers)
+        assert manager.count_knora_requests("Leaves.jpg") == calls + 2
+
+        # a denied image, with preflight_negative_ttl = 2
+        deny_calls = manager.count_knora_requests("DenyLeaves.jpg")
+
+        for i in range(3):
+            manager.expect_status_code("/knora/DenyLeaves.jpg/info.json", 401, headers=headers)
+
+        assert manager.count_knora_requests("DenyLeaves.jpg") == deny_calls + 1
+        time.sleep(3)
+        manager.expect_status_code("/knora/DenyLeaves.jpg/info.json", 401, headers=headers)
+        assert manager.count_knora_requests("DenyLeaves.jpg") == deny_calls + 2
+
+        # preflight_cache.invalidate removes the decision which is still valid
+        response = requests.get(manager.make_sipi_url("/test_preflight_cache"), params={"prefix": "knora", "identifier": "Leaves.jpg"})
+        assert response.status_code == 200
+        assert response.json()["invalidated"] >= 1
+        manager.expect_status_code("/knora/Leaves.jpg/info.json", 200, headers=headers)
+        assert manager.count_knora_requests("Leaves.jpg") == calls + 3
+
+    def test_cache_journal(self, manager):
+        """keep the cache index across restarts, and ignore a record torn by a crash"""
+        def get_cached(size):
+            return self.get_cached(manager, "/knora/Leaves.jpg/full/{}/0/default.jpg".format(size))
+
+        def cached_entries():
+            entries = set()
+
+            for type, canonical in manager.read_cache_journal():
+                if type == "A":
+                    entries.add(canonical)
+                else:
+                    entries.discard(canonical)
+
+            return entries
+
+        # the files are added once they are on the disk, and the journal is written once per second
+        first = get_cached("93,")
+        second = get_cached("94,")
+        time.sleep(3)
+        entries = cached_entries()
+        assert {first, second} <= entries
+
+        # on shutdown, the journal is replaced by a snapshot of the index
+        manager.stop_sipi()
+        assert cached_entries() == entries
+
+        # a record torn by a crash: its header announces more bytes than follow
+        with open(os.path.join(manager.sipi_cache_dir, ".sipicache.journal"), mode="ab") as journal_file:
+            journal_file.write(struct.pack("=II", 200, 0) + b"torn record")
+
+        manager.start_sipi()
+
+        # a cached file is not rendered again, and a new file is added after the cut-off torn record
+        assert get_cached("93,") == first
+        third = get_cached("95,")
+        time.sleep(3)
+        records = manager.read_cache_journal()
+        assert records.count(("A", first)) == 1
+        assert ("A", third) in records
+        assert cached_entries() == entries | {third}
+
+    def get_cached(self, manager, url_path):
+        """Requests an image and returns its canonical URL without the scheme, by which the cache indexes it."""
+        response = requests.get(manager.make_sipi_url(url_path))
+        assert response.status_code == 200
+        return response.headers["Link"].split(">")[0].replace("<http://", "")
+
+    def wait_for_cache(self, manager, condition, timeout=10):
+        """Polls the state of the cache until condition is true for it, and returns the state."""
+        deadline = time.time() + timeout
+
+        while True:
+            response = requests.get(manager.make_sipi_url("/test_cache"))
+            assert response.status_code == 200
+            state = response.json()
+
+            # an empty Lua table is sent as an array
+            state["entries"] = dict(state["entries"] or {})
+
+            if condition(state):
+                return state
+
+            assert time.time() < deadline, "the cache did not reach the expected state: {}".format(state)
+            time.sleep(0.2)
+
+    def test_cache_sync_delay(self, manager):
+        """add a rendering to the cache within the sync delay while other renderings keep the file writer busy"""
+        stop = time.time() + 15
+
+        def render_large(width):
+            # large renderings, so that the writer thread of the cache files always has data queued
+            while time.time() < stop:
+                requests.get(manager.make_sipi_url("/knora/Leaves.jpg/full/{},/0/default.png".format(width)))
+                width += 4
+
+        with ThreadPoolExecutor(max_workers=4) as executor:
+            try:
+                for i in range(4):
+                    executor.submit(render_large, 1500 + i)
+
+                time.sleep(1)
+                canonical = self.get_cached(manager, "/knora/Leaves.jpg/full/98,/0/default.jpg")
+                written = time.time()
+
+                # the files are synced at most a second after they have been written, and are added to the cache then
+                self.wait_for_cache(manager, lambda state: canonical in state["entries"], timeout=5)
+                assert time.time() - written < 3
+            finally:
+                stop = 0
+
+    def test_cache_eviction_order(self, manager):
+        """evict the least recently used files, whichever shard of the index they are in"""
+        manager.stop_sipi()
+        manager.clear_cache_dir()
+
+        try:
+            # the cache is full with 10 files, and is purged down to 7 files
+            manager.start_sipi("sipi.cache-test-config.lua")
+
+            # the access times have a resolution of one second
+            old = [self.get_cached(manager, "/knora/Leaves.jpg/full/{},/0/default.jpg".format(size)) for size in range(80, 85)]
+            self.wait_for_cache(manager, lambda state: state["nfiles"] == 5)
+            time.sleep(1.1)
+            newer = [self.get_cached(manager, "/knora/Leaves.jpg/full/{},/0/default.jpg".format(size)) for size in range(85, 88)]
+            self.wait_for_cache(manager, lambda state: state["nfiles"] == 8)
+            time.sleep(1.1)
+
+            # serving a file from the cache makes it the most recently used one
+            assert self.get_cached(manager, "/knora/Leaves.jpg/full/80,/0/default.jpg") == old[0]
+            assert self.get_cached(manager, "/knora/Leaves.jpg/full/81,/0/default.jpg") == old[1]
+            time.sleep(1.1)
+
+            # the tenth file fills the cache
+            newest = [self.get_cached(manager, "/knora/Leaves.jpg/full/{},/0/default.jpg".format(size)) for size in range(88, 90)]
+            state = self.wait_for_cache(manager, lambda state: state["nfiles"] < 10 and len(state["entries"]) == state["nfiles"])
+            assert set(state["entries"]) == set(old[:2] + newer + newest)
+        finally:
+            manager.stop_sipi()
+            manager.clear_cache_dir()
+            manager.start_sipi()
+
+    def test_cache_low_watermark(self, manager):
+        """purge a full cache in the background down to its low watermark"""
+        manager.stop_sipi()
+        manager.clear_cache_dir()
+
+        try:
+            # the cache is full with 10 files, and is purged down to 7 files (cache_hysteresis = 0.25)
+            manager.start_sipi("sipi.cache-test-config.lua")
+
+            for size in range(80, 89):
+                self.get_cached(manager, "/knora/Leaves.jpg/full/{},/0/default.jpg".format(size))
+
+            # below the limit, nothing is evicted
+            self.wait_for_cache(manager, lambda state: state["nfiles"] == 9)
+            time.sleep(1)
+            state = self.wait_for_cache(manager, lambda state: True)
+            assert state["nfiles"] == 9 and len(state["entries"]) == 9
+
+            # the tenth file wakes up the evictor, which does not stop right below the limit
+            self.get_cached(manager, "/knora/Leaves.jpg/full/89,/0/default.jpg")
+            state = self.wait_for_cache(manager, lambda state: state["nfiles"] < 10)
+            assert state["nfiles"] == 7
+            assert state["nfiles"] < (1 - 0.25) * state["max_nfiles"]
+            assert len(state["entries"]) == 7
+
+            # the evictor removes the files of the evicted entries from the cache directory
+            deadline = time.time() + 10
+
+            while len([name for name in os.listdir(manager.sipi_cache_dir) if not name.startswith(".")]) > 7:
+                assert time.time() < deadline, "the evicted files were not removed"
+                time.sleep(0.2)
+        finally:
+            manager.stop_sipi()
+            manager.clear_cache_dir()
+            manager.start_sipi()
+
+    def test_cache_reconciliation(self, manager):
+        """remove the files in the cache directory which are not in the index, and drop the entries without file"""
+        kept = self.get_cached(manager, "/knora/Leaves.jpg/full/96,/0/default.jpg")
+        lost = self.get_cached(manager, "/knora/Leaves.jpg/full/97,/0/default.jpg")
+        state = self.wait_for_cache(manager, lambda state: kept in state["entries"] and lost in state["entries"])
+        manager.stop_sipi()
+
+        # a file left over from an earlier run (the files created since the startup are kept)
+        stray_path = os.path.join(manager.sipi_cache_dir, "stray.jpg")
+
+        with open(stray_path, mode="wb") as stray_file:
+            stray_file.write(b"not in the index")
+
+        an_hour_ago = time.time() - 3600
+        os.utime(stray_path, (an_hour_ago, an_hour_ago))
+
+        # a cached file lost while Sipi was not running
+        os.remove(os.path.join(manager.sipi_cache_dir, state["entries"][lost]))
+
+        manager.start_sipi()
+        state = self.wait_for_cache(manager, lambda state: not state["reconciliation"]["running"])
+        reconciliation = state["reconciliation"]
+        assert reconciliation["scanned"] >= len(state["entries"]) + 1
+        assert reconciliation["removed"] >= 1
+        assert reconciliation["missing"] == 1
+        assert kept in state["entries"]
+        assert lost not in state["entries"]
+
+        # the evictor removes the unknown files
+        deadline = time.time() + 10
+
+        while os.path.exists(stray_path):
+            assert time.time() < deadline, "the unknown file was not removed"
+            time.sleep(0.2)
+
+        # the dropped entry is rendered and cached again
+        assert self.get_cached(manager, "/knora/Leaves.jpg/full/97,/0/default.jpg") == lost
+        self.wait_for_cache(manager, lambda state: lost in state["entries"])
+
+    def test_conditional_get(self, manager):
+        """answer requests with an up-to-date validator with 304 Not Modified"""
+        for path in ["/knora/Leaves.jpg/full/full/0/default.jpg", "/knora/Leaves.jpg/full/200,/0/default.jpg"]:
+            url = manager.make_sipi_url(path)
+            response = requests.get(url)
+            assert response.status_code == 200
+            etag = response.headers["ETag"]
+            last_modified = response.headers["Last-Modified"]
+
+            response = requests.get(url, headers={"If-None-Match": etag})
+            assert response.status_code == 304
+            assert response.headers["ETag"] == etag
+            assert len(response.content) == 0
+
+            assert requests.get(url, headers={"If-Modified-Since": last_modified}).status_code == 304
+            assert requests.get(url, headers={"If-None-Match": "\"other\""}).status_code == 200
+
+    def test_range_request(self, manager):
+        """serve byte ranges of unmodified files"""
+        url = manager.make_sipi_url("/knora/Leaves.jpg/full/full/0/default.jpg")
+        with open(manager.data_dir_path("knora/Leaves.jpg"), "rb") as image_file:
+            expected = image_file.read()
+
+        response = requests.get(url, headers={"Range": "bytes=100-199"})
+        assert response.status_code == 206
+        assert response.headers["Content-Range"] == "bytes 100-199/{}".format(len(expected))
+        assert response.content == expected[100:200]
+
+        response = requests.get(url, headers={"Range": "bytes=-50"})
+        assert response.status_code == 206
+        assert response.content == expected[-50:]
+
+        response = requests.get(url, headers={"Range": "bytes={}-".format(len(expected))})
+        assert response.status_code == 416
+
+    def test_idle_keep_alive_connections(self, manager):
+        """serve more idle keep-alive connections than there are worker threads"""
+        nsessions = 4 * multiprocessing.cpu_count() + 4
+        url = manager.make_sipi_url("/knora/Leaves.jpg/full/full/0/default.jpg")
+        sessions = [requests.Session() for i in range(nsessions)]
+
+        try:
+            for session in sessions:
+                assert session.get(url).status_code == 200
+
+            # every session still holds its (now idle) connection; they must not starve each other
+            for session in reversed(sessions):
+                assert session.get(url, timeout=10).status_code == 200
+        finally:
+            for session in sessions:
+                session.close()
+
+    def test_lua_request_overhead(self, manager):
+        """measure the per-request overhead of small IIIF requests, which all run the Lua pre-flight function"""
+        nrequests = 200
+        url = manager.make_sipi_url("/knora/Leaves.jpg/0,0,16,16/full/0/default.jpg")
+
+        with requests.Session() as session:
+            assert session.get(url).status_code == 200 # warm up the Lua interpreters
+            start = time.time()
+            for i in range(nrequests):
+                assert session.get(url).status_code == 200
+            elapsed = time.time() - start
+
+        print("\n{} small IIIF requests: {:.2f} ms per request".format(nrequests, 1000 * elapsed / nrequests))
+
+    def write_server_file(self, manager, filename, size):
+        """writes a file of random data to the document root of the server and returns the data"""
+        data = os.urandom(size)
+
+        with open(os.path.join(manager.sipi_working_dir, "server", filename), "wb") as data_file:
+            data_file.write(data)
+
+        return data
+
+    def server_file_urls(self, manager, filename):
+        """returns the URLs of a file in the document root over a plain connection and, if possible, a secure one"""
+        urls = {"plain": manager.make_sipi_url("/server/" + filename)}
+        ssl_url = manager.make_sipi_ssl_url("/server/" + filename)
+
+        if ssl_url is not None:
+            urls["ssl"] = ssl_url
+
+        return urls
+
+    @pytest.mark.filterwarnings("ignore:Unverified HTTPS request")
+    def test_file_download(self, manager):
+        """send static files unchanged over plain connections (with sendfile) and secure connections"""
+        for size in [1, 65537, 3 * 1024 * 1024 + 1]:
+            filename = "_download_{}.bin".format(size)
+            data = self.write_server_file(manager, filename, size)
+
+            try:
+                for connection, url in self.server_file_urls(manager, filename).items():
+                    response = requests.get(url, verify=False)
+                    assert response.status_code == 200
+                    assert response.content == data, "file of {} bytes differs over {} connection".format(size, connection)
+            finally:
+                os.remove(os.path.join(manager.sipi_working_dir, "server", filename))
+
+    @pytest.mark.benchmark
+    @pytest.mark.filterwarnings("ignore:Unverified HTTPS request")
+    def test_file_throughput(self, manager):
+        """measure the throughput of static file downloads over plain connections (with sendfile) and secure connections (through the buffer)"""
+        results = "\n"
+
+        for size_mb in [1, 10, 100]:
+            filename = "_throughput_{}MB.bin".format(size_mb)
+            data = self.write_server_file(manager, filename, size_mb * 1024 * 1024)
+            digest = hashlib.sha256(data).digest()
+
+            try:
+                for connection, url in self.server_file_urls(manager, filename).items():
+                    with requests.Session() as session:
+                        session.verify = False
+                        response = session.get(url) # warm up the page cache
+                        assert response.status_code == 200
+                        assert hashlib.sha256(response.content).digest() == digest
+
+                        nrequests = max(3, 100 // size_mb)
+                        start = time.time()
+                        for i in range(nrequests):
+                            response = session.get(url)
+                            assert len(response.content) == len(data)
+                        elapsed = time.time() - start
+
+                    results += "{} MB file, {} connection: {:.1f} MB/s\n".format(size_mb, connection, size_mb * nrequests / elapsed)
+            finally:
+                os.remove(os.path.join(manager.sipi_working_dir, "server", filename))
+
+        print(results)